@@ -5,3 +5,9 @@
 
 struct grass *grass = (void*)APPS_STACK_TOP;
 struct earth *earth = (void*)GRASS_STACK_TOP;
+
+/* The output of printf() in apps goes to the pipe of a pipeline if the
+ * app feeds one, see stdout_write(); INFO() and the others keep going
+ * to the tty, like stderr */
+#undef printf
+#define printf app_printf
@@ -0,0 +1,37 @@
+#pragma once
+
+/* Helpers of the apps/user/bench_*.c benchmarks; each result is printed
+ * as one line "BENCH <name> <iterations> <cycles/iteration> <iterations/s>"
+ * which `make bench` collects into build/bench.txt */
+#include "app.h"
+#include <stdlib.h>
+
+#define MTIME_HZ (earth->platform == ARTY? 32768 : 10000000)
+
+struct bench {
+    unsigned int cycles;
+    unsigned long long time;
+};
+
+static unsigned int bench_cycles() {
+    unsigned int cycle;
+    asm volatile("csrr %0, cycle" : "=r"(cycle));
+    return cycle;
+}
+
+static void bench_start(struct bench* b) {
+    b->time = earth->timer_get();
+    b->cycles = bench_cycles();
+}
+
+static void bench_end(struct bench* b, char* name, int iters) {
+    unsigned int cycles = bench_cycles() - b->cycles;
+    unsigned long long ticks = earth->timer_get() - b->time;
+    unsigned int rate = ticks? iters * (unsigned long long)MTIME_HZ / ticks : 0;
+    printf("BENCH %s %d %u %u\r\n", name, iters, cycles / iters, rate);
+}
+
+static int bench_iters(int argc, char** argv, int iters) {
+    int n = (argc > 1)? atoi(argv[1]) : iters;
+    return n > 0? n : 1;
+}
@@ -13,10 +13,8 @@
 #include <stdlib.h>
 
 /* To understand directory management, read tools/mkfs.c */
-int dir_do_lookup(int dir_ino, char* name) {
-    char buf[BLOCK_SIZE];
-    file_read(dir_ino, 0, buf);
-
+static int dir_text_lookup(char* buf, char* name) {
+    /* The legacy format is a text string of "name ino " pairs in block 0 */
     for (int i = 0, namelen = strlen(name); i < strlen(buf) - namelen; i++)
         if (!strncmp(name, buf + i, namelen) &&
             buf[i + namelen] == ' ' && (i == 0 || buf[i - 1] == ' '))
@@ -25,6 +23,103 @@ int dir_do_lookup(int dir_ino, char* name) {
     return -1;
 }
 
+static struct dir_entry entries[DIR_ENTRIES_PER_BLOCK];
+static int entries_ino = -1, entries_block;
+
+static struct dir_entry* dir_entry_get(int dir_ino, int slot) {
+    int block = slot / DIR_ENTRIES_PER_BLOCK;
+    if (entries_ino != dir_ino || entries_block != block) {
+        if (file_read(dir_ino, block, (void*)entries) < 0) {
+            entries_ino = -1;
+            return NULL;
+        }
+        entries_ino = dir_ino;
+        entries_block = block;
+    }
+    return &entries[slot % DIR_ENTRIES_PER_BLOCK];
+}
+
+/* Probe the hash table for name and return its slot, or -1 if not found;
+ * if free is not NULL, also return the first empty or removed slot */
+static int dir_probe(int dir_ino, int nblocks, char* name, int* free) {
+    unsigned int hash = dir_hash(name);
+    int nslots = DIR_NSLOTS(nblocks), slot = dir_slot(hash, nblocks);
+    if (free) *free = -1;
+
+    for (int i = 1; i < nslots; i++) {
+        struct dir_entry* entry = dir_entry_get(dir_ino, slot);
+        if (entry == NULL) return -1;
+
+        if (entry->hash == DIR_HASH_EMPTY) {
+            if (free && *free == -1) *free = slot;
+            return -1;
+        }
+        if (entry->hash == DIR_HASH_REMOVED) {
+            if (free && *free == -1) *free = slot;
+        } else if (entry->hash == hash &&
+                   !strncmp(entry->name, name, DIR_ENTRY_NAME_SIZE)) {
+            return slot;
+        }
+        slot = (slot + 1 == nslots)? 1 : slot + 1;
+    }
+    return -1;
+}
+
+/* Return the number of blocks of a hashed directory, or 0 for a block 0
+ * in the legacy text format (a copy of which is left in buf) */
+static int dir_nblocks(int dir_ino, char* buf) {
+    struct dir_entry* entry = dir_entry_get(dir_ino, 0);
+    if (entry == NULL) return -1;
+
+    struct dir_header* header = (void*)entry;
+    if (header->magic == DIR_MAGIC) return header->nblocks;
+
+    memcpy(buf, entries, BLOCK_SIZE);
+    return 0;
+}
+
+static int dir_entry_put(int dir_ino, int slot) {
+    return file_write(dir_ino, slot / DIR_ENTRIES_PER_BLOCK, (void*)entries);
+}
+
+int dir_do_lookup(int dir_ino, char* name) {
+    char buf[BLOCK_SIZE];
+    int nblocks = dir_nblocks(dir_ino, buf);
+    if (nblocks < 0) return -1;
+    if (nblocks == 0) return dir_text_lookup(buf, name);
+
+    int slot = dir_probe(dir_ino, nblocks, name, NULL);
+    return slot == -1? -1 : dir_entry_get(dir_ino, slot)->ino;
+}
+
+int dir_do_insert(int dir_ino, char* name, int ino) {
+    char buf[BLOCK_SIZE];
+    int nblocks = dir_nblocks(dir_ino, buf), free;
+    if (nblocks <= 0 || strlen(name) >= DIR_ENTRY_NAME_SIZE) return -1;
+
+    /* Fail if name exists or the table is full */
+    if (dir_probe(dir_ino, nblocks, name, &free) != -1 || free == -1)
+        return -1;
+
+    struct dir_entry* entry = dir_entry_get(dir_ino, free);
+    entry->hash = dir_hash(name);
+    entry->ino = ino;
+    strncpy(entry->name, name, DIR_ENTRY_NAME_SIZE);
+    return dir_entry_put(dir_ino, free);
+}
+
+int dir_do_remove(int dir_ino, char* name) {
+    char buf[BLOCK_SIZE];
+    int nblocks = dir_nblocks(dir_ino, buf);
+    if (nblocks <= 0) return -1;
+
+    int slot = dir_probe(dir_ino, nblocks, name, NULL);
+    if (slot == -1) return -1;
+
+    dir_entry_get(dir_ino, slot)->hash = DIR_HASH_REMOVED;
+    return dir_entry_put(dir_ino, slot);
+}
+
 int main() {
     SUCCESS("Enter kernel process GPID_DIR");
 
@@ -33,22 +128,30 @@ int main() {
     strcpy(buf, "Finish GPID_DIR initialization");
     grass->sys_send(GPID_PROCESS, buf, 31);
 
-    /* Wait for directory requests */
+    /* Wait for directory requests; each reply is sent in the same
+     * system call which waits for the next request */
+    int sender;
+    grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
     while (1) {
-        int sender;
         struct dir_request *req = (void*)buf;
         struct dir_reply *reply = (void*)buf;
-        grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
 
         switch (req->type) {
         case DIR_LOOKUP:
             reply->ino = dir_do_lookup(req->ino, req->name);
             reply->status = reply->ino == -1? DIR_ERROR : DIR_OK;
-            grass->sys_send(sender, (void*)reply, sizeof(*reply));
             break;
-        case DIR_INSERT: case DIR_REMOVE: default:
-            /* This part is left to students as an exercise */
+        case DIR_INSERT:
+            reply->status = dir_do_insert(req->ino, req->name, req->entry_ino) == 0? DIR_OK : DIR_ERROR;
+            grass->dir_generation++;
+            break;
+        case DIR_REMOVE:
+            reply->status = dir_do_remove(req->ino, req->name) == 0? DIR_OK : DIR_ERROR;
+            grass->dir_generation++;
+            break;
+        default:
             FATAL("sys_dir: request%d not implemented", req->type);
         }
+        grass->sys_reply_recv(sender, (void*)reply, sizeof(*reply), &sender, buf, SYSCALL_MSG_LEN);
     }
 }
@@ -6,39 +6,284 @@
 /* Author: Yunhao Zhang
  * Description: the file (inode) system server
  * handling requests to reading and writing inodes
+ * A client reading a file sequentially gets the next blocks prefetched
+ * into the block cache after each reply, while it is still processing.
  */
 
 #include "app.h"
 #include "file.h"
 #include <string.h>
 
+/* Number of disk blocks cached below the treedisk file system */
+#define NCACHED_BLOCKS  8
+
+/* Adjacent writes to one inode are collected in a small buffer, which is
+ * flushed when it fills, when a non-adjacent write arrives, on FILE_SYNC,
+ * or when it has been held for about 10 scheduler quanta.  Its writers
+ * got FILE_OK already, so a failed flush is reported to the next write
+ * of the same inode and to the next FILE_SYNC, not to whoever caused it */
+#define WBUF_NBLOCKS    2
+#define WBUF_MAX_AGE    (earth->platform == ARTY? 50000 : 5000000)
+
+static inode_intf fs, cache;
+static struct {
+    int ino, nblocks;
+    unsigned int offset;
+    unsigned long long time;            /* mtime of the first write */
+    block_t block[WBUF_NBLOCKS];
+} wbuf = { .ino = -1 };
+static int wbuf_error_ino = -1;         /* whose blocks failed to be written */
+static int wbuf_sync_error;             /* a flush failed since FILE_SYNC */
+
+static void wbuf_flush() {
+    for (int i = 0; i < wbuf.nblocks; i++)
+        if (fs->write(fs, wbuf.ino, wbuf.offset + i, &wbuf.block[i]) < 0) {
+            wbuf_error_ino = wbuf.ino;
+            wbuf_sync_error = 1;
+        }
+    wbuf.ino = -1;
+    wbuf.nblocks = 0;
+}
+
+/* Return -1, once, if buffered blocks of ino failed to be written */
+static int wbuf_error(int ino) {
+    if (wbuf_error_ino != ino) return 0;
+    wbuf_error_ino = -1;
+    return -1;
+}
+
+static int wbuf_write(unsigned int ino, unsigned int offset, block_t* block) {
+    if (wbuf.ino == ino && offset >= wbuf.offset &&
+        offset < wbuf.offset + wbuf.nblocks) {
+        /* Overwrite a block which is already buffered */
+        memcpy(&wbuf.block[offset - wbuf.offset], block, BLOCK_SIZE);
+        return wbuf_error(ino);
+    }
+
+    if (wbuf.ino != ino || offset != wbuf.offset + wbuf.nblocks ||
+        wbuf.nblocks == WBUF_NBLOCKS)
+        wbuf_flush();
+
+    if (wbuf.ino == -1) {
+        wbuf.ino = ino;
+        wbuf.offset = offset;
+        wbuf.time = earth->timer_get();
+    }
+    memcpy(&wbuf.block[wbuf.nblocks++], block, BLOCK_SIZE);
+    return wbuf_error(ino);
+}
+
+/* Sequential readahead
+ *
+ * Each (client, ino) read stream remembers where the client will read
+ * next; a read from there is sequential and asks for the window of blocks
+ * after it.  A prefetched block which is still cached when it is read
+ * widens the window by one, up to RA_MAX_WINDOW, and one which was evicted
+ * before its read halves it; the window stays well below NCACHED_BLOCKS
+ * so that prefetching does not evict the metadata blocks.
+ */
+#define NSTREAMS        4
+#define RA_MAX_WINDOW   4
+static struct stream {
+    int client;                         /* 0 if the slot is unused */
+    unsigned int ino, size;             /* size in blocks, when last read */
+    unsigned int next;                  /* offset of the next sequential read */
+    unsigned int ra_start, ra_next;     /* blocks prefetched, [ra_start, ra_next) */
+    unsigned int ra_end;                /* and the end of the window */
+    int window;
+    unsigned int last_use;
+} streams[NSTREAMS];
+static unsigned int stream_clock;
+
+static struct stream* stream_get(int client, unsigned int ino) {
+    struct stream* s = &streams[0];
+    for (int i = 0; i < NSTREAMS; i++) {
+        if (streams[i].client == client && streams[i].ino == ino) {
+            s = &streams[i];
+            s->last_use = ++stream_clock;
+            return s;
+        }
+        if (streams[i].last_use < s->last_use) s = &streams[i];
+    }
+
+    /* Replace the least recently used stream */
+    memset(s, 0, sizeof(*s));
+    s->client = client;
+    s->ino = ino;
+    s->next = -1;
+    s->window = 1;
+    s->last_use = ++stream_clock;
+    return s;
+}
+
+/* The block cache counts a miss for every block it reads from the disk */
+static unsigned int cache_misses() {
+    struct cache_stats stats;
+    cachedisk_stats(cache, &stats);
+    return stats.misses;
+}
+
+static int file_read_block(unsigned int ino, unsigned int offset, block_t* block);
+
+/* Serve nblocks from offset of ino to client and plan the readahead */
+static int stream_read(int client, unsigned int ino, unsigned int offset,
+                       int nblocks, block_t* blocks) {
+    struct stream* s = stream_get(client, ino);
+    int n;
+    for (n = 0; n < nblocks; n++) {
+        unsigned int misses = cache_misses();
+        if (file_read_block(ino, offset + n, &blocks[n]) < 0) break;
+
+        /* Adapt the window to whether the prefetched block was still cached */
+        if (offset + n >= s->ra_start && offset + n < s->ra_next) {
+            if (cache_misses() == misses) {
+                if (s->window < RA_MAX_WINDOW) s->window++;
+            } else if (s->window > 1) {
+                s->window /= 2;
+            }
+        }
+    }
+
+    /* Only a sequential read moves the window forward */
+    if (n > 0 && offset == s->next) {
+        if (s->ra_next < offset + n || s->ra_next > offset + n + s->window) {
+            s->ra_start = s->ra_next = offset + n;
+            s->size = fs->getsize(fs, ino);
+        }
+        s->ra_end = offset + n + s->window;
+        if (s->ra_end > s->size) s->ra_end = s->size;
+    }
+    s->next = offset + n;
+    return n;
+}
+
+/* Return a stream with a window left to fill, or NULL */
+static struct stream* readahead_pending() {
+    for (int i = 0; i < NSTREAMS; i++)
+        if (streams[i].client && streams[i].ra_next < streams[i].ra_end) return &streams[i];
+    return NULL;
+}
+
+/* Prefetch one block of a stream into the block cache; return 0 if there
+ * is nothing to prefetch */
+static int readahead_step() {
+    static block_t scratch;
+    struct stream* s = readahead_pending();
+    if (!s) return 0;
+    if (fs->read(fs, s->ino, s->ra_next, &scratch) < 0) s->ra_end = s->ra_next;
+    else s->ra_next++;
+    return 1;
+}
+
+static int file_read_block(unsigned int ino, unsigned int offset, block_t* block) {
+    /* Serve reads of buffered blocks from the write buffer */
+    if (wbuf.ino == ino && offset >= wbuf.offset &&
+        offset < wbuf.offset + wbuf.nblocks) {
+        memcpy(block, &wbuf.block[offset - wbuf.offset], BLOCK_SIZE);
+        return 0;
+    }
+    return fs->read(fs, ino, offset, block);
+}
+
+/* Wait for the next request; while the write buffer holds blocks, wait
+ * only until it is WBUF_MAX_AGE old and write it back then */
+static void file_recv(int* sender, char* buf) {
+    while (wbuf.ino != -1) {
+        unsigned long long age = earth->timer_get() - wbuf.time;
+        if (age < WBUF_MAX_AGE &&
+            grass->sys_recv_timed(sender, buf, SYSCALL_MSG_LEN, WBUF_MAX_AGE - age) >= 0)
+            return;
+        wbuf_flush();
+        if (cachedisk_sync(cache) < 0) wbuf_sync_error = 1;
+    }
+    grass->sys_recv(sender, buf, SYSCALL_MSG_LEN);
+}
+
 int main() {
     SUCCESS("Enter kernel process GPID_FILE");
 
-    /* Initialize the file system interface */
-    inode_intf fs = treedisk_init(fs_disk_init(), 0);
+    /* Initialize the file system interface;
+     * the block cache keeps hot metadata blocks (superblock, inode
+     * blocks and indirect blocks) in memory after the first access */
+    cache = cachedisk_init(fs_disk_init(), NCACHED_BLOCKS);
+    fs = treedisk_init(cache, 0);
 
     /* Send a notification to GPID_PROCESS */
     char buf[SYSCALL_MSG_LEN];
     strcpy(buf, "Finish GPID_FILE initialization");
     grass->sys_send(GPID_PROCESS, buf, 32);
 
-    /* Wait for inode read/write requests */
+    /* Wait for inode read/write requests; each reply is sent in the
+     * same system call which waits for the next request */
+    int sender;
+    file_recv(&sender, buf);
     while (1) {
-        int sender, r;
+        int r, n, len;
+        unsigned int ino, offset, nblocks;
         struct file_request *req = (void*)buf;
         struct file_reply *reply = (void*)buf;
-        grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
+
+        /* Flush a write buffer which has been held for too long */
+        if (wbuf.ino != -1 && earth->timer_get() - wbuf.time > WBUF_MAX_AGE) {
+            wbuf_flush();
+            if (cachedisk_sync(cache) < 0) wbuf_sync_error = 1;
+        }
 
         switch (req->type) {
         case FILE_READ:
-            r = fs->read(fs, req->ino, req->offset, (void*)&reply->block);
+            /* reply overlaps req in buf, so copy the request out first */
+            ino = req->ino;
+            offset = req->offset;
+            r = stream_read(sender, ino, offset, 1, (void*)&reply->block[0]) == 1? 0 : -1;
             reply->status = r == 0 ? FILE_OK : FILE_ERROR;
-            grass->sys_send(sender, (void*)reply, sizeof(*reply));
+            reply->nblocks = r == 0 ? 1 : 0;
+            len = sizeof(*reply);
             break;
-        case FILE_WRITE: default:
-            /* This part is left to students as an exercise */
+        case FILE_READ_RANGE:
+            /* reply overlaps req in buf, so copy the request out first */
+            ino = req->ino;
+            offset = req->offset;
+            nblocks = req->nblocks < FILE_RANGE_NBLOCKS? req->nblocks : FILE_RANGE_NBLOCKS;
+
+            n = stream_read(sender, ino, offset, nblocks, (void*)reply->block);
+            reply->status = n > 0 ? FILE_OK : FILE_ERROR;
+            reply->nblocks = n;
+            len = sizeof(*reply);
+            break;
+        case FILE_WRITE:
+        case FILE_WRITE_RANGE:
+            nblocks = req->type == FILE_WRITE? 1 : req->nblocks;
+            if (nblocks > FILE_RANGE_NBLOCKS) nblocks = FILE_RANGE_NBLOCKS;
+
+            for (r = 0, n = 0; n < nblocks; n++)
+                if (wbuf_write(req->ino, req->offset + n, &req->block[n]) < 0) r = -1;
+            grass->file_version[req->ino % NFILE_VERSIONS]++;
+            reply->status = r == 0 ? FILE_OK : FILE_ERROR;
+            len = sizeof(reply->status);
+            break;
+        case FILE_SYNC:
+            wbuf_flush();
+            r = (cachedisk_sync(cache) < 0 || wbuf_sync_error)? -1 : 0;
+            wbuf_sync_error = 0;
+            wbuf_error_ino = -1;
+            reply->status = r == 0 ? FILE_OK : FILE_ERROR;
+            len = sizeof(reply->status);
+            break;
+        default:
             FATAL("sys_file: request%d not implemented", req->type);
         }
+
+        /* Reply first, then prefetch between polls for the next request;
+         * with blocks in the write buffer, the wait has a deadline */
+        if (!readahead_pending() && wbuf.ino == -1) {
+            grass->sys_reply_recv(sender, (void*)reply, len, &sender, buf, SYSCALL_MSG_LEN);
+            continue;
+        }
+        grass->sys_send(sender, (void*)reply, len);
+        while (grass->sys_try_recv(&sender, buf, SYSCALL_MSG_LEN) < 0)
+            if (!readahead_step()) {
+                file_recv(&sender, buf);
+                break;
+            }
     }
 }
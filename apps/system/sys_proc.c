@@ -13,15 +13,29 @@
 #include <string.h>
 
 static int app_ino, app_pid;
+#define NSTAGES 3                       /* commands in a pipeline, see app_spawn() */
+static int stage_pids[NSTAGES], nstages;
 static void sys_spawn(int base);
 static int app_spawn(struct proc_request *req);
+static void image_init();
+static void proc_info_fill(struct proc_info_reply* reply);
+static void boot_summary();
+
+/* Processes spawned in the foreground and the processes waiting for them */
+#define NWAITERS 8
+static struct { int pid, parent; } waiters[NWAITERS];
+static int waiter_add(int pid, int parent);
+static int waiter_remove(int pid);
+static int waiter_find(int parent);
 
 int main() {
     SUCCESS("Enter kernel process GPID_PROCESS");    
+    grass->boot_time[BOOT_PROC] = earth->timer_get();
 
-    int sender, shell_waiting;
+    int sender, parent, background;
     char buf[SYSCALL_MSG_LEN];
 
+    image_init();
     sys_spawn(SYS_FILE_EXEC_START);
     grass->sys_recv(NULL, buf, SYSCALL_MSG_LEN);
     INFO("sys_proc receives: %s", buf);
@@ -31,57 +45,241 @@ int main() {
     INFO("sys_proc receives: %s", buf);
 
     sys_spawn(SYS_SHELL_EXEC_START);
+    grass->boot_time[BOOT_SERVERS] = earth->timer_get();
+    boot_summary();
     
+    /* Replies to the shell are sent in the same system call which
+     * waits for the next request */
+    grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
     while (1) {
         struct proc_request *req = (void*)buf;
         struct proc_reply *reply = (void*)buf;
-        grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
+        struct trace_reply *trace = (void*)buf;
+        int reply_to = 0, reply_len = sizeof(*reply);
+        unsigned int seq;
 
         switch (req->type) {
         case PROC_SPAWN:
+            /* reply overlaps req in buf, so check for "&" first */
+            background = (req->argv[req->argc - 1][0] == '&');
             reply->type = app_spawn(req) < 0 ? CMD_ERROR : CMD_OK;
+            reply->pid = reply->type == CMD_OK? app_pid : -1;
 
-            /* Handling background processes */
-            shell_waiting = (req->argv[req->argc - 1][0] != '&');
-            if (!shell_waiting && app_pid > 0)
-                INFO("process %d running in the background", app_pid);
-            grass->sys_send(GPID_SHELL, (void*)reply, sizeof(reply));
+            /* Handling background processes; the parent of a pipeline
+             * waits until all of its commands have exited */
+            if (reply->type == CMD_OK) {
+                if (!background)
+                    for (int i = 0; i < nstages; i++) waiter_add(stage_pids[i], sender);
+                else if (sender == GPID_SHELL)
+                    INFO("process %d running in the background", app_pid);
+            }
+            reply_to = sender;
             break;
         case PROC_EXIT:
             grass->proc_free(sender);
 
-            if (shell_waiting && app_pid == sender)
-                grass->sys_send(GPID_SHELL, (void*)reply, sizeof(reply));
+            if ((parent = waiter_remove(sender)) > 0)
+                reply_to = waiter_find(parent)? 0 : parent;
             else
                 INFO("background process %d terminated", sender);
             break;
         case PROC_KILLALL:
-            grass->proc_free(-1); break;
+            grass->proc_free(-1);
+            for (int i = 0; i < NWAITERS; i++) waiters[i].pid = 0;
+            break;
+        case PROC_NULL:
+            reply_to = sender;
+            reply_len = 0;
+            break;
+        case PROC_PROF:
+            grass->prof_ctl(req->argc, (void*)buf);
+            reply_to = sender;
+            reply_len = sizeof(struct prof_reply);
+            break;
+        case PROC_TRACE:
+            /* reply overlaps req in buf, so copy the request out first */
+            seq = req->argc;
+            trace->nevents = grass->trace_read(&seq, trace->events, TRACE_NREAD);
+            trace->seq = seq;
+            reply_to = sender;
+            reply_len = sizeof(struct trace_reply);
+            break;
+        case PROC_INFO:
+            proc_info_fill((void*)buf);
+            reply_to = sender;
+            reply_len = sizeof(struct proc_info_reply);
+            break;
         default:
             FATAL("sys_proc: invalid request %d", req->type);
         }
+
+        if (reply_to)
+            grass->sys_reply_recv(reply_to, (void*)reply, reply_len, &sender, buf, SYSCALL_MSG_LEN);
+        else
+            grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
     }
 }
 
-static int app_read(int off, char* dst) { file_read(app_ino, off, dst); }
+static void boot_summary() {
+    static char* name[] = {"start", "tty", "disk", "cpu", "grass", "sys_proc", "servers"};
+    unsigned int* t = grass->boot_time;
+    printf("[INFO] Boot phases in mtime ticks:");
+    for (int i = BOOT_TTY; i < BOOT_NPHASES; i++) printf(" %s %u", name[i], t[i] - t[i - 1]);
+    printf(", total %u\r\n", t[BOOT_SERVERS] - t[BOOT_START]);
+}
 
-static int app_spawn(struct proc_request *req) {
+static int waiter_add(int pid, int parent) {
+    for (int i = 0; i < NWAITERS; i++)
+        if (waiters[i].pid == 0) {
+            waiters[i].pid = pid;
+            waiters[i].parent = parent;
+            return 0;
+        }
+    return -1;
+}
+
+/* Return the process waiting for pid, or -1 if none is */
+static int waiter_remove(int pid) {
+    for (int i = 0; i < NWAITERS; i++)
+        if (waiters[i].pid == pid) {
+            waiters[i].pid = 0;
+            return waiters[i].parent;
+        }
+    return -1;
+}
+
+/* Is a process still running in the foreground of parent? */
+static int waiter_find(int parent) {
+    for (int i = 0; i < NWAITERS; i++)
+        if (waiters[i].pid && waiters[i].parent == parent) return 1;
+    return 0;
+}
+
+static void proc_info_fill(struct proc_info_reply* reply) {
+    reply->nprocs = 0;
+    reply->idle = grass->proc_idle_time();
+    for (int i = 0; i < grass->proc_nslots && reply->nprocs < PROC_INFO_MAX; i++)
+        if (grass->proc_info(i, &reply->procs[reply->nprocs]) == 0) reply->nprocs++;
+}
+
+static int app_read(int off, int nblocks, char* dst) {
+    return file_read_range(app_ino, off, nblocks, dst) == nblocks? 0 : -1;
+}
+
+/* Recently spawned app images are kept in unmapped frames, so spawning
+ * the same app again only copies frames instead of reading the file;
+ * the cache is dropped whenever a directory changes, and an image when
+ * the version of its file changes with a write.  A new process
+ * gets its copy of a page when it first touches the page, so a frame
+ * is handed to the processes still waiting for it before it is freed */
+#define NCACHED_IMAGES 4
+static struct image {
+    int ino;                            /* -1 if the slot is empty */
+    unsigned int last_use;
+    unsigned int version;               /* grass->file_version when loaded */
+    int frames[APPS_NPAGES];
+} images[NCACHED_IMAGES];
+static unsigned int image_clock, image_generation;
+
+static void image_init() {
+    for (int i = 0; i < NCACHED_IMAGES; i++) images[i].ino = -1;
+}
+
+static void image_drop(struct image* img) {
+    for (int i = 0; i < APPS_NPAGES; i++) {
+        if (img->frames[i] == -1) continue;
+        grass->proc_map_drop(img->frames[i]);
+        earth->mmu_free_frame(img->frames[i]);
+    }
+    img->ino = -1;
+}
+
+static struct image* image_get(int ino) {
+    if (image_generation != grass->dir_generation) {
+        for (int i = 0; i < NCACHED_IMAGES; i++)
+            if (images[i].ino != -1) image_drop(&images[i]);
+        image_generation = grass->dir_generation;
+    }
+
+    /* Find the image or evict the least recently used one */
+    struct image* img = &images[0];
+    for (int i = 0; i < NCACHED_IMAGES; i++) {
+        if (images[i].ino == ino &&
+            images[i].version != grass->file_version[ino % NFILE_VERSIONS])
+            image_drop(&images[i]);     /* The file was written since */
+        if (images[i].ino == ino) {
+            images[i].last_use = ++image_clock;
+            return &images[i];
+        }
+        if (images[i].ino == -1 ||
+            (img->ino != -1 && images[i].last_use < img->last_use))
+            img = &images[i];
+    }
+    if (img->ino != -1) image_drop(img);
+
+    img->version = grass->file_version[ino % NFILE_VERSIONS];
+    if (elf_load_image(app_read, img->frames) < 0) return NULL;
+    img->ino = ino;
+    img->last_use = ++image_clock;
+    return img;
+}
+
+/* Load the command in argv[0 .. argc-1] into a new process, which is not
+ * ready to run yet; return its pid, or -1 */
+static int cmd_spawn(int argc, char (*argv)[CMD_ARG_LEN]) {
     int bin_ino = dir_lookup(0, "bin/");
-    if ((app_ino = dir_lookup(bin_ino, req->argv[0])) < 0) return -1;
+    if (argc == 0 || (app_ino = dir_lookup(bin_ino, argv[0])) < 0) return -1;
+
+    struct image* img = image_get(app_ino);
+    if (img == NULL) return -1;
 
-    app_pid = grass->proc_alloc();
+    int pid = grass->proc_alloc();
+
+    /* Give the new process its own copy of the cached image, page by
+     * page as it touches them; the argument and stack pages are mapped
+     * now since the trap handlers run on the stack of the process */
+    int ret = 0;
+    for (int i = 0; ret == 0 && i < APPS_NPAGES; i++)
+        ret = grass->proc_map_lazy(pid, (APPS_ENTRY >> 12) + i, img->frames[i]);
+    if (ret < 0 || elf_load_args(pid, argc, (void**)argv) < 0) {
+        grass->proc_free(pid);
+        return -1;
+    }
+    return pid;
+}
+
+/* Spawn the commands of a pipeline "cmd1 | cmd2 | ...", each feeding the
+ * next through a pipe in the kernel; app_pid is the last command */
+static int app_spawn(struct proc_request *req) {
     int argc = req->argv[req->argc - 1][0] == '&'? req->argc - 1 : req->argc;
 
-    elf_load(app_pid, app_read, argc, (void**)req->argv);
-    grass->proc_set_ready(app_pid);
+    nstages = 0;
+    for (int start = 0, i = 0; i <= argc; i++) {
+        if (i < argc && strcmp(req->argv[i], "|")) continue;
+
+        int pid = (nstages < NSTAGES)? cmd_spawn(i - start, &req->argv[start]) : -1;
+        if (pid > 0 && nstages > 0 && grass->proc_pipe(stage_pids[nstages - 1], pid) < 0) {
+            grass->proc_free(pid);
+            pid = -1;
+        }
+        if (pid < 0) {
+            while (nstages) grass->proc_free(stage_pids[--nstages]);
+            return -1;
+        }
+        stage_pids[nstages++] = pid;
+        start = i + 1;
+    }
+
+    for (int i = 0; i < nstages; i++) grass->proc_set_ready(stage_pids[i]);
+    app_pid = stage_pids[nstages - 1];
     return 0;
 }
 
 static int sys_proc_base;
 char* sysproc_names[] = {"sys_proc", "sys_file", "sys_dir", "sys_shell"};
 
-static int sys_proc_read(int block_no, char* dst) {
-    return earth->disk_read(sys_proc_base + block_no, 1, dst);
+static int sys_proc_read(int block_no, int nblocks, char* dst) {
+    return earth->disk_read(sys_proc_base + block_no, nblocks, dst);
 }
 
 static void sys_spawn(int base) {
@@ -89,6 +287,6 @@ static void sys_spawn(int base) {
     INFO("Load kernel process #%d: %s", pid, sysproc_names[pid - 1]);
 
     sys_proc_base = base;
-    elf_load(pid, sys_proc_read, 0, NULL);
+    elf_load(pid, sys_proc_read, base, 0, NULL);
     grass->proc_set_ready(pid);
 }
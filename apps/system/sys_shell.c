@@ -5,6 +5,8 @@
 
 /* Author: Yunhao Zhang
  * Description: a simple shell
+ * A command line is one command or a pipeline "cmd1 | cmd2", optionally
+ * followed by "&"; sys_proc spawns and connects the commands.
  */
 
 #include "app.h"
@@ -14,8 +16,14 @@ int parse_request(char* buf, struct proc_request* req) {
     int idx = 0, nargs = 0;
     memset(req->argv, 0, CMD_NARGS * CMD_ARG_LEN);
 
+    /* A '|' is an argument of its own even without spaces around it */
     for (int i = 0; i < strlen(buf); i++)
-        if (buf[i] != ' ') {
+        if (buf[i] == '|') {
+            if (idx != 0 && ++nargs >= CMD_NARGS) return -1;
+            req->argv[nargs][0] = '|';
+            idx = 0;
+            if (++nargs >= CMD_NARGS) return -1;
+        } else if (buf[i] != ' ') {
             req->argv[nargs][idx] = buf[i];
             if (++idx >= CMD_ARG_LEN) return -1;
         } else if (idx != 0) {
@@ -43,8 +51,7 @@ int main() {
             if (0 != parse_request(buf, &req)) {
                 INFO("sys_shell: too many arguments or argument too long");
             } else {
-                grass->sys_send(GPID_PROCESS, (void*)&req, sizeof(req));
-                grass->sys_recv(NULL, (void*)&reply, sizeof(reply));
+                grass->sys_call(GPID_PROCESS, (void*)&req, sizeof(req), (void*)&reply, sizeof(reply));
 
                 if (reply.type != CMD_OK)
                     INFO("sys_shell: command causes an error");
@@ -56,6 +63,6 @@ int main() {
 
         do {
             printf("\x1B[1;32m➜ \x1B[1;36m%s\x1B[1;0m ", grass->workdir);
-        } while (earth->tty_read(buf, 256) == 0);
+        } while (grass->sys_tty_read(buf, 256) == 0);
     }
 }
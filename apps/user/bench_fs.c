@@ -0,0 +1,76 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: measure directory lookups, file reads of 1, 8 and 64
+ * blocks, and hits and misses in the block cache of GPID_FILE
+ */
+
+#include "bench.h"
+#include <string.h>
+
+#define MAX_NBLOCKS 64
+#define CACHE_NBLOCKS 8    /* NCACHED_BLOCKS in sys_file.c */
+
+static char block[FILE_RANGE_NBLOCKS * BLOCK_SIZE];
+
+/* Read nblocks blocks from the start of a file of size blocks,
+ * wrapping around at its end */
+static void read_blocks(int ino, int size, int nblocks) {
+    for (int off = 0; off < nblocks; off += FILE_RANGE_NBLOCKS) {
+        int n = nblocks - off < FILE_RANGE_NBLOCKS? nblocks - off : FILE_RANGE_NBLOCKS;
+        if (off % size + n > size) n = size - off % size;
+        file_read_range(ino, off % size, n, block);
+    }
+}
+
+int main(int argc, char** argv) {
+    int cnt = bench_iters(argc, argv, 100);
+    struct bench b;
+
+    int bin_ino = dir_lookup(0, "bin/");
+    int ino = dir_lookup(bin_ino, "bench_fs");
+    if (ino < 0) FATAL("bench_fs: cannot find /bin/bench_fs");
+
+    /* dir_lookup() answers repeated lookups from its cache in the app */
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) dir_lookup(bin_ino, "bench_fs");
+    bench_end(&b, "dir_lookup_cached", cnt);
+
+    struct dir_request req;
+    req.type = DIR_LOOKUP;
+    req.ino = bin_ino;
+    strcpy(req.name, "bench_fs");
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++)
+        grass->sys_call(GPID_DIR, (void*)&req, sizeof(req), block, sizeof(block));
+    bench_end(&b, "dir_lookup", cnt);
+
+    int size;
+    for (size = 0; size < MAX_NBLOCKS && file_read(ino, size, block) == 0; size++);
+
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) file_read(ino, 0, block);
+    bench_end(&b, "file_read_1", cnt);
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) read_blocks(ino, size, 8);
+    bench_end(&b, "file_read_8", cnt);
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) read_blocks(ino, size, 64);
+    bench_end(&b, "file_read_64", cnt);
+
+    /* Reading one block again and again always hits in the cache, and
+     * cycling through more blocks than it holds always misses */
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) file_read(ino, 1, block);
+    bench_end(&b, "cache_hit", cnt);
+    if (size <= 2 * CACHE_NBLOCKS) {
+        INFO("bench_fs: /bin/bench_fs is too small to miss in the cache");
+        return 0;
+    }
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) file_read(ino, i % size, block);
+    bench_end(&b, "cache_miss", cnt);
+    return 0;
+}
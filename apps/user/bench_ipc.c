@@ -0,0 +1,45 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: measure a null IPC round-trip to GPID_PROCESS and
+ * a ping-pong between two user processes, which takes two context
+ * switches per round-trip
+ */
+
+#include "bench.h"
+#include <string.h>
+
+int main(int argc, char** argv) {
+    char buf[4];
+    int sender;
+
+    /* The child spawned below echoes every message back to its sender
+     * and exits when it receives an empty message */
+    if (argc > 1 && strcmp(argv[1], "echo") == 0) {
+        int len = grass->sys_recv(&sender, buf, sizeof(buf));
+        while (len > 0)
+            len = grass->sys_reply_recv(sender, buf, len, &sender, buf, sizeof(buf));
+        return 0;
+    }
+
+    int cnt = bench_iters(argc, argv, 1000);
+    struct bench b;
+
+    struct proc_request req;
+    req.type = PROC_NULL;
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++)
+        grass->sys_call(GPID_PROCESS, (void*)&req, sizeof(req.type), buf, sizeof(buf));
+    bench_end(&b, "ipc_null", cnt);
+
+    char* args[] = {"bench_ipc", "echo", "&"};
+    int pid = proc_spawn(3, args);
+    if (pid < 0) FATAL("bench_ipc: cannot spawn the echo process");
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) grass->sys_call(pid, buf, sizeof(buf), buf, sizeof(buf));
+    bench_end(&b, "ipc_pingpong", cnt);
+    grass->sys_send(pid, buf, 0);
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: compare page_copy, page_zero and page_equal with
+ * newlib's memcpy, memset and memcmp on one 4KB page
+ */
+
+#include "bench.h"
+#include "page.h"
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char** argv) {
+    int cnt = bench_iters(argc, argv, 100);
+
+    /* Copy the first page of this app's code, so both pages are equal */
+    int page[PAGE_SIZE / sizeof(int)];
+    char* src = (void*)APPS_ENTRY;
+    struct bench b;
+    volatile int equal;
+
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) memcpy(page, src, PAGE_SIZE);
+    bench_end(&b, "memcpy", cnt);
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) page_copy(page, src);
+    bench_end(&b, "page_copy", cnt);
+
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) equal = (memcmp(page, src, PAGE_SIZE) == 0);
+    bench_end(&b, "memcmp", cnt);
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) equal = page_equal(page, src);
+    bench_end(&b, "page_equal", cnt);
+    if (!equal) INFO("bench_page: page_equal returns 0 for equal pages");
+
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) memset(page, 0, PAGE_SIZE);
+    bench_end(&b, "memset", cnt);
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++) page_zero(page);
+    bench_end(&b, "page_zero", cnt);
+    return 0;
+}
@@ -0,0 +1,25 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: measure spawning a trivial app and waiting for its exit
+ */
+
+#include "bench.h"
+#include <string.h>
+
+int main(int argc, char** argv) {
+    /* The spawned copy of this app exits at once */
+    if (argc > 1 && strcmp(argv[1], "-") == 0) return 0;
+
+    int cnt = bench_iters(argc, argv, 20);
+    char* args[] = {"bench_spawn", "-"};
+    struct bench b;
+
+    bench_start(&b);
+    for (int i = 0; i < cnt; i++)
+        if (proc_spawn(2, args) < 0) FATAL("bench_spawn: cannot spawn bench_spawn");
+    bench_end(&b, "spawn_exit", cnt);
+    return 0;
+}
@@ -5,15 +5,23 @@
 
 /* Author: Yunhao Zhang
  * Description: a simple cat
+ * With a file, print the whole file, read FILE_RANGE_NBLOCKS at a time.
+ * Without a file, copy the input of a pipeline, e.g. "echo hi | cat".
  */
 
 #include "app.h"
 #include <string.h>
 
 int main(int argc, char** argv) {
+    char buf[FILE_RANGE_NBLOCKS * BLOCK_SIZE];
     if (argc == 1) {
-        INFO("usage: cat [FILE]");
-        return -1;
+        int n = grass->sys_pipe_read(buf, BLOCK_SIZE);
+        if (n < 0) {
+            INFO("usage: cat [FILE]");
+            return -1;
+        }
+        for (; n > 0; n = grass->sys_pipe_read(buf, BLOCK_SIZE)) stdout_write(buf, n);
+        return 0;
     }
 
     /* Get the inode number of the file */
@@ -23,11 +31,18 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    /* Read and print the first block of the file */
-    char buf[BLOCK_SIZE];
-    file_read(file_ino, 0, buf);
-    printf("%s", buf);
-    if (buf[strlen(buf) - 1] != '\n') printf("\r\n");
+    /* Stream the file in ranges until a short read or the first NUL,
+     * which ends the text in its last block */
+    int off = 0, len, n;
+    char last = '\n';
+    while ((n = file_read_range(file_ino, off, FILE_RANGE_NBLOCKS, buf)) > 0) {
+        len = strnlen(buf, n * BLOCK_SIZE);
+        stdout_write(buf, len);
+        if (len) last = buf[len - 1];
+        if (len < n * BLOCK_SIZE || n < FILE_RANGE_NBLOCKS) break;
+        off += n;
+    }
+    if (last != '\n') printf("\r\n");
 
     return 0;
 }
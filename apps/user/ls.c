@@ -19,7 +19,22 @@ int main(int argc, char** argv) {
     /* Read the directory content */
     char buf[BLOCK_SIZE];
     file_read(grass->workdir_ino, 0, buf);
-    
+
+    struct dir_header* header = (void*)buf;
+    if (header->magic == DIR_MAGIC) {
+        /* Print the names in the hashed directory format */
+        int nblocks = header->nblocks;
+        for (int b = 0; b < nblocks; b++) {
+            if (b) file_read(grass->workdir_ino, b, buf);
+            struct dir_entry* entries = (void*)buf;
+            for (int i = (b == 0); i < DIR_ENTRIES_PER_BLOCK; i++)
+                if (entries[i].hash > DIR_HASH_REMOVED)
+                    printf("%s   ", entries[i].name);
+        }
+        printf("\r\n");
+        return 0;
+    }
+
     /* Remove the inode numbers from the string */
     for (int i = 1; i < strlen(buf); i++)
         if (buf[i - 1] == ' ' && buf[i] >= '0' && buf[i] <= '9') buf[i] = ' ';
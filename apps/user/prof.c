@@ -0,0 +1,37 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: control the PC sampling profiler in grass/prof.c
+ * usage: prof start|stop|dump
+ * "prof dump" prints one "PROF pid pc count" line per sampled pc;
+ * copy them into a file and run tools/prof.py to resolve the symbols
+ */
+
+#include "app.h"
+#include <string.h>
+
+static struct prof_reply reply;
+
+int main(int argc, char** argv) {
+    int cmd = -1;
+    if (argc == 2 && strcmp(argv[1], "start") == 0) cmd = PROF_START;
+    if (argc == 2 && strcmp(argv[1], "stop") == 0)  cmd = PROF_STOP;
+    if (argc == 2 && strcmp(argv[1], "dump") == 0)  cmd = PROF_DUMP;
+    if (cmd == -1) {
+        INFO("usage: prof start|stop|dump");
+        return -1;
+    }
+
+    if (proc_prof(cmd, &reply) < 0) return -1;
+    if (cmd != PROF_DUMP) return 0;
+
+    INFO("profiler %s, %d samples, %d dropped",
+         reply.running? "running" : "stopped", reply.nsamples, reply.dropped);
+    for (int i = 0; i < PROF_NSAMPLES; i++)
+        if (reply.samples[i].count)
+            printf("PROF %d 0x%x %d\r\n", reply.samples[i].pid,
+                   reply.samples[i].pc, reply.samples[i].count);
+    return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: print the performance counter registry and reset it,
+ * so each run of stat shows the counts since the previous one
+ * usage: stat [-n], where -n prints without resetting
+ */
+
+#include "app.h"
+#include "counter.h"
+#include <string.h>
+
+int main(int argc, char** argv) {
+    struct counter_registry* reg = earth->counters;
+
+    /* The hardware counters first, then the others by registration */
+    for (int i = 0; i < reg->nhw; i++)
+        printf("%-12s %u\r\n", counter_hw_name(i), counter_hw(i));
+    for (int i = 0; i < reg->ncounters; i++)
+        printf("%-12s %u\r\n", reg->counters[i].name, reg->counters[i].value);
+
+    if (argc == 1 || strcmp(argv[1], "-n")) counter_reset();
+    return 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: write the file data buffered by GPID_FILE to the disk
+ * usage: sync
+ */
+
+#include "app.h"
+
+int main(int argc, char** argv) {
+    if (file_sync() < 0) {
+        INFO("sync: some blocks could not be written");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: measure the cost of a null system call in CPU cycles
+ */
+
+#include "app.h"
+#include <stdlib.h>
+
+static unsigned int cycles() {
+    unsigned int cycle;
+    asm volatile("csrr %0, cycle" : "=r"(cycle));
+    return cycle;
+}
+
+int main(int argc, char** argv) {
+    int cnt = (argc == 1)? 1000 : atoi(argv[1]);
+    if (cnt <= 0) cnt = 1;
+
+    unsigned int start = cycles();
+    for (int i = 0; i < cnt; i++) grass->sys_null();
+    unsigned int end = cycles();
+
+    printf("sysbench: %d null system calls, %d cycles each\r\n", cnt, (end - start) / cnt);
+    return 0;
+}
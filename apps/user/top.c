@@ -0,0 +1,60 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: sample the CPU and IPC counters of every process
+ * from GPID_PROCESS periodically and show the change of each period
+ * usage: top [number of samples]
+ */
+
+#include "app.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_QUANTA 20    /* time slices between two samples */
+
+/* The process status values in grass/process.h */
+static char* status_name[] = {"unused", "loading", "ready", "running",
+                              "runnable", "send", "recv", "sleep", "tty", "pipe"};
+
+static struct proc_info_reply prev, curr;
+
+static struct proc_info* find(struct proc_info_reply* r, int pid) {
+    for (int i = 0; i < r->nprocs; i++)
+        if (r->procs[i].pid == pid) return &r->procs[i];
+    return NULL;
+}
+
+static int percent(unsigned int part, unsigned int total) {
+    return total? (int)((unsigned long long)part * 100 / total) : 0;
+}
+
+int main(int argc, char** argv) {
+    int cnt = (argc == 1)? 5 : atoi(argv[1]);
+
+    proc_info(&prev);
+    unsigned int last = earth->timer_get();
+    for (int n = 0; n < cnt; n++) {
+        grass->sys_sleep(earth->timer_quantum * SAMPLE_QUANTA);
+        if (proc_info(&curr) < 0) return -1;
+        unsigned int now = earth->timer_get(), elapsed = now - last;
+
+        printf("  PID  STATE     CPU%%  BLOCK%%  VOLUN  INVOL   SENT   RECV\r\n");
+        for (int i = 0; i < curr.nprocs; i++) {
+            struct proc_info *c = &curr.procs[i], zero = {0}, *p = find(&prev, c->pid);
+            if (p == NULL) p = &zero;
+            printf("%5d  %-8s  %4d  %6d  %5d  %5d  %5d  %5d\r\n", c->pid,
+                   status_name[c->status], percent(c->runtime - p->runtime, elapsed),
+                   percent(c->blocked - p->blocked, elapsed),
+                   c->nvoluntary - p->nvoluntary, c->ninvoluntary - p->ninvoluntary,
+                   c->nsent - p->nsent, c->nrecv - p->nrecv);
+        }
+        printf("idle: %d%%\r\n", percent(curr.idle - prev.idle, elapsed));
+
+        memcpy(&prev, &curr, sizeof(curr));
+        last = now;
+    }
+
+    return 0;
+}
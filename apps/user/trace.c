@@ -0,0 +1,56 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: print the kernel event trace of grass/trace.c
+ * usage: trace          print the events in the buffer
+ *        trace stream   print new events in compact form until killed;
+ *                       each line is "T" and the hex digits of time(8),
+ *                       type(2), pid(4) and arg(4), or "L" and the
+ *                       number of events overwritten before printing
+ */
+
+#include "app.h"
+#include <string.h>
+
+#define NREAD TRACE_NREAD
+
+static char* type_name[] = {"switch", "send", "recv", "block",
+                            "wake", "syscall", "sysret", "pagemiss"};
+
+static struct trace_event buf[NREAD];
+
+int main(int argc, char** argv) {
+    int stream = (argc == 2 && strcmp(argv[1], "stream") == 0);
+    if (argc > 1 && !stream) {
+        INFO("usage: trace [stream]");
+        return -1;
+    }
+
+    /* Start from the oldest event still in the buffer */
+    unsigned int seq = 0, last = 0;
+    int n, first = 1;
+    for (;;) {
+        while ((n = proc_trace(&seq, buf, NREAD)) > 0) {
+            unsigned int lost = seq - n - last;
+            if (!first && lost && stream) printf("L%08x\r\n", lost);
+            if (!first && lost && !stream) printf("(%d events lost)\r\n", lost);
+
+            for (int i = 0; i < n; i++) {
+                struct trace_event* e = &buf[i];
+                if (stream)
+                    printf("T%08x%02x%04x%04x\r\n", e->time, e->type, e->pid, e->arg);
+                else
+                    printf("%10u  %-8s  pid %2d  arg %d\r\n", e->time,
+                           e->type < TRACE_NTYPES? type_name[e->type] : "?", e->pid, e->arg);
+            }
+            last = seq;
+            first = 0;
+        }
+        if (!stream) break;
+        grass->sys_sleep(earth->timer_quantum);
+    }
+
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: count the lines, words and bytes of the input of a
+ * pipeline, e.g. "cat README | wc"
+ */
+
+#include "app.h"
+
+int main() {
+    char buf[BLOCK_SIZE];
+    int nlines = 0, nwords = 0, nbytes = 0, in_word = 0;
+
+    int n = grass->sys_pipe_read(buf, BLOCK_SIZE);
+    if (n < 0) {
+        INFO("usage: CMD | wc");
+        return -1;
+    }
+
+    for (; n > 0; n = grass->sys_pipe_read(buf, BLOCK_SIZE)) {
+        nbytes += n;
+        for (int i = 0; i < n; i++) {
+            char c = buf[i];
+            if (c == '\n') nlines++;
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n') in_word = 0;
+            else if (!in_word) nwords += (in_word = 1);
+        }
+    }
+    printf("%d %d %d\r\n", nlines, nwords, nbytes);
+    return 0;
+}
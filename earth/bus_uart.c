@@ -16,12 +16,19 @@
 #define UART0_RXDATA  4UL
 #define UART0_TXCTRL  8UL
 #define UART0_RXCTRL  12UL
+#define UART0_IE      16UL
+#define UART0_IP      20UL
 #define UART0_DIV     24UL
 
+#define UART0_TXWM    1             /* TX watermark bit in IE and IP */
+#define UART0_RXWM    2             /* RX watermark bit, pending if the FIFO is not empty */
+#define UART0_TXCNT   (1 << 16)     /* TXWM is pending when the FIFO has fewer entries */
+
 void uart_init(long baud_rate) {
     REGW(UART0_BASE, UART0_DIV) = CPU_CLOCK_RATE / baud_rate - 1;
-    REGW(UART0_BASE, UART0_TXCTRL) |= 1;
+    REGW(UART0_BASE, UART0_TXCTRL) |= UART0_TXCNT | 1;
     REGW(UART0_BASE, UART0_RXCTRL) |= 1;
+    REGW(UART0_BASE, UART0_IE) |= UART0_RXWM;
 
     /* UART0 send/recv are mapped to GPIO pin16 and pin17 */
     REGW(GPIO0_BASE, GPIO0_IOF_ENABLE) |= (1 << 16) | (1 << 17);
@@ -32,7 +39,14 @@ int uart_getc(int* c) {
     return *c = (ch & (1 << 31))? -1 : (ch & 0xFF);
 }
 
+int uart_tx_full() { return REGW(UART0_BASE, UART0_TXDATA) & (1 << 31); }
+
 void uart_putc(int c) {
-    while ((REGW(UART0_BASE, UART0_TXDATA) & (1 << 31)));
+    while (uart_tx_full());
     REGW(UART0_BASE, UART0_TXDATA) = c;
 }
+
+void uart_txwm_enable(int on) {
+    if (on) REGW(UART0_BASE, UART0_IE) |= UART0_TXWM;
+    else    REGW(UART0_BASE, UART0_IE) &= ~UART0_TXWM;
+}
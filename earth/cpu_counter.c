@@ -0,0 +1,47 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: the performance counter registry and hardware counters
+ * Counters are registered and read in library/libc/counter.c; earth only
+ * owns the registry and finds the hardware counters.  cycle and instret
+ * are always there, and an hpmcounter is kept if it counts on its own,
+ * which rules out the ones hardwired to zero or without an event.
+ * see sections 3.1.16 and 3.1.17 of references/riscv-privileged-v1.10.pdf
+ */
+
+#include "egos.h"
+#include "counter.h"
+
+static struct counter_registry registry;
+
+static int hpm_counts(int idx) {
+    /* Clear the counter, run a few instructions and see if it moved */
+    unsigned int val = 0;
+    switch (idx) {
+    case 3: asm volatile("csrw mhpmcounter3, zero; nop; nop; nop; nop; csrr %0, mhpmcounter3" : "=r"(val)); break;
+    case 4: asm volatile("csrw mhpmcounter4, zero; nop; nop; nop; nop; csrr %0, mhpmcounter4" : "=r"(val)); break;
+    case 5: asm volatile("csrw mhpmcounter5, zero; nop; nop; nop; nop; csrr %0, mhpmcounter5" : "=r"(val)); break;
+    case 6: asm volatile("csrw mhpmcounter6, zero; nop; nop; nop; nop; csrr %0, mhpmcounter6" : "=r"(val)); break;
+    }
+    return val != 0;
+}
+
+void counter_init() {
+    /* earth is not zeroed by the bss, so this runs before anything counts */
+    earth->counters = &registry;
+    registry.nhw = 2;
+
+    /* The core on the Arty board may trap on the hpmcounter CSRs */
+    if (earth->platform == QEMU)
+        while (registry.nhw < NCOUNTERS_HW && hpm_counts(registry.nhw + 1)) registry.nhw++;
+
+    /* Let grass and the user apps read cycle, time, instret and the
+     * hpmcounters; the user apps need scounteren too with the S mode */
+    unsigned int mask = (1 << (registry.nhw + 1)) - 1;
+    asm("csrw mcounteren, %0" ::"r"(mask));
+    if (earth->platform == QEMU) asm("csrw scounteren, %0" ::"r"(mask));
+
+    counter_reset();
+}
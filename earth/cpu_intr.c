@@ -9,11 +9,36 @@
 
 #include "egos.h"  
 
-/* Declaration of two static function pointers for handling interrupts and exceptions. 
-   These are initialized to NULL, meaning they point to no function initially. */
+#define INTR_ID_EXTERNAL 11
+#define PLIC_BASE        0x0C000000UL
+#define PLIC_PRIORITY    0x0UL          /* one word per interrupt source */
+#define PLIC_ENABLE      0x2000UL       /* hart 0 M-mode context */
+#define PLIC_THRESHOLD   0x200000UL
+#define PLIC_CLAIM       0x200004UL
+#define PLIC_UART0_ID    3
+
+void tty_tx_intr();
+int  tty_rx_intr();
+void tty_intr_enable();
+
 static void (*intr_handler)(int);
 static void (*excp_handler)(int);
 
+static void plic_entry(int id) {
+    /* The UART is the only external interrupt source; earth handles it and
+     * tells the grass layer only when a line was typed, see dev_tty.c */
+    int source = REGW(PLIC_BASE, PLIC_CLAIM), line = 0;
+    if (source == PLIC_UART0_ID) {
+        line = tty_rx_intr();
+        tty_tx_intr();
+    }
+    REGW(PLIC_BASE, PLIC_CLAIM) = source;
+    if (line && intr_handler) intr_handler(id);
+}
+
+/* The two static function pointers for handling interrupts and exceptions are
+   declared above and initialized to NULL, meaning they point to no function initially. */
+
 /* Function to register an interrupt handler. 
    It assigns the provided function pointer to the static 'intr_handler'. */
 int intr_register(void (*_handler)(int)) { intr_handler = _handler; }
@@ -23,6 +48,7 @@ int intr_register(void (*_handler)(int)) { intr_handler = _handler; }
 int excp_register(void (*_handler)(int)) { excp_handler = _handler; }
 
 void trap_entry_vm();  // Declaration of a wrapper function 'trap_entry_vm', defined elsewhere (in earth.S).
+void trap_entry_ecall(); // Entry which sends system calls to ecall_entry(), also in earth.S.
 
 /* Declaration of the 'trap_entry' function with specific attributes.
    It is marked as an interrupt handler for the 'machine' level and aligned to 128 bytes. */
@@ -38,7 +64,9 @@ void trap_entry() {
     int id = mcause & 0x3FF;
 
     /* Checks the highest bit of 'mcause' to determine if it's an interrupt or an exception. */
-    if (mcause & (1 << 31))
+    if ((mcause & (1 << 31)) && id == INTR_ID_EXTERNAL)
+        plic_entry(id);
+    else if (mcause & (1 << 31))
         /* If it's an interrupt and a handler is registered, call it; otherwise, trigger a fatal error. */
         (intr_handler)? intr_handler(id) : FATAL("trap_entry: interrupt handler not registered");
     else
@@ -46,6 +74,14 @@ void trap_entry() {
         (excp_handler)? excp_handler(id) : FATAL("trap_entry: exception handler not registered");
 }
 
+/* Called by trap_entry_ecall() for system calls, on the caller's stack;
+ * that path saves no register and its call clobbers ra, t0 and a0, so
+ * sys_invoke() in grass/syscall.c declares them, and the other
+ * caller-saved registers, as clobbered */
+void ecall_entry(int mcause) {
+    (excp_handler)? excp_handler(mcause & 0x3FF) : FATAL("ecall_entry: exception handler not registered");
+}
+
 void intr_init() {
     /* Registering the interrupt and exception handler registration functions with the 'earth' structure. */
     earth->intr_register = intr_register;
@@ -57,17 +93,23 @@ void intr_init() {
         asm("csrw mtvec, %0" ::"r"(trap_entry_vm));
         INFO("Use direct mode and put the address of trap_entry_vm() to mtvec");
     } else {
-        /* Otherwise, set 'mtvec' to 'trap_entry'. */
-        asm("csrw mtvec, %0" ::"r"(trap_entry));
-        INFO("Use direct mode and put the address of trap_entry() to mtvec");
+        /* Otherwise, set 'mtvec' to 'trap_entry_ecall', which calls 'trap_entry' for everything but system calls. */
+        asm("csrw mtvec, %0" ::"r"(trap_entry_ecall));
+        INFO("Use direct mode and put the address of trap_entry_ecall() to mtvec");
     }
 
-    /* Enable machine-mode timer and software interrupts. */
+    /* Route the UART interrupt to hart 0 through the PLIC. */
+    REGW(PLIC_BASE, PLIC_PRIORITY + 4 * PLIC_UART0_ID) = 1;
+    REGW(PLIC_BASE, PLIC_ENABLE) |= (1 << PLIC_UART0_ID);
+    REGW(PLIC_BASE, PLIC_THRESHOLD) = 0;
+    tty_intr_enable();
+
+    /* Enable machine-mode timer, software and external interrupts. */
     int mstatus, mie;  // Variables to store 'mie' (Machine Interrupt Enable) and 'mstatus' (Machine Status) register values.
 
-    /* Read the current 'mie' value, set bits for enabling timer and software interrupts, and write back. */
+    /* Read the current 'mie' value, set bits for enabling timer, software and external interrupts, and write back. */
     asm("csrr %0, mie" : "=r"(mie));
-    asm("csrw mie, %0" ::"r"(mie | 0x88));
+    asm("csrw mie, %0" ::"r"(mie | 0x888));
     /* Read the current 'mstatus' value, set bits for enabling timer and software interrupts, and write back. */
     asm("csrr %0, mstatus" : "=r"(mstatus));
     asm("csrw mstatus, %0" ::"r"(mstatus | 0x88));
@@ -11,148 +11,408 @@
 #include "egos.h"
 #include "disk.h"
 #include "servers.h"
+#include "page.h"
+#include "spinlock.h"
+#include "counter.h"
 #include <string.h>
-#include <pthread.h>
 
 /* Interface of the paging device, see earth/dev_page.c */
 void  paging_init();                 // Function prototype to initialize paging.
 int   paging_invalidate_cache(int frame_id); // Invalidate cache for a frame.
 int   paging_write(int frame_id, int page_no); // Write a frame to a page.
 char* paging_read(int frame_id, int alloc_only); // Read from a frame, possibly allocating only.
+int   paging_set_dirty(int frame_id); // Mark a frame modified through paging_read.
+int   paging_flush(int nframes); // Write back dirty frames ahead of eviction.
 
-/* Allocation and free of physical frames */
-#define NFRAMES 256               // Define a constant for the number of frames.
+char* disk_rom_addr(int block_no); // Where a block is in the on-board ROM, see earth/dev_disk.c.
 
-pthread_mutex_t frame_table_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t frame_available = PTHREAD_COND_INITIALIZER;  // Condition variable for frame availability
-pthread_rwlock_t tlb_rwlock = PTHREAD_RWLOCK_INITIALIZER;   // Read-write lock for the TLB operations
+/* Allocation and free of physical frames
+ *
+ * Free frames are kept on a free list and allocated frames on the list of
+ * their owner in owners, found from the pid through a hash table, all
+ * linked through the frame table; so alloc is O(1) while free and switch
+ * only visit the frames of the process, however large pids grow.
+ * Frames which are allocated but not mapped yet are owned by pid 0.
+ * mmu_alloc() returns -1 once every frame is taken, and its callers give
+ * up what they were building, e.g. the spawn of an app.
+ *
+ * On QEMU, mmu_flush() also clears up to NZEROED free frames from the
+ * idle path and keeps them on a list of their own, so that mmu_alloc()
+ * can hand out a zeroed frame without clearing it; on Arty, clearing a
+ * frame ahead of time would take a slot of the frame cache.
+ */
+#define NFRAMES      256          // Define a constant for the number of frames.
+#define NOWNERS      64           // Processes owning frames at the same time.
+#define NZEROED      16           // Free frames kept zeroed ahead of time.
+
+/* One lock protects the frame table, the XIP pages and the page tables;
+ * it nests because building page tables calls earth->mmu_alloc() */
+static struct spinlock mmu_spinlock;
+static int mmu_depth[NHARTS];
+
+static void mmu_lock() {
+    if (mmu_depth[HART_ID()]++ == 0) spin_lock(&mmu_spinlock);
+}
+
+static void mmu_unlock() {
+    if (--mmu_depth[HART_ID()] == 0) spin_unlock(&mmu_spinlock);
+}
 
 struct frame_mapping {
     int use;     // Is the frame allocated?
     int pid;     // Which process owns the frame?
     int page_no; // Which virtual page is the frame mapped to?
+    int prev, next;        // Free list or owner's bucket list, -1 terminates
+    int resident;          // Soft TLB: is the frame the image at page_no?
+    unsigned int checksum; // Soft TLB: checksum of page_no when switched in
+    int zeroed;            // Is the free frame on the list of zeroed frames?
 } table[NFRAMES];                 // Array of frame mappings.
 
+/* Execute-in-place pages: read-only app pages mapped to the on-board ROM
+ * disk without a frame; the software TLB copies them in from the ROM */
+#define NXIP 16
+static struct {
+    int pid;               // 0 if the entry is unused
+    int page_no;
+    char* rom;             // Page-aligned address in the ROM
+    int resident;          // Soft TLB: is the ROM page at page_no?
+} xip[NXIP];
+
+static int free_head = -1, zeroed_head = -1, nzeroed;
+
+static struct {
+    int pid;
+    int head;              // First frame of the owner, -1 if the entry is free
+    int next;              // Hash chain or free list, -1 terminates
+} owners[NOWNERS];
+static int owner_hash[NOWNERS], owner_free_head;
+
+// The owner entry of pid, or -1
+static int owner_find(int pid) {
+    for (int i = owner_hash[pid % NOWNERS]; i != -1; i = owners[i].next)
+        if (owners[i].pid == pid) return i;
+    return -1;
+}
 
-// Using Read-Write Locks
-// Read-write locks are useful for optimizing scenarios where data is frequently read but less frequently modified. They allow multiple readers to access the data concurrently but require exclusive access for writers. This can be particularly effective for operations like soft_tlb_switch, where checks on the current process ID (curr_vm_pid) are frequent but changes to it are less frequent.
-// Read-Write Locks: soft_tlb_map() uses a write lock because it modifies shared data. soft_tlb_switch() first attempts to read the current process ID and, if a change is necessary, it acquires a write lock to update the TLB and the current process ID. This allows multiple readers concurrently, improving performance when there's no change in the process ID.
-
-// Using Condition Variables
-// Condition variables can help manage synchronization more efficiently when threads need to wait for certain conditions to be true before proceeding. For example, in mmu_alloc, a thread that cannot find a free frame might wait until a frame becomes available, which can be signaled by mmu_free.
-// Condition Variables: mmu_alloc() now waits on a condition variable if no frames are available, and mmu_free() signals this condition when frames are freed, waking up waiting threads.
-
-
-// int mmu_alloc(int* frame_id, void** cached_addr) { // Allocate a frame.
-//     for (int i = 0; i < NFRAMES; i++) // Loop through the frames.
-//         if (!table[i].use) {    // If frame is not in use:
-//             *frame_id = i;       // Set the frame ID.
-//             *cached_addr = paging_read(i, 1); // Read the frame, allocating if necessary.
-//             table[i].use = 1;    // Mark the frame as used.
-//             return 0;            // Return success.
-//         }
-//     FATAL("mmu_alloc: no more available frames"); // If no frames available, fatal error.
-// }
-
-int mmu_alloc(int* frame_id, void** cached_addr) {
-    pthread_mutex_lock(&frame_table_mutex);
-    while (1) {
-        for (int i = 0; i < NFRAMES; i++) {
-            if (!table[i].use) {
-                *frame_id = i;
-                *cached_addr = paging_read(i, 1);
-                table[i].use = 1;
-                pthread_mutex_unlock(&frame_table_mutex);
-                return 0;
-            }
-        }
-        // Wait for a frame to become available
-        pthread_cond_wait(&frame_available, &frame_table_mutex);
+static int owner_get(int pid) {
+    int i = owner_find(pid);
+    if (i != -1) return i;
+
+    if ((i = owner_free_head) == -1) FATAL("owner_get: more than %d processes own frames", NOWNERS);
+    owner_free_head = owners[i].next;
+    owners[i].pid = pid;
+    owners[i].next = owner_hash[pid % NOWNERS];
+    owner_hash[pid % NOWNERS] = i;
+    return i;
+}
+
+static void owner_put(int i) {
+    int* link = &owner_hash[owners[i].pid % NOWNERS];
+    while (*link != i) link = &owners[*link].next;
+    *link = owners[i].next;
+
+    owners[i].next = owner_free_head;
+    owner_free_head = i;
+}
+
+// The first frame owned by pid, or -1
+static int owner_frames(int pid) {
+    int i = owner_find(pid);
+    return i == -1? -1 : owners[i].head;
+}
+
+static void page_table_free(int pid);
+static int curr_vm_pid = -1;      // Soft TLB: whose pages are in the user space
+
+static void frame_unlink(int frame_id) {
+    struct frame_mapping* f = &table[frame_id];
+    int owner = f->use? owner_find(f->pid) : -1;
+    int* head = f->use? &owners[owner].head :
+                f->zeroed? &zeroed_head : &free_head;
+    if (f->prev != -1) table[f->prev].next = f->next;
+    else *head = f->next;
+    if (f->next != -1) table[f->next].prev = f->prev;
+    if (owner != -1 && *head == -1) owner_put(owner);
+}
+
+static void frame_link(int frame_id) {
+    struct frame_mapping* f = &table[frame_id];
+    int* head = f->use? &owners[owner_get(f->pid)].head :
+                f->zeroed? &zeroed_head : &free_head;
+    f->prev = -1;
+    f->next = *head;
+    if (*head != -1) table[*head].prev = frame_id;
+    *head = frame_id;
+}
+
+static void frame_set_owner(int frame_id, int pid) {
+    if (table[frame_id].pid == pid) return;
+    frame_unlink(frame_id);
+    table[frame_id].pid = pid;
+    frame_link(frame_id);
+}
+
+static void frame_table_init() {
+    memset(owner_hash, 0xFF, sizeof(owner_hash));
+    for (int i = 0; i < NOWNERS; i++) {
+        owners[i].head = -1;
+        owners[i].next = (i == NOWNERS - 1)? -1 : i + 1;
     }
-    // Not reachable, but needed for compiler happiness
-    pthread_mutex_unlock(&frame_table_mutex);
-    FATAL("mmu_alloc: no more available frames");
+    owner_free_head = 0;
+    for (int i = NFRAMES - 1; i >= 0; i--) frame_link(i);
+}
+
+static void zeroed_count_update() {
+    static unsigned int* pool_size;
+    if (!pool_size) pool_size = counter("zero.pool");
+    if (pool_size) *pool_size = nzeroed;
 }
 
-// int mmu_free(int pid) {             // Free frames for a process.
-//     for (int i = 0; i < NFRAMES; i++) // Loop through frames.
-//         if (table[i].use && table[i].pid == pid) { // If frame is used by the process:
-//             paging_invalidate_cache(i); // Invalidate the frame's cache.
-//             memset(&table[i], 0, sizeof(struct frame_mapping)); // Reset the frame's mapping.
-//         }
-// }
+/* With zeroed, the frame is all zeros; it comes from the zeroed frames if
+ * there is one, and is cleared here otherwise */
+int mmu_alloc(int* frame_id, void** cached_addr, int zeroed) {
+    mmu_lock();
+    int i = (zeroed && zeroed_head != -1) || free_head == -1? zeroed_head : free_head;
+    if (i == -1) {
+        mmu_unlock();
+        return -1;
+    }
+
+    frame_unlink(i);
+    if (table[i].zeroed) {
+        nzeroed--;
+        zeroed_count_update();
+    }
+    if (zeroed && table[i].zeroed) COUNT("zero.hit", 1);
+    else if (zeroed) COUNT("zero.miss", 1);
+    table[i].use = 1;
+    table[i].pid = 0;
+    table[i].resident = 0;
+    frame_link(i);
+
+    *frame_id = i;
+    *cached_addr = paging_read(i, 1);
+    if (zeroed && !table[i].zeroed) page_zero(*cached_addr);
+    table[i].zeroed = 0;
+    mmu_unlock();
+    return 0;
+}
+
+/* Background work of the idle path: write back up to nframes dirty
+ * frames, or zero a free frame if none is dirty */
+static int mmu_flush(int nframes) {
+    int n = paging_flush(nframes);
+    if (n > 0 || nframes <= 0 || earth->platform != QEMU) return n;
+
+    mmu_lock();
+    int i = free_head;
+    if (i != -1 && nzeroed < NZEROED) {
+        page_zero(paging_read(i, 1));
+        frame_unlink(i);
+        table[i].zeroed = 1;
+        frame_link(i);
+        nzeroed++;
+        zeroed_count_update();
+        n = 1;
+    }
+    mmu_unlock();
+    return n;
+}
+
+static void frame_free(int frame_id) {
+    paging_invalidate_cache(frame_id);
+    frame_unlink(frame_id);
+    memset(&table[frame_id], 0, sizeof(struct frame_mapping));
+    frame_link(frame_id);
+}
 
 int mmu_free(int pid) {
-    pthread_mutex_lock(&frame_table_mutex);
-    int freed = 0;
-    for (int i = 0; i < NFRAMES; i++) {
-        if (table[i].use && table[i].pid == pid) {
-            paging_invalidate_cache(i);
-            memset(&table[i], 0, sizeof(struct frame_mapping));
-            freed = 1;
-        }
+    mmu_lock();
+    for (int i = owner_frames(pid), next; i != -1; i = next) {
+        next = table[i].next;
+        frame_free(i);
+    }
+
+    for (int i = 0; i < NXIP; i++)
+        if (xip[i].pid == pid) xip[i].pid = 0;
+
+    // A new process may reuse pid, so make the next switch copy pages in
+    if (pid == curr_vm_pid) curr_vm_pid = -1;
+    if (earth->translation == PAGE_TABLE) page_table_free(pid);
+    mmu_unlock();
+}
+
+int mmu_free_frame(int frame_id) {
+    mmu_lock();
+    if (table[frame_id].use) frame_free(frame_id);
+    mmu_unlock();
+    return 0;
+}
+
+static int frame_lookup(int pid, int page_no) {
+    for (int i = owner_frames(pid); i != -1; i = table[i].next)
+        if (table[i].page_no == page_no) return i;
+    return -1;
+}
+
+static void soft_tlb_save(int frame_id);
+static void soft_tlb_load(int frame_id);
+
+/* Give the frame at src_page_no of src_pid to dst_pid at dst_page_no and
+ * the frame which was there to src_pid, so that both stay fully mapped;
+ * with page tables no page content is copied */
+int mmu_grant(int src_pid, int src_page_no, int dst_pid, int dst_page_no) {
+    mmu_lock();
+    int src = frame_lookup(src_pid, src_page_no);
+    int dst = frame_lookup(dst_pid, dst_page_no);
+    if (src == -1 || dst == -1 || src_pid == dst_pid) {
+        mmu_unlock();
+        return -1;
+    }
+
+    if (earth->translation == SOFT_TLB) {
+        soft_tlb_save(src);
+        soft_tlb_save(dst);
     }
-    if (freed) {
-        pthread_cond_broadcast(&frame_available);
+    earth->mmu_map(dst_pid, dst_page_no, src);
+    earth->mmu_map(src_pid, src_page_no, dst);
+    if (earth->translation == SOFT_TLB) {
+        soft_tlb_load(src);
+        soft_tlb_load(dst);
     }
-    pthread_mutex_unlock(&frame_table_mutex);
+
+    mmu_unlock();
+    return 0;
 }
 
-/* Software TLB Translation */
-// int soft_tlb_map(int pid, int page_no, int frame_id) { // Map a virtual page to a frame.
-//     table[frame_id].pid = pid;       // Set the process ID for the frame.
-//     table[frame_id].page_no = page_no; // Set the virtual page number for the frame.
-// }
+int mmu_copy(int dst_frame_id, int src_frame_id) {
+    /* Copy through a block-sized buffer, so that bringing one frame into
+     * the frame cache cannot evict the other in the middle of a memcpy */
+    char buf[BLOCK_SIZE];
+    mmu_lock();
+    for (int off = 0; off < PAGE_SIZE; off += BLOCK_SIZE) {
+        memcpy(buf, paging_read(src_frame_id, 0) + off, BLOCK_SIZE);
+        memcpy(paging_read(dst_frame_id, 0) + off, buf, BLOCK_SIZE);
+        paging_set_dirty(dst_frame_id);
+    }
+    mmu_unlock();
+    return 0;
+}
 
+/* Software TLB Translation */
 int soft_tlb_map(int pid, int page_no, int frame_id) {
-    pthread_rwlock_wrlock(&tlb_rwlock);
-    table[frame_id].pid = pid;
+    mmu_lock();
+    frame_set_owner(frame_id, pid);
     table[frame_id].page_no = page_no;
-    pthread_rwlock_unlock(&tlb_rwlock);
+    mmu_unlock();
+    return 0;
+}
+
+static unsigned int page_checksum(int page_no) {
+    /* FNV-1a over the words of a virtual page */
+    unsigned int hash = 2166136261u, *word = (void*)(page_no << 12);
+    for (int i = 0; i < PAGE_SIZE / sizeof(int); i++)
+        hash = (hash ^ word[i]) * 16777619u;
+    return hash;
 }
 
-// int soft_tlb_switch(int pid) {       // Switch the TLB context for a process.
-//     static int curr_vm_pid = -1;     // Static variable for the current VM process ID.
-//     if (pid == curr_vm_pid) return 0; // If the process is already the current, return.
+/* Frames whose content is at their virtual page, at most one per page */
+#define NRESIDENT 16
+static int resident[NRESIDENT] = { [0 ... NRESIDENT - 1] = -1 };
 
-//     // Unmap curr_vm_pid from the user address space
-//     for (int i = 0; i < NFRAMES; i++) // Loop through frames.
-//         if (table[i].use && table[i].pid == curr_vm_pid) // If frame belongs to current process:
-//             paging_write(i, table[i].page_no); // Write the frame to its page.
+static void xip_evict(int page_no) {
+    for (int i = 0; i < NXIP; i++)
+        if (xip[i].page_no == page_no) xip[i].resident = 0;
+}
+
+static void resident_set(int frame_id) {
+    xip_evict(table[frame_id].page_no);
+    int slot = -1;
+    for (int j = 0; j < NRESIDENT; j++) {
+        int f = resident[j];
+        if (f != -1 && (!table[f].use || !table[f].resident ||
+                        table[f].page_no == table[frame_id].page_no)) {
+            if (table[f].use) table[f].resident = 0;
+            resident[j] = f = -1;
+        }
+        if (f == -1 && slot == -1) slot = j;
+    }
+    if (slot == -1) {
+        slot = 0;                       // Table full, forget the first page
+        table[resident[0]].resident = 0;
+    }
+    resident[slot] = frame_id;
+    table[frame_id].resident = 1;
+}
 
-//     // Map pid to the user address space
-//     for (int i = 0; i < NFRAMES; i++) // Loop through frames.
-//         if (table[i].use && table[i].pid == pid) // If frame belongs to new process:
-//             memcpy((void*)(table[i].page_no << 12), paging_read(i, 0), PAGE_SIZE); // Copy data from frame to virtual page.
+/* A frame of curr_vm_pid lives at its virtual page, so write it back
+ * before the frame changes hands and copy the new frame in afterwards */
+static void soft_tlb_save(int frame_id) {
+    struct frame_mapping* f = &table[frame_id];
+    if (f->pid == curr_vm_pid && page_checksum(f->page_no) != f->checksum) {
+        paging_write(frame_id, f->page_no);
+        COUNT("tlb.out", PAGE_SIZE);
+    }
+    f->resident = 0;
+}
 
-//     curr_vm_pid = pid;               // Update the current VM process ID.
-// }
+static void soft_tlb_load(int frame_id) {
+    struct frame_mapping* f = &table[frame_id];
+    if (f->pid != curr_vm_pid) return;
+    page_copy((void*)(f->page_no << 12), paging_read(frame_id, 0));
+    resident_set(frame_id);
+    f->checksum = page_checksum(f->page_no);
+    COUNT("tlb.in", PAGE_SIZE);
+}
 
 int soft_tlb_switch(int pid) {
-    pthread_rwlock_rdlock(&tlb_rwlock);
-    static int curr_vm_pid = -1;
+    mmu_lock();
     if (pid == curr_vm_pid) {
-        pthread_rwlock_unlock(&tlb_rwlock);
+        mmu_unlock();
         return 0;
     }
-    pthread_rwlock_unlock(&tlb_rwlock);
 
-    // Lock for writing since we need to modify curr_vm_pid and potentially the page table
-    pthread_rwlock_wrlock(&tlb_rwlock);
-    for (int i = 0; i < NFRAMES; i++) {
-        if (table[i].use && table[i].pid == curr_vm_pid)
+    /* Write back only the pages of curr_vm_pid whose checksum changed;
+     * they stay resident until another frame is copied to the page */
+    if (curr_vm_pid != -1)
+        for (int i = owner_frames(curr_vm_pid); i != -1; i = table[i].next) {
+            if (page_checksum(table[i].page_no) == table[i].checksum) continue;
             paging_write(i, table[i].page_no);
+            table[i].checksum = page_checksum(table[i].page_no);
+            COUNT("tlb.out", PAGE_SIZE);
+        }
+
+    /* Copy in the pages of pid which are not resident already */
+    for (int i = owner_frames(pid); i != -1; i = table[i].next) {
+        if (table[i].resident) continue;
+
+        page_copy((void*)(table[i].page_no << 12), paging_read(i, 0));
+        resident_set(i);
+        table[i].checksum = page_checksum(table[i].page_no);
+        COUNT("tlb.in", PAGE_SIZE);
     }
 
-    for (int i = 0; i < NFRAMES; i++) {
-        if (table[i].use && table[i].pid == pid)
-            memcpy((void*)(table[i].page_no << 12), paging_read(i, 0), PAGE_SIZE);
+    /* Copy in the execute-in-place pages of pid from the ROM */
+    for (int i = 0; i < NXIP; i++) {
+        if (xip[i].pid != pid || xip[i].resident) continue;
+        for (int j = 0; j < NRESIDENT; j++)
+            if (resident[j] != -1 && table[resident[j]].page_no == xip[i].page_no) {
+                table[resident[j]].resident = 0;
+                resident[j] = -1;
+            }
+        xip_evict(xip[i].page_no);
+
+        page_copy((void*)(xip[i].page_no << 12), xip[i].rom);
+        xip[i].resident = 1;
+        COUNT("tlb.in", PAGE_SIZE);
     }
 
+    COUNT("tlb.switch", 1);
     curr_vm_pid = pid;
-    pthread_rwlock_unlock(&tlb_rwlock);
+    mmu_unlock();
 }
 
+
 /* Page Table Translation
  *
  * The code below creates an identity mapping using RISC-V Sv32;
@@ -166,10 +426,75 @@ int soft_tlb_switch(int pid) {
 
 #define OS_RWX   0xF       // Define permission flags for the OS.
 #define USER_RWX 0x1F      // Define permission flags for the user.
+#define USER_RX  0x1B      // Permission flags for read-only user code, see mmu_map_rom.
+#define PTE_G    0x20      // Global mapping, shared by all address spaces.
 static unsigned int frame_id, *root, *leaf; // Static variables for frame ID and page table pointers.
 
-/* 32 is a number large enough for demo purpose */
-static unsigned int* pid_to_pagetable_base[32]; // Array mapping process ID to page table base.
+/* The root page table of each process is kept in one of NPAGETABLES
+ * slots, found from the pid through a hash table, so pids can grow
+ * without bound; pid 0 always holds slot 0.  The slot is used as the
+ * ASID in satp, so switching between processes does not flush the TLB,
+ * and asid_mask holds the ASID bits the CPU keeps */
+#define NPAGETABLES 64
+static struct {
+    int pid;
+    unsigned int* root;               // NULL if the slot is free
+    int next;                         // Hash chain or free list, -1 terminates
+} pagetables[NPAGETABLES];
+static int pagetable_hash[NPAGETABLES], pagetable_free_head;
+static unsigned int asid_mask;
+
+static void pagetable_init() {
+    memset(pagetable_hash, 0xFF, sizeof(pagetable_hash));
+    for (int i = 0; i < NPAGETABLES; i++) pagetables[i].next = (i == NPAGETABLES - 1)? -1 : i + 1;
+    pagetable_free_head = 0;
+}
+
+// The slot holding the page tables of pid, or -1
+static int pagetable_slot(int pid) {
+    for (int i = pagetable_hash[pid % NPAGETABLES]; i != -1; i = pagetables[i].next)
+        if (pagetables[i].pid == pid) return i;
+    return -1;
+}
+
+static int pagetable_insert(int pid, unsigned int* root) {
+    int i = pagetable_free_head;
+    if (i == -1) FATAL("pagetable_insert: more than %d processes have page tables", NPAGETABLES);
+    pagetable_free_head = pagetables[i].next;
+
+    pagetables[i].pid = pid;
+    pagetables[i].root = root;
+    pagetables[i].next = pagetable_hash[pid % NPAGETABLES];
+    pagetable_hash[pid % NPAGETABLES] = i;
+    return i;
+}
+
+static void pagetable_remove(int slot) {
+    int* link = &pagetable_hash[pagetables[slot].pid % NPAGETABLES];
+    while (*link != slot) link = &pagetables[*link].next;
+    *link = pagetables[slot].next;
+
+    pagetables[slot].root = NULL;
+    pagetables[slot].next = pagetable_free_head;
+    pagetable_free_head = slot;
+}
+
+static void tlb_flush_asid(int slot) {
+    if (slot & ~asid_mask) asm("sfence.vma zero, zero");
+    else asm("sfence.vma zero, %0" ::"r"(slot));
+}
+
+static void tlb_flush_page(int slot, int page_no) {
+    if (slot & ~asid_mask) asm("sfence.vma %0, zero" ::"r"(page_no << 12));
+    else asm("sfence.vma %0, %1" ::"r"(page_no << 12), "r"(slot));
+}
+
+/* The app code/data and argument/stack pages differ across processes,
+ * so their identity mappings are not global */
+static int is_user_page(unsigned int addr) {
+    return (addr >= APPS_ENTRY && addr < APPS_ENTRY + APPS_SIZE) ||
+           (addr >= APPS_ARG && addr < APPS_STACK_TOP);
+}
 
 void setup_identity_region(int pid, unsigned int addr, int npages, int flag) {
     int vpn1 = addr >> 22; // Calculate the first virtual page number component.
@@ -179,24 +504,26 @@ void setup_identity_region(int pid, unsigned int addr, int npages, int flag) {
         leaf = (void*)((root[vpn1] << 2) & 0xFFFFF000); // Get the leaf page table address.
     } else {
         // Leaf has not been allocated
-        earth->mmu_alloc(&frame_id, (void**)&leaf); // Allocate a frame for the leaf page table.
-        table[frame_id].pid = pid; // Assign the frame to the process.
-        memset(leaf, 0, PAGE_SIZE); // Initialize the leaf page table.
+        if (earth->mmu_alloc(&frame_id, (void**)&leaf, 1) < 0) // Allocate a zeroed frame for the leaf page table.
+            FATAL("setup_identity_region: no frame for the leaf of pid %d", pid);
+        frame_set_owner(frame_id, pid); // Assign the frame to the process.
         root[vpn1] = ((unsigned int)leaf >> 2) | 0x1; // Set the root entry to point to the leaf page table.
     }
 
     // Setup the entries in the leaf page table
     int vpn0 = (addr >> 12) & 0x3FF; // Calculate the second virtual page number component.
-    for (int i = 0; i < npages; i++) // Loop to set up each page.
-        leaf[vpn0 + i] = ((addr + i * PAGE_SIZE) >> 2) | flag; // Map each page.
+    for (int i = 0; i < npages; i++) { // Loop to set up each page.
+        unsigned int page = addr + i * PAGE_SIZE;
+        leaf[vpn0 + i] = (page >> 2) | flag | (is_user_page(page)? 0 : PTE_G); // Map each page.
+    }
 }
 
-void pagetable_identity_mapping(int pid) {
+static void pagetable_build_identity(int pid) {
     // Allocate the root page table and set the page table base (satp)
-    earth->mmu_alloc(&frame_id, (void**)&root); // Allocate a frame for the root page table.
-    table[frame_id].pid = pid; // Assign the frame to the process.
-    memset(root, 0, PAGE_SIZE); // Initialize the root page table.
-    pid_to_pagetable_base[pid] = root; // Set the process's page table base.
+    if (earth->mmu_alloc(&frame_id, (void**)&root, 1) < 0) // Allocate a zeroed frame for the root page table.
+        FATAL("pagetable_build_identity: no frame for the root of pid %d", pid);
+    frame_set_owner(frame_id, pid); // Assign the frame to the process.
+    pagetable_insert(pid, root); // Record the process's page table base.
 
     // Allocate the leaf page tables
     setup_identity_region(pid, 0x02000000, 16, OS_RWX);   // Map CLINT region.
@@ -210,61 +537,200 @@ void pagetable_identity_mapping(int pid) {
         setup_identity_region(pid, 0x08000000 + i * 0x400000, 1024, OS_RWX); // Map each 4MB block.
 }
 
-int page_table_map(int pid, int page_no, int frame_id) {
-    if (pid >= 32) FATAL("page_table_map: pid too large"); // Check for valid process ID.
+/* The identity tables of pid 0 are built once by mmu_init; every other
+ * process links its root to the same leaf tables and only gets private
+ * copies of the leaves holding user pages (see leaf_private); both return
+ * failure when no frame is left, and what was built stays with pid until
+ * mmu_free(pid) or the next attempt */
+static unsigned int* leaf_private(int pid, unsigned int* root, int vpn1) {
+    unsigned int* shared = pagetables[0].root;
+    unsigned int* leaf = (void*)((root[vpn1] << 2) & 0xFFFFF000);
+    if ((root[vpn1] & 0x1) && (pid == 0 || root[vpn1] != shared[vpn1]))
+        return leaf;                    // The leaf is private already
+
+    unsigned int* copy;
+    int present = root[vpn1] & 0x1;
+    if (earth->mmu_alloc(&frame_id, (void**)&copy, !present) < 0) return NULL; // Allocate a frame for the private leaf.
+    frame_set_owner(frame_id, pid); // Assign the frame to the process.
+    if (present) page_copy(copy, leaf);
+    root[vpn1] = ((unsigned int)copy >> 2) | 0x1;
+    return copy;
+}
+
+int pagetable_identity_mapping(int pid) {
+    if (pid == 0) {
+        pagetable_build_identity(0);
+        return 0;
+    }
+
+    if (earth->mmu_alloc(&frame_id, (void**)&root, 0) < 0) return -1; // Allocate a frame for the root page table.
+    frame_set_owner(frame_id, pid); // Assign the frame to the process.
+    page_copy(root, pagetables[0].root); // Link the shared leaf tables.
+    int slot = pagetable_insert(pid, root); // Record the process's page table base.
+    tlb_flush_asid(slot); // The ASID may hold entries of an earlier process.
+
+    if (leaf_private(pid, root, APPS_ENTRY >> 22) == NULL) return -1; // App code and data.
+    if (leaf_private(pid, root, APPS_ARG >> 22) == NULL) return -1;   // App arguments and stack.
+    return 0;
+}
+
+int page_table_map(int pid, int page_no, int frame_no) {
+    mmu_lock();
 
     // Check if page tables for pid do not exist, build the tables
-    if (!pid_to_pagetable_base[pid]) {
-        pagetable_identity_mapping(pid); // Create identity mapping for the process.
+    int slot = pagetable_slot(pid);
+    if (slot == -1 && pagetable_identity_mapping(pid) < 0) { // Create identity mapping for the process.
+        mmu_unlock();
+        return -1;
     }
+    slot = pagetable_slot(pid);
 
     // Calculate virtual page number (VPN) components
     int vpn1 = page_no >> 10; // Calculate the first virtual page number component.
     int vpn0 = page_no & 0x3FF; // Calculate the second virtual page number component.
 
-    // Fetch or create root page table
-    unsigned int *root = pid_to_pagetable_base[pid]; // Get the root page table for the process.
-    unsigned int *leaf;
-
-    if (root[vpn1] & 0x1) {
-        leaf = (void*)((root[vpn1] << 2) & 0xFFFFF000); // Get the leaf page table address.
-    } else {
-        earth->mmu_alloc(&frame_id, (void**)&leaf); // Allocate a frame for the leaf page table.
-        table[frame_id].pid = pid; // Assign the frame to the process.
-        memset(leaf, 0, PAGE_SIZE); // Initialize the leaf page table.
-        root[vpn1] = ((unsigned int)leaf >> 2) | 0x1; // Set the root entry to point to the leaf page table.
+    // Fetch the private leaf page table of pid for this page
+    unsigned int *leaf = leaf_private(pid, pagetables[slot].root, vpn1);
+    if (leaf == NULL) {
+        mmu_unlock();
+        return -1;  // Out of frames, the frame stays with its owner
     }
 
-    // Map the frame in the leaf page table
-    leaf[vpn0] = (frame_id << 2) | USER_RWX; // Map the frame with user permissions.
+    // Map the frame in the leaf page table and drop the stale translation
+    frame_set_owner(frame_no, pid);
+    table[frame_no].page_no = page_no;
+    leaf[vpn0] = ((unsigned int)paging_read(frame_no, 0) >> 2) | USER_RWX;
+    tlb_flush_page(slot, page_no);
 
+    mmu_unlock();
     return 0;   // Indicating success
 }
 
-int page_table_switch(int pid) {
-    if (pid >= 32) FATAL("page_table_switch: pid too large");
+static void page_table_free(int pid) {
+    // The frames of the tables are freed by mmu_free; the slot is reused
+    // by the next process and its ASID is flushed then
+    int slot = pagetable_slot(pid);
+    if (slot > 0) pagetable_remove(slot);
+}
 
-    /* Check if page tables for pid exist */
-    if (!pid_to_pagetable_base[pid]) {
-        FATAL("page_table_switch: page tables not initialized for pid");
+
+/* Map page_no of pid to the page of the ROM disk at block_no, read-only:
+ * page tables point at the ROM and the software TLB records the page */
+int mmu_map_rom(int pid, int page_no, int block_no) {
+    char* rom = disk_rom_addr(block_no);
+    if (rom == NULL || ((unsigned int)rom & (PAGE_SIZE - 1))) return -1;
+
+    mmu_lock();
+    int i;
+    for (i = 0; i < NXIP && xip[i].pid != 0; i++);
+    if (i == NXIP) {
+        mmu_unlock();
+        return -1;
+    }
+    xip[i].pid = pid;
+    xip[i].page_no = page_no;
+    xip[i].rom = rom;
+    xip[i].resident = 0;
+
+    if (earth->translation == PAGE_TABLE) {
+        unsigned int *leaf = NULL;
+        if (pagetable_slot(pid) != -1 || pagetable_identity_mapping(pid) == 0)
+            leaf = leaf_private(pid, pagetables[pagetable_slot(pid)].root, page_no >> 10);
+        if (leaf == NULL) {
+            xip[i].pid = 0;
+            mmu_unlock();
+            return -1;
+        }
+        leaf[page_no & 0x3FF] = ((unsigned int)rom >> 2) | USER_RX;
+        tlb_flush_asid(pagetable_slot(pid));
+    }
+    mmu_unlock();
+    return 0;
+}
+
+/* Free the frame at page_no of pid, if any; with page tables the page
+ * becomes invalid, so any access to it faults until it is mapped again,
+ * see proc_fault() in grass for the lazily loaded app pages */
+int mmu_unmap(int pid, int page_no) {
+    mmu_lock();
+    int frame_no = frame_lookup(pid, page_no);
+    if (frame_no != -1) frame_free(frame_no);
+
+    if (earth->translation == PAGE_TABLE) {
+        unsigned int *leaf = NULL;
+        if (pagetable_slot(pid) != -1 || pagetable_identity_mapping(pid) == 0)
+            leaf = leaf_private(pid, pagetables[pagetable_slot(pid)].root, page_no >> 10);
+        if (leaf == NULL) {
+            mmu_unlock();
+            return -1;
+        }
+        leaf[page_no & 0x3FF] = 0;
+        tlb_flush_page(pagetable_slot(pid), page_no);
     }
+    mmu_unlock();
+    return 0;
+}
+
+int page_table_switch(int pid) {
+    /* Check if page tables for pid exist */
+    int slot = pagetable_slot(pid);
+    if (slot == -1) FATAL("page_table_switch: page tables not initialized for pid %d", pid);
 
-    unsigned int *root = pid_to_pagetable_base[pid];
+    unsigned int *root = pagetables[slot].root;
 
-    /* Update satp register with the base address of the page table */
-    asm("csrw satp, %0" ::"r"(((unsigned int)root >> 12) | (1 << 31)));
+    /* Update satp with the page table base and the slot as ASID; the TLB
+     * only needs a flush if the CPU cannot hold this ASID */
+    asm("csrw satp, %0" ::"r"(((unsigned int)root >> 12) | ((slot & asid_mask) << 22) | (1 << 31)));
+    if (slot & ~asid_mask) asm("sfence.vma zero, zero");
 
     return 0;   // Indicating success
 }
 
+#ifdef MMU_BENCH
+/* Build with -DMMU_BENCH to measure page_table_switch between two pids,
+ * with ASIDs and with a full TLB flush per switch as before */
+static unsigned int bench_switches(int pid0, int pid1, int flush) {
+    unsigned int start, end;
+    asm("csrr %0, mcycle" : "=r"(start));
+    for (int i = 0; i < 1000; i++) {
+        page_table_switch(i % 2? pid1 : pid0);
+        if (flush) asm("sfence.vma zero, zero");
+        for (int j = 0; j < 16; j++) *(volatile int*)(0x80004000 + j * PAGE_SIZE);
+    }
+    asm("csrr %0, mcycle" : "=r"(end));
+    return (end - start) / 1000;
+}
+
+static void page_table_bench() {
+    int pid0 = 30, pid1 = 31;
+    pagetable_identity_mapping(pid0);
+    pagetable_identity_mapping(pid1);
+
+    INFO("page_table_switch: %d cycles with ASID, %d cycles with full flush",
+         bench_switches(pid0, pid1, 0), bench_switches(pid0, pid1, 1));
+
+    mmu_free(pid0);
+    mmu_free(pid1);
+    page_table_switch(0);
+}
+#endif
+
 /* MMU Initialization */
 void mmu_init() {
-    /* Initialize the paging device */
+    /* Initialize the paging device and the frame lists */
     paging_init();
+    frame_table_init();
 
     /* Initialize MMU interface functions */
     earth->mmu_free = mmu_free;
     earth->mmu_alloc = mmu_alloc;
+    earth->mmu_free_frame = mmu_free_frame;
+    earth->mmu_copy = mmu_copy;
+    earth->mmu_flush = mmu_flush;
+    earth->mmu_grant = mmu_grant;
+    earth->mmu_map_rom = mmu_map_rom;
+    earth->mmu_unmap = mmu_unmap;
+    earth->trace = NULL;
 
     /* Setup a PMP region for the whole 4GB address space */
     asm("csrw pmpaddr0, %0" : : "r" (0x40000000));
@@ -294,21 +760,36 @@ void mmu_init() {
     earth->mmu_switch = soft_tlb_switch;
     if (earth->platform == ARTY) return;
 
-    /* Choose memory translation mechanism in QEMU */
+    /* Choose memory translation mechanism in QEMU, or at compile time with
+     * -DTRANSLATION_CHOICE=0 (page tables) or 1 (software TLB) */
+    char buf[2];
+#ifdef TRANSLATION_CHOICE
+    buf[0] = '0' + TRANSLATION_CHOICE;
+#else
     CRITICAL("Choose a memory translation mechanism:");
     printf("Enter 0: page tables\r\nEnter 1: software TLB\r\n");
 
-    char buf[2];
     for (buf[0] = 0; buf[0] != '0' && buf[0] != '1'; earth->tty_read(buf, 2));
+#endif
     earth->translation = (buf[0] == '0') ? PAGE_TABLE : SOFT_TLB;
     INFO("%s translation is chosen", earth->translation == PAGE_TABLE ? "Page table" : "Software");
 
     if (earth->translation == PAGE_TABLE) {
+        /* Find the implemented ASID bits while translation is still off */
+        asm("csrw satp, %0" ::"r"(0x1FF << 22));
+        asm("csrr %0, satp" : "=r"(asid_mask));
+        asid_mask = (asid_mask >> 22) & 0x1FF;
+
         /* Setup an identity mapping using page tables */
+        pagetable_init();
         pagetable_identity_mapping(0);
         asm("csrw satp, %0" ::"r"(((unsigned int)root >> 12) | (1 << 31)));
+        asm("sfence.vma zero, zero");
 
         earth->mmu_map = page_table_map;
         earth->mmu_switch = page_table_switch;
+#ifdef MMU_BENCH
+        page_table_bench();
+#endif
     }
 }
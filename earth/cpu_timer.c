@@ -5,7 +5,8 @@
 
 /* Author: Yunhao Zhang
  * Description: timer reset and initialization
- * mtime is at 0x200bff8 and mtimecmp is at 0x2004000 in the memory map
+ * mtime is at 0x200bff8 and mtimecmp is at 0x2004000 in the memory map,
+ * followed by the mtimecmp of the other harts
  * see section 3.1.15 of references/riscv-privileged-v1.10.pdf
  * and section 9.1, 9.3 of references/sifive-fe310-v19p04.pdf
  */
@@ -23,18 +24,24 @@ static unsigned long long mtime_get() {
 }
 
 static int mtimecmp_set(unsigned long long time) {
-    REGW(0x2004000, 4) = 0xFFFFFFFF;
-    REGW(0x2004000, 0) = (unsigned int)time;
-    REGW(0x2004000, 4) = (unsigned int)(time >> 32);
+    unsigned int mtimecmp = 0x2004000 + 8 * HART_ID();
+    REGW(mtimecmp, 4) = 0xFFFFFFFF;
+    REGW(mtimecmp, 0) = (unsigned int)time;
+    REGW(mtimecmp, 4) = (unsigned int)(time >> 32);
 
     return 0;
 }
 
+/* The kernel programs the next deadline itself with timer_set(), so it
+ * can vary the time slice and skip ticks; timer_reset() arms one quantum */
 static unsigned int QUANTUM;
 int timer_reset() { return mtimecmp_set(mtime_get() + QUANTUM); }
 
 void timer_init()  {
     earth->timer_reset = timer_reset;
+    earth->timer_get = mtime_get;
+    earth->timer_set = mtimecmp_set;
     QUANTUM = (earth->platform == ARTY)? 5000 : 500000;
-    mtimecmp_set(0x0FFFFFFFFFFFFFFFUL);
+    earth->timer_quantum = QUANTUM;
+    mtimecmp_set(TIMER_NEVER);
 }
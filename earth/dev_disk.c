@@ -5,6 +5,8 @@
 
 /* Author: Yunhao Zhang
  * Description: a simple disk device driver
+ * The disk is chosen at boot, or at compile time with -DDISK_CHOICE=0
+ * (microSD card) or -DDISK_CHOICE=1 (on-board ROM), see EARTH_FLAGS
  */
 
 #include "egos.h"
@@ -29,6 +31,11 @@ int disk_read(int block_no, int nblocks, char* dst) {
     return 0;
 }
 
+/* The address of a block if the disk is the memory-mapped ROM, or NULL */
+char* disk_rom_addr(int block_no) {
+    return (type == FLASH_ROM)? (char*)0x20800000 + block_no * BLOCK_SIZE : NULL;
+}
+
 int disk_write(int block_no, int nblocks, char* src) {
     if (type == FLASH_ROM)
         FATAL("disk_write: Writing to the read-only ROM");
@@ -41,11 +48,15 @@ void disk_init() {
     earth->disk_read = disk_read;
     earth->disk_write = disk_write;
 
+    char buf[2];
+#ifdef DISK_CHOICE
+    buf[0] = '0' + DISK_CHOICE;
+#else
     CRITICAL("Choose a disk:");
     printf("Enter 0: microSD card\r\nEnter 1: on-board ROM\r\n");
 
-    char buf[2];
     for (buf[0] = 0; buf[0] != '0' && buf[0] != '1'; earth->tty_read(buf, 2));
+#endif
     type = (buf[0] == '0')? SD_CARD : FLASH_ROM;
     INFO("%s is chosen", type == SD_CARD? "microSD" : "on-board ROM");
 
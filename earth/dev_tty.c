@@ -7,6 +7,18 @@
  * Description: a simple tty device driver
  * uart_getc() and uart_putc() are implemented in bus_uart.c
  * printf-related functions are linked from the compiler's C library
+ *
+ * tty_write() only copies into a TX ring buffer and fills the UART FIFO;
+ * tty_tx_intr() refills the FIFO from the TX watermark interrupt, so a
+ * writer waits only when the ring buffer is full.  Every process, the
+ * kernel and the other harts write to the ring, so tx_lock guards both
+ * the enqueue and tx_pump().  A writer may be preempted while holding
+ * it, and the kernel runs with interrupts masked, so a writer which does
+ * not get the lock within TX_LOCK_SPINS tries writes straight to the
+ * UART instead; its output may then overtake the buffered output, but
+ * no character is lost.  tty_tx_intr() never waits for the lock and
+ * leaves the refill to its holder.
+ * Typed characters are buffered by the RX interrupt, see tty_rx_intr().
  */
 
 #define LIBC_STDIO
@@ -17,39 +29,148 @@
 int uart_getc(int* c);
 void uart_putc(int c);
 void uart_init(long baud_rate);
+int uart_tx_full();
+void uart_txwm_enable(int on);
+
+#define TX_BUF_SIZE 1024                /* power of 2 */
+#define TX_LOCK_SPINS 1000
+static char tx_buf[TX_BUF_SIZE];
+static volatile unsigned int tx_head, tx_tail;
+static volatile int tx_lock;
+static int tx_intr, rx_intr;            /* set once the UART interrupt is routed */
+
+/* amoswap.w.aq from the A extension, which both boards have, see
+ * library/libc/spinlock.c; taken even with a single hart, where the
+ * holder may be a preempted process */
+static int tx_trylock() {
+    int busy;
+    asm volatile(".insn r 0x2f, 2, 0x6, %0, %1, %2"
+                 : "=r"(busy) : "r"(&tx_lock), "r"(1) : "memory");
+    return !busy;
+}
+
+static int tx_lock_spin() {
+    for (int i = 0; i < TX_LOCK_SPINS; i++)
+        if (tx_trylock()) return 1;
+    return 0;
+}
+
+static void tx_unlock() {
+    asm volatile("fence rw, w" ::: "memory");
+    tx_lock = 0;
+}
+
+/* With tx_lock held, move the ring into the UART FIFO and release the lock */
+static void tx_pump() {
+    while (tx_tail != tx_head && !uart_tx_full())
+        uart_putc(tx_buf[tx_tail++ % TX_BUF_SIZE]);
+    tx_unlock();
+    uart_txwm_enable(tx_intr && tx_tail != tx_head);
+}
+
+void tty_tx_intr() {
+    /* Called by cpu_intr.c for the TX watermark interrupt */
+    if (tx_trylock()) tx_pump();
+    else uart_txwm_enable(0); /* the holder of tx_lock re-enables it */
+}
 
-static int c, is_reading;
-int tty_recv_intr() { return (is_reading)? 0 : (uart_getc(&c) == 3); }
+void tty_intr_enable() { tx_intr = rx_intr = 1; }
+
+/* Write out the ring buffer: all of it if wait, or what fits into the FIFO */
+int tty_drain(int wait) {
+    do {
+        if (!tx_lock_spin()) return -1;
+        tx_pump();
+    } while (wait && tx_tail != tx_head);
+    if (wait) while (uart_tx_full());
+    return 0;
+}
 
 int tty_write(char* buf, int len) {
-    for (int i = 0; i < len; i++) uart_putc(buf[i]);
+    for (int i = 0; i < len; ) {
+        if (!tx_lock_spin()) {
+            while (i < len) uart_putc(buf[i++]);
+            break;
+        }
+
+        /* Enqueue what fits, then make room in the FIFO if the ring is full */
+        while (i < len && tx_head - tx_tail < TX_BUF_SIZE)
+            tx_buf[tx_head++ % TX_BUF_SIZE] = buf[i++];
+        tx_pump();
+    }
+    tty_drain(!tx_intr); /* nothing else drains the buffer during boot */
+    return len;
 }
 
-int tty_read(char* buf, int len) {
-    is_reading = 1;
-    for (int i = 0; i < len - 1; i++) {
-        for (c = -1; c == -1; uart_getc(&c));
-        buf[i] = (char)c;
+/* Receive side: the RX interrupt feeds typed characters into a ring of
+ * lines.  The line being typed lies between rx_head and rx_edit, so that
+ * backspace can edit it; complete lines end with '\n' and lie between
+ * rx_tail and rx_head, where tty_read() takes them from */
+#define RX_BUF_SIZE 256                 /* power of 2 */
+static char rx_buf[RX_BUF_SIZE];
+static volatile unsigned int rx_tail, rx_head, rx_edit, rx_ctrl_c;
 
+static void rx_echo(char* s) { while (*s) uart_putc(*s++); }
+
+/* Handle the characters in the RX FIFO; return 1 if a line is complete */
+int tty_rx_intr() {
+    int c, line = 0;
+    while (uart_getc(&c) != -1) {
         switch (c) {
         case 0x03:  /* Ctrl+C    */
-            buf[0] = 0;
+            rx_ctrl_c = 1;
+            rx_edit = rx_head;
+            line = 1;   /* grass sees the Ctrl+C even if its '\n' is dropped */
         case 0x0d:  /* Enter     */
-            buf[i] = is_reading = 0;
-            printf("\r\n");
-            return c == 0x03? 0 : i;
+            if (rx_edit - rx_tail >= RX_BUF_SIZE) break; /* the ring is full of lines */
+            rx_buf[rx_edit++ % RX_BUF_SIZE] = '\n';
+            rx_head = rx_edit;
+            rx_echo("\r\n");
+            line = 1;
+            break;
         case 0x7f:  /* Backspace */
-            c = 0;
-            if (i) printf("\b \b");
-            i = i ? i - 2 : i - 1;
+            if (rx_edit != rx_head) {
+                rx_edit--;
+                rx_echo("\b \b");
+            }
+            break;
+        default:    /* Keep room for the '\n'; the echo may overtake buffered output */
+            if (rx_edit - rx_tail >= RX_BUF_SIZE - 1) break;
+            rx_buf[rx_edit++ % RX_BUF_SIZE] = c;
+            uart_putc(c);
         }
+    }
+    return line;
+}
 
-        if (c) printf("%c", c);
-        fflush(stdout);
+int tty_recv_intr() {
+    /* Return whether Ctrl+C was typed since the last call */
+    int ctrl_c = rx_ctrl_c;
+    rx_ctrl_c = 0;
+    return ctrl_c;
+}
+
+int tty_ready() { return rx_tail != rx_head; }
+
+/* Copy the next line without its '\n' into buf, truncated to len - 1
+ * bytes; return its length, or -1 if no line has been typed yet and the
+ * caller should wait, see sys_tty_read() in grass/syscall.c.  Without the
+ * RX interrupt, during boot, poll the UART until a line is complete or
+ * len - 1 characters are typed */
+int tty_read(char* buf, int len) {
+    while (!rx_intr && !tty_ready()) {
+        tty_rx_intr();
+        if (rx_edit - rx_head < len - 1) continue;
+        rx_buf[rx_edit++ % RX_BUF_SIZE] = '\n'; /* buf is full, as if Enter was typed */
+        rx_head = rx_edit;
     }
+    if (!tty_ready()) return -1;
 
-    buf[len - 1] = is_reading = 0;    
-    return len - 1;
+    int i = 0;
+    for (char c; (c = rx_buf[rx_tail++ % RX_BUF_SIZE]) != '\n'; )
+        if (i < len - 1) buf[i++] = c;
+    buf[i] = 0;
+    return i;
 }
 
 #define LOG(x, y)  printf(x); \
@@ -70,6 +191,8 @@ int tty_info(const char *format, ...) { LOG("[INFO] ", "\r\n") }
 int tty_fatal(const char *format, ...)
 {
     LOG("\x1B[1;31m[FATAL] ", "\x1B[1;0m\r\n") /* red color */
+    fflush(stdout);
+    tty_drain(1);
     while(1);
 }
 
@@ -89,10 +212,13 @@ void tty_init() {
 
     /* Wait for the tty device to be ready */
     for (int c = 0; c != -1; uart_getc(&c));
+    rx_tail = rx_head = rx_edit = rx_ctrl_c = 0;
 
     earth->tty_read = tty_read;
     earth->tty_write = tty_write;
     earth->tty_recv_intr = tty_recv_intr;
+    earth->tty_drain = tty_drain;
+    earth->tty_ready = tty_ready;
     
     earth->tty_printf = tty_printf;
     earth->tty_info = tty_info;
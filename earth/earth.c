@@ -14,6 +14,7 @@
 #include "egos.h"
 #include <string.h>
 
+void counter_init();
 void tty_init();
 void disk_init();
 void mmu_init();
@@ -24,38 +25,50 @@ struct grass *grass = (void*)APPS_STACK_TOP;
 struct earth *earth = (void*)GRASS_STACK_TOP;
 extern char bss_start, bss_end, data_rom, data_start, data_end;
 
+/* The timer is not initialized yet, so read the low word of mtime */
+static void boot_checkpoint(int phase) {
+    grass->boot_time[phase] = REGW(0x200BFF8, 0);
+}
+
 static void earth_init() {
     /* Arty board does not support the supervisor mode or page tables */
     int MISA_SMODE = (1 << 18), misa;
     asm("csrr %0, misa" : "=r"(misa));
     earth->platform = (misa & MISA_SMODE)? QEMU : ARTY;
+    counter_init();
 
     tty_init();
+    boot_checkpoint(BOOT_TTY);
     CRITICAL("--- Booting on %s ---", earth->platform == QEMU? "QEMU" : "Arty");
 
     disk_init();
+    boot_checkpoint(BOOT_DISK);
     SUCCESS("Finished initializing the tty and disk devices");
 
     mmu_init();
+    if (NHARTS > 1 && earth->translation == SOFT_TLB)
+        FATAL("earth_init: the software TLB holds one process, %d harts need page tables", NHARTS);
     timer_init();
     intr_init();
+    boot_checkpoint(BOOT_CPU);
     SUCCESS("Finished initializing the CPU MMU, timer and interrupts");
 }
 
-static int grass_read(int block_no, char* dst) {
-    return earth->disk_read(GRASS_EXEC_START + block_no, 1, dst);
+static int grass_read(int block_no, int nblocks, char* dst) {
+    return earth->disk_read(GRASS_EXEC_START + block_no, nblocks, dst);
 }
 
 int main() {
     /* Prepare the bss and data memory regions */
     memset(&bss_start, 0, (&bss_end - &bss_start));
     memcpy(&data_start, &data_rom, (&data_end - &data_start));
+    boot_checkpoint(BOOT_START);
 
     /* Initialize the earth layer */
     earth_init();
 
     /* Load and enter the grass layer */
-    elf_load(0, grass_read, 0, 0);
+    elf_load(0, grass_read, GRASS_EXEC_START, 0, 0);
 
     int mstatus;
     int M_MODE = 3, S_MODE = 1; /* U_MODE = 0 */
@@ -9,16 +9,25 @@
  */
     .section .image.placeholder
     .section .text.enter
-    .global earth_entry, trap_entry_vm
+    .global earth_entry, trap_entry_vm, trap_entry_ecall
 earth_entry:
     /* Disable machine interrupt */
     li t0, 0x8
     csrc mstatus, t0
 
+    /* Keep the hart id in tp, see HART_ID() in library/egos.h; only
+     * hart 0 boots, and the sifive_e machine of QEMU has no other hart */
+    csrr tp, mhartid
+    bnez tp, hart_park
+
     /* Call main() of earth.c */
     li sp, 0x80003f80
     call main
 
+hart_park:
+    wfi
+    j hart_park
+
 trap_entry_vm:
     csrw mscratch, t0
 
@@ -27,6 +36,26 @@ trap_entry_vm:
     li t0, 0x20800
     csrs mstatus, t0
 
-    /* Jump to trap_entry() without modifying any registers */
+    /* Jump to trap_entry_ecall() without modifying any registers */
+    csrr t0, mscratch
+    j trap_entry_ecall
+
+    .align 2
+trap_entry_ecall:
+    /* System calls (mcause 8 or 11) skip the register saving of
+     * trap_entry(): the ecall in grass/syscall.c declares every
+     * caller-saved register as clobbered and C code keeps the others */
+    csrw mscratch, t0
+    csrr t0, mcause
+    addi t0, t0, -8
+    beqz t0, ecall
+    addi t0, t0, -3
+    beqz t0, ecall
+
+    /* Other exceptions and interrupts take the full path */
     csrr t0, mscratch
     j trap_entry
+ecall:
+    csrr a0, mcause
+    call ecall_entry
+    mret
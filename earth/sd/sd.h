@@ -1,9 +1,11 @@
 #pragma once
 
 #include "egos.h"
+#include <stddef.h>
 
 char recv_data_byte();
 char send_data_byte(char);
+void spi_xfer_block(char* tx, char* rx, int len);
 
 char sd_exec_cmd(char*);
 char sd_exec_acmd(char*);
@@ -27,3 +29,5 @@ int sdwrite(int offset, int nblock, char* src);
 #define SPI1_TXDATA   72UL
 #define SPI1_RXDATA   76UL
 #define SPI1_FCTRL    96UL
+
+#define SPI1_FIFO_DEPTH  8
@@ -100,9 +100,75 @@ static void spi_config() {
     REGW(SPI1_BASE, SPI1_FMT) = 0x80000;
 }
 
-static void spi_set_clock(long baud_rate) {
-    long div = (CPU_CLOCK_RATE / (2 * baud_rate)) - 1;
-    REGW(SPI1_BASE, SPI1_SCKDIV) = (div & 0xFFF);
+static long spi_set_clock(long baud_rate) {
+    /* Round the divisor up so that the clock never exceeds baud_rate */
+    long div = (CPU_CLOCK_RATE + 2 * baud_rate - 1) / (2 * baud_rate) - 1;
+    div = (div < 0)? 0 : (div > 0xFFF)? 0xFFF : div;
+    REGW(SPI1_BASE, SPI1_SCKDIV) = div;
+    return CPU_CLOCK_RATE / (2 * (div + 1));
+}
+
+static long sd_max_clock() {
+    /* Read the CSD register with cmd9 and decode TRAN_SPEED (byte 3) */
+    char csd[16], cmd9[] = {0x49, 0x00, 0x00, 0x00, 0x00, 0xFF};
+    while (recv_data_byte() != 0xFF);
+    if (sd_exec_cmd(cmd9)) return CPU_CLOCK_RATE / 4;
+
+    while (recv_data_byte() != 0xFE);
+    spi_xfer_block(NULL, csd, 16);
+    recv_data_byte();
+    recv_data_byte();
+
+    static const int unit[] = {10000, 100000, 1000000, 10000000};
+    static const int value[] = {0, 10, 12, 13, 15, 20, 25, 30,
+                                35, 40, 45, 50, 55, 60, 70, 80};
+    int speed = csd[3] & 0xFF;
+    if ((speed & 0x7) > 3) return CPU_CLOCK_RATE / 4;
+    return (long)unit[speed & 0x7] * value[(speed >> 3) & 0xF];
+}
+
+static void sd_switch_high_speed() {
+    /* cmd6 in switch mode selects function 1 (high speed) of group 1;
+     * the card replies with a 64-byte status block */
+    char status[64], cmd6[] = {0x46, 0x80, 0xFF, 0xFF, 0xF1, 0xFF};
+    while (recv_data_byte() != 0xFF);
+    if (sd_exec_cmd(cmd6)) return;
+
+    while (recv_data_byte() != 0xFE);
+    spi_xfer_block(NULL, status, 64);
+    recv_data_byte();
+    recv_data_byte();
+
+    if ((status[16] & 0xF) == 1) INFO("SD card switched to high speed mode");
+}
+
+static int sd_probe() {
+    /* Send cmd13 and expect an all-zero R2 reply, without FATAL on failure */
+    char cmd13[] = {0x4D, 0x00, 0x00, 0x00, 0x00, 0xFF};
+    for (int i = 0; i < 8000 && recv_data_byte() != 0xFF; i++);
+    for (int i = 0; i < 6; i++) send_data_byte(cmd13[i]);
+
+    char reply = 0xFF;
+    for (int i = 0; i < 100 && (reply = recv_data_byte()) == (char)0xFF; i++);
+    char status = recv_data_byte();
+    return (reply == 0 && status == 0)? 0 : -1;
+}
+
+static void sd_clock_ramp() {
+    /* Try the fastest clock the card advertises and step down to
+     * CPU_CLOCK_RATE / 4, which sdinit() has already verified */
+    sd_switch_high_speed();
+    long baud_rate = sd_max_clock(), safe_rate = CPU_CLOCK_RATE / 4;
+
+    for (long rate = spi_set_clock(baud_rate); rate > safe_rate;
+         rate = spi_set_clock(rate - 1))
+        if (sd_probe() == 0) {
+            INFO("Set SPI clock frequency to %ldHz", rate);
+            return;
+        }
+
+    spi_set_clock(safe_rate);
+    while (recv_data_byte() != 0xFF);
 }
 
 void sdinit() {
@@ -127,4 +193,6 @@ void sdinit() {
 
     if (SD_CARD_TYPE == SD_TYPE_SD2) sd_check_capacity();
     if (SD_CARD_TYPE != SD_TYPE_SDHC) FATAL("Only SDHC/SDXC supported");
+
+    sd_clock_ramp();
 }
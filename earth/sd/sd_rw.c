@@ -9,6 +9,7 @@
 
 #include "sd.h"
 #include "disk.h"
+#include "counter.h"
 
 static void single_read(int offset, char* dst) {
     /* Wait until SD card is not busy */
@@ -23,7 +24,7 @@ static void single_read(int offset, char* dst) {
  
     /* Wait for the data packet and ignore the 2-byte checksum */
     while (recv_data_byte() != 0xFE);
-    for (int i = 0; i < BLOCK_SIZE; i++) dst[i] = recv_data_byte();
+    spi_xfer_block(NULL, dst, BLOCK_SIZE);
     recv_data_byte();
     recv_data_byte();
 }
@@ -40,7 +41,7 @@ static void single_write(int offset, char* src) {
 
     /* Send data packet: token + block + dummy 2-byte checksum */
     send_data_byte(0xFE);
-    for (int i = 0; i < BLOCK_SIZE; i++) send_data_byte(src[i]);
+    spi_xfer_block(src, NULL, BLOCK_SIZE);
     send_data_byte(0xFF);
     send_data_byte(0xFF);
 
@@ -50,20 +51,89 @@ static void single_write(int offset, char* src) {
         FATAL("SD card write ack with status 0x%.2x", reply);
 }
 
-int sdread(int offset, int nblock, char* dst) {
-    /* A better way to read multiple blocks using SD card
-     * command 18 is left to students as a course project */
+static void sd_stop_transmission() {
+    /* Send cmd12; the card sends one stuff byte before the R1b reply */
+    char cmd12[] = {0x4C, 0x00, 0x00, 0x00, 0x00, 0xFF};
+    COUNT("sd.cmd", 1);
+    for (int i = 0; i < 6; i++) send_data_byte(cmd12[i]);
+    recv_data_byte();
+
+    char reply;
+    while ((reply = recv_data_byte()) & 0x80);
+    if (reply) FATAL("SD card replies cmd12 with status 0x%.2x", reply);
+
+    /* Wait until the card releases the busy signal */
+    while (recv_data_byte() != 0xFF);
+}
+
+static void multi_read(int offset, int nblock, char* dst) {
+    /* Wait until SD card is not busy */
+    while (recv_data_byte() != 0xFF);
+
+    /* Send read request with cmd18 */
+    char *arg = (void*)&offset;
+    char reply, cmd18[] = {0x52, arg[3], arg[2], arg[1], arg[0], 0xFF};
+    if (reply = sd_exec_cmd(cmd18))
+        FATAL("SD card replies cmd18 with status 0x%.2x", reply);
+
+    /* Every block is a data packet: token + block + 2-byte checksum */
+    for (int b = 0; b < nblock; b++, dst += BLOCK_SIZE) {
+        while (recv_data_byte() != 0xFE);
+        spi_xfer_block(NULL, dst, BLOCK_SIZE);
+        recv_data_byte();
+        recv_data_byte();
+    }
+
+    sd_stop_transmission();
+}
 
-    for (int i = 0; i < nblock; i++)
-        single_read(offset + i, dst + BLOCK_SIZE * i);
+static void multi_write(int offset, int nblock, char* src) {
+    /* Wait until SD card is not busy */
+    while (recv_data_byte() != 0xFF);
+
+    /* Send write request with cmd25 */
+    char *arg = (void*)&offset;
+    char reply, cmd25[] = {0x59, arg[3], arg[2], arg[1], arg[0], 0xFF};
+    if (reply = sd_exec_cmd(cmd25))
+        FATAL("SD card replies cmd25 with status 0x%.2x", reply);
+
+    for (int b = 0; b < nblock; b++, src += BLOCK_SIZE) {
+        /* Send data packet: multi-block token + block + dummy checksum */
+        send_data_byte(0xFC);
+        spi_xfer_block(src, NULL, BLOCK_SIZE);
+        send_data_byte(0xFF);
+        send_data_byte(0xFF);
+
+        /* Wait for SD card ack of data packet and for the write to finish */
+        while ((reply = recv_data_byte()) == 0xFF);
+        if ((reply & 0x1F) != 0x05)
+            FATAL("SD card write ack with status 0x%.2x", reply);
+        while (recv_data_byte() != 0xFF);
+    }
+
+    /* Send the stop-tran token and wait until the card is not busy */
+    send_data_byte(0xFD);
+    recv_data_byte();
+    while (recv_data_byte() != 0xFF);
+}
+
+int sdread(int offset, int nblock, char* dst) {
+    /* Use cmd18 for multiple blocks so that the command frame
+     * and the R1 response are paid once per request, not per block */
+    COUNT("sd.read", nblock * BLOCK_SIZE);
+    if (nblock == 1)
+        single_read(offset, dst);
+    else if (nblock > 1)
+        multi_read(offset, nblock, dst);
     return 0;
 }
 
 int sdwrite(int offset, int nblock, char* src) {
-    /* A better way to write multiple blocks using SD card
-     * command 25 is left to students as a course project */
-
-    for (int i = 0; i < nblock; i++)
-        single_write(offset + i, src + BLOCK_SIZE * i);
+    /* Use cmd25 for multiple blocks, see sdread() */
+    COUNT("sd.write", nblock * BLOCK_SIZE);
+    if (nblock == 1)
+        single_write(offset, src);
+    else if (nblock > 1)
+        multi_write(offset, nblock, src);
     return 0;
 }
@@ -8,6 +8,7 @@
  */
 
 #include "sd.h"
+#include "counter.h"
 
 char send_data_byte(char byte) {
     while (REGW(SPI1_BASE, SPI1_TXDATA) & (1 << 31));
@@ -20,7 +21,27 @@ char send_data_byte(char byte) {
 
 char recv_data_byte() { return send_data_byte(0xFF); }
 
+void spi_xfer_block(char* tx, char* rx, int len) {
+    /* Keep up to 8 bytes in flight so that the TX FIFO never runs dry
+     * while the RX FIFO is drained in parallel; tx == NULL sends 0xFF
+     * and rx == NULL discards the received bytes */
+    int nsent = 0, nrecv = 0;
+    while (nrecv < len) {
+        if (nsent < len && nsent - nrecv < SPI1_FIFO_DEPTH &&
+            !(REGW(SPI1_BASE, SPI1_TXDATA) & (1 << 31))) {
+            REGB(SPI1_BASE, SPI1_TXDATA) = tx? tx[nsent] : 0xFF;
+            nsent++;
+        }
+
+        long rxdata = REGW(SPI1_BASE, SPI1_RXDATA);
+        if (rxdata & (1 << 31)) continue;
+        if (rx) rx[nrecv] = (char)(rxdata & 0xFF);
+        nrecv++;
+    }
+}
+
 char sd_exec_cmd(char* cmd) {
+    COUNT("sd.cmd", 1);
     for (int i = 0; i < 6; i++) send_data_byte(cmd[i]);
 
     for (int reply, i = 0; i < 8000; i++)
@@ -13,31 +13,56 @@
 #include "egos.h"
 #include "process.h"
 #include "syscall.h"
+#include <string.h>
 
 // Define pointers to grass and earth structures, initializing them with predefined stack top addresses.
 struct grass *grass = (void*)APPS_STACK_TOP;
 struct earth *earth = (void*)GRASS_STACK_TOP;
 
-// Function to read a block from the disk.
-// 'block_no' specifies the block number to read, 'dst' is the destination buffer.
+// Function to read blocks from the disk.
+// 'block_no' specifies the first block to read, 'nblocks' how many blocks, 'dst' is the destination buffer.
 // It calls the 'disk_read' function of the 'earth' structure, offsetting the block number by SYS_PROC_EXEC_START.
-static int sys_proc_read(int block_no, char* dst) {
-    return earth->disk_read(SYS_PROC_EXEC_START + block_no, 1, dst);
+static int sys_proc_read(int block_no, int nblocks, char* dst) {
+    return earth->disk_read(SYS_PROC_EXEC_START + block_no, nblocks, dst);
 }
 
 // Main function of the program.
 int main() {
     // Log entry into the grass layer of the operating system.
     CRITICAL("Enter the grass layer");
+    grass->boot_time[BOOT_GRASS] = earth->timer_get();
 
-    // Initialize the grass interface functions for process management and system calls.
+    // Initialize the ready queues, then the grass interface functions for process management and system calls.
+    proc_init();
+    grass->proc_nslots = proc_nslots;
     grass->proc_alloc = proc_alloc;
     grass->proc_free = proc_free;
     grass->proc_set_ready = proc_set_ready;
+    grass->proc_info = proc_get_info;
+    grass->proc_idle_time = proc_idle_time;
+    grass->proc_map_lazy = proc_map_lazy;
+    grass->proc_map_drop = proc_map_drop;
+    grass->prof_ctl = prof_ctl;
+    grass->trace_read = trace_read;
+    grass->proc_pipe = pipe_open;
+    trace_init();
 
     grass->sys_exit = sys_exit;
+    grass->sys_null = sys_null;
+    grass->sys_sleep = sys_sleep;
+    grass->sys_tty_read = sys_tty_read;
+    grass->sys_pipe_read = sys_pipe_read;
+    grass->sys_pipe_write = sys_pipe_write;
     grass->sys_send = sys_send;
     grass->sys_recv = sys_recv;
+    grass->sys_try_recv = sys_try_recv;
+    grass->sys_recv_timed = sys_recv_timed;
+    grass->sys_call = sys_call;
+    grass->sys_reply_recv = sys_reply_recv;
+    grass->sys_grant = sys_grant;
+    grass->sys_accept = sys_accept;
+    grass->dir_generation = 0;
+    memset(grass->file_version, 0, sizeof(grass->file_version));
 
     // Register functions to handle interrupts and exceptions in the earth layer.
     earth->intr_register(intr_entry);
@@ -46,7 +71,7 @@ int main() {
     // Load the first kernel process, identified by GPID_PROCESS.
     // It logs the information, loads the process using 'elf_load', and sets it to running.
     INFO("Load kernel process #%d: sys_proc", GPID_PROCESS);
-    elf_load(GPID_PROCESS, sys_proc_read, 0, 0);
+    elf_load(GPID_PROCESS, sys_proc_read, SYS_PROC_EXEC_START, 0, 0);
     proc_set_running(proc_alloc());
     earth->mmu_switch(GPID_PROCESS);
 
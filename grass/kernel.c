@@ -6,7 +6,9 @@
 /* Author: Yunhao Zhang
  * Description: Kernel ≈ 3 handlers
  *     proc_yield() handles timer interrupt for process scheduling
+ *     (proc_handoff() switches straight to the partner of a rendezvous)
  *     excp_entry() handles faults such as unauthorized memory access
+ *     (proc_page_fault() maps the lazily loaded pages of user apps)
  *     proc_syscall() handles system calls for inter-process communication
  */
 
@@ -14,27 +16,50 @@
 #include "egos.h"
 #include "process.h"
 #include "syscall.h"
+#include "spinlock.h"
+#include "counter.h"
 #include <string.h>
 
 #define EXCP_ID_ECALL_U    8  // Defines an exception ID for user mode system calls.
 #define EXCP_ID_ECALL_M    11 // Defines an exception ID for machine mode system calls.
+#define EXCP_ID_FETCH_PF   12 // Instruction page fault, e.g. on a page of proc_map_lazy().
+#define EXCP_ID_LOAD_PF    13 // Load page fault.
+#define EXCP_ID_STORE_PF   15 // Store or AMO page fault.
 
-#define INTR_ID_SOFT       3  // Defines an interrupt ID for software interrupts.
 #define INTR_ID_TIMER      7  // Defines an interrupt ID for timer interrupts.
+#define INTR_ID_EXTERNAL   11 // Defines an interrupt ID for a line typed on the tty, see earth/cpu_intr.c.
 
 static void proc_yield();           // Forward declaration of a function to yield the processor.
+static void proc_handoff(int pid);  // Forward declaration of a function to switch to a given process.
+static void proc_timer();           // Forward declaration of the timer interrupt handler.
 static void proc_syscall();         // Forward declaration of a function to handle system calls.
-static void (*kernel_entry)();      // Declaration of a function pointer for kernel entry.
+static void proc_timer_arm();       // Forward declaration of a function to program the next timer interrupt.
+static void proc_page_fault();      // Forward declaration of the page fault handler.
 
-int proc_curr_idx;                  // Variable to store the current process index.
-struct process proc_set[MAX_NPROCESS]; // Array to hold process control blocks.
+struct hart harts[NHARTS];          // The current process and time slice of each hart.
+#define this_hart (&harts[HART_ID()])
 
-void excp_entry(int id) {
+/* proc_deliver() copies messages through these, as a struct sys_msg
+ * does not fit on the kernel stack of a hart */
+static struct sys_msg deliver_msg[NHARTS];
+struct process* proc_set;           // Array of proc_nslots process control blocks, see proc_init().
+int proc_nslots;
+
+/* One hart at a time runs the kernel: the lock is taken when a trap enters
+ * grass and released when the hart returns to a process or waits in wfi. */
+static struct spinlock kernel_lock;
+
+static unsigned long long idle_time;   // Time with no runnable process.
+static const int slice_quanta[NPRIO] = {1, 1, 2, 4}; // Longer slices for lower priority levels.
+
+static void excp_handle(int id) {
     /* Exception handling entry point function. */
 
-    if (id == EXCP_ID_ECALL_U) {
-        // Handle user mode system call exception.
-        proc_syscall(); // Calls a function to process the system call.
+    if (id == EXCP_ID_ECALL_U || (id == EXCP_ID_ECALL_M && curr_pid < GPID_USER_START)) {
+        // Handle system calls of user apps (U-mode) and kernel processes (M-mode)
+        // on the kernel stack, like interrupts.
+        this_hart->kernel_entry = proc_syscall;
+        ctx_start(&proc_set[proc_curr_idx].sp, (void*)KERNEL_STACK_TOP(HART_ID()));
         return;
     } else if (id == EXCP_ID_ECALL_M && curr_pid >= GPID_USER_START) {
         // Handle machine mode system call exception for user processes.
@@ -42,6 +67,13 @@ void excp_entry(int id) {
         INFO("process %d killed due to exception", curr_pid);
         asm("csrw mepc, %0" ::"r"(0x800500C)); // Sets the Machine Exception Program Counter (mepc) to a specific address.
         return;
+    } else if ((id == EXCP_ID_FETCH_PF || id == EXCP_ID_LOAD_PF || id == EXCP_ID_STORE_PF) &&
+               curr_pid >= GPID_USER_START) {
+        // Map the page on the kernel stack, where allocating a frame may
+        // write back another one, then retry the faulting instruction.
+        this_hart->kernel_entry = proc_page_fault;
+        ctx_start(&proc_set[proc_curr_idx].sp, (void*)KERNEL_STACK_TOP(HART_ID()));
+        return;
     }
     // If the exception is not handled, logs a fatal error.
     FATAL("excp_entry: kernel got exception %d", id);
@@ -50,35 +82,66 @@ void excp_entry(int id) {
 
 
 
-void intr_entry(int id) {
+static void intr_handle(int id) {
     /* Interrupt handling entry point function. */
 
+    // Processes in sys_tty_read() can take the line; a Ctrl+C typed for
+    // one of them, e.g. at the shell prompt, only discards its line.
+    int reading = (id == INTR_ID_EXTERNAL) && proc_tty_wakeup();
+
+    if (this_hart->in_idle) {
+        // Woken up in the kernel by proc_idle(), which runs on the kernel stack and
+        // looks for runnable processes itself; only silence the timer until it re-arms.
+        if (id == INTR_ID_TIMER) earth->timer_set(TIMER_NEVER);
+        earth->tty_recv_intr(); // No user process runs, so Ctrl+C kills nothing.
+        return;
+    }
+
+    if (id == INTR_ID_TIMER) {
+        // Record where the interrupted process was for the profiler, see grass/prof.c.
+        int mepc;
+        asm("csrr %0, mepc" : "=r"(mepc));
+        prof_record(curr_pid, mepc);
+    }
+
     if (id == INTR_ID_TIMER && curr_pid < GPID_SHELL) {
         // If the interrupt is a timer interrupt and the current process is a kernel process,
-        // reset the timer and return without handling.
-        earth->timer_reset();
+        // wake up sleeping processes, re-arm the timer and return without preemption.
+        proc_timer_arm();
         return;
     }
 
-    if (earth->tty_recv_intr() && curr_pid >= GPID_USER_START) {
-        // If a terminal interrupt is received and the current process is a user process,
-        // log the information and set mepc.
+    if (earth->tty_recv_intr() && !reading && curr_pid >= GPID_USER_START) {
+        // If Ctrl+C is typed while nobody reads the tty and the current process is a
+        // user process, log the information and set mepc.
         INFO("process %d killed by interrupt", curr_pid);
         asm("csrw mepc, %0" ::"r"(0x800500C));
         return;
     }
 
+    if (id == INTR_ID_EXTERNAL && curr_pid < GPID_SHELL) {
+        // Kernel processes are not preempted; a woken reader runs after them.
+        proc_timer_arm();
+        return;
+    }
+
+    if (id == INTR_ID_TIMER && earth->timer_get() < this_hart->slice_end) {
+        // The interrupt is for a sleeping process and the time slice is not over yet.
+        proc_timer_arm();
+        return;
+    }
+
     // Depending on the interrupt ID, set the appropriate kernel entry function.
-    if (id == INTR_ID_SOFT)
-        kernel_entry = proc_syscall; // For software interrupts, handle system calls.
-    else if (id == INTR_ID_TIMER)
-        kernel_entry = proc_yield;   // For timer interrupts, yield the processor.
+    if (id == INTR_ID_TIMER)
+        this_hart->kernel_entry = proc_timer;   // For timer interrupts, yield the processor.
+    else if (id == INTR_ID_EXTERNAL)
+        this_hart->kernel_entry = proc_yield;   // Let the woken reader, usually the shell, run right away.
     else
         // If the interrupt ID is unknown, log a fatal error.
         FATAL("intr_entry: got unknown interrupt %d", id);
 
     // Switch to the kernel stack for further processing.
-    ctx_start(&proc_set[proc_curr_idx].sp, (void*)GRASS_STACK_TOP);
+    ctx_start(&proc_set[proc_curr_idx].sp, (void*)KERNEL_STACK_TOP(HART_ID()));
 }
 
 void ctx_entry() {
@@ -89,7 +152,7 @@ void ctx_entry() {
     proc_set[proc_curr_idx].mepc = (void*) mepc; // Store the mepc value in the current process's structure.
 
     /* Call the appropriate kernel function, which is either proc_yield() or proc_syscall(). */
-    kernel_entry();
+    this_hart->kernel_entry();
 
     /* Switching back to the user application stack. */
     mepc = (int)proc_set[proc_curr_idx].mepc; // Retrieve the mepc value from the current process's structure.
@@ -97,25 +160,57 @@ void ctx_entry() {
     ctx_switch((void**)&tmp, proc_set[proc_curr_idx].sp); // Perform context switch to the user stack.
 }
 
+/* A hart returns from these two when it resumes a process, which may not
+ * be the one it trapped from, so the kernel lock is released there. */
+void excp_entry(int id) {
+    spin_lock(&kernel_lock);
+    excp_handle(id);
+    spin_unlock(&kernel_lock);
+}
 
-static void proc_yield() {
-    /* Find the next runnable process. */
-    int next_idx = -1;
-    for (int i = 1; i <= MAX_NPROCESS; i++) {
-        int s = proc_set[(proc_curr_idx + i) % MAX_NPROCESS].status;
-        if (s == PROC_READY || s == PROC_RUNNING || s == PROC_RUNNABLE) {
-            next_idx = (proc_curr_idx + i) % MAX_NPROCESS;
-            break;
-        }
-    }
+void intr_entry(int id) {
+    spin_lock(&kernel_lock);
+    intr_handle(id);
+    spin_unlock(&kernel_lock);
+}
 
-    if (next_idx == -1) FATAL("proc_yield: no runnable process"); // Fatal error if no runnable process is found.
-    if (curr_status == PROC_RUNNING) proc_set_runnable(curr_pid); // Set the current process status to runnable if it's running.
 
-    /* Switch to the next runnable process and reset the timer. */
+#define PRIO_BOOST_TICKS 100         // Timer ticks between two priority boosts.
+
+static void proc_timer_arm() {
+    /* Program the next timer interrupt: the end of the current time slice if
+     * another process waits to run, or the earliest wakeup of a sleeping
+     * process; with neither, the timer stays off and no tick is taken. */
+    unsigned long long now = earth->timer_get();
+    unsigned long long deadline = proc_wakeup(now);
+    if (curr_pid >= GPID_SHELL && curr_status == PROC_RUNNING &&
+        proc_ready() && this_hart->slice_end < deadline)
+        deadline = this_hart->slice_end;
+    if (prof_enabled() && now + earth->timer_quantum < deadline)
+        deadline = now + earth->timer_quantum; // The profiler samples every quantum.
+    earth->timer_set(deadline);
+}
+
+static unsigned long long slice_length(int idx) {
+    return (unsigned long long)earth->timer_quantum * slice_quanta[proc_set[idx].priority];
+}
+
+static void proc_timer() {
+    /* The current process used its full quantum; move it one level down
+     * and periodically move everyone back up so that no process starves. */
+    static int ticks;
+    proc_set[proc_curr_idx].info.ninvoluntary++;
+    proc_demote(proc_curr_idx);
+    if (++ticks % PRIO_BOOST_TICKS == 0) proc_boost();
+    proc_yield();
+}
+
+static void proc_dispatch(int next_idx) {
+    /* Switch to the process at next_idx, which is not in a ready queue. */
+    trace_record(TRACE_SWITCH, proc_set[next_idx].pid, curr_pid);
     proc_curr_idx = next_idx;
     earth->mmu_switch(curr_pid); // Switch the Memory Management Unit (MMU) context to the current process.
-    earth->timer_reset(); // Reset the system timer.
+    this_hart->run_start = earth->timer_get();
 
     /* Modify mstatus.MPP to enter machine or user mode during mret. */
     int mstatus;
@@ -128,8 +223,12 @@ static void proc_yield() {
     asm("csrw mstatus, %0" :: "r"(mstatus)); // Write the updated mstatus value back to the register.
 
     /* Prepare for entering application code if the process is ready. */
-    if (curr_status == PROC_READY) {
-        proc_set_running(curr_pid); // Update the process status to running.
+    int ready = (curr_status == PROC_READY);
+    proc_set_running(curr_pid); // Update the process status to running.
+    proc_timer_arm();
+    if (ready) {
+        spin_unlock(&kernel_lock); // This process starts without returning through intr_entry().
+
         /* Setup arguments for the application (argc and argv). */
         asm("mv a0, %0" ::"r"(APPS_ARG));
         asm("mv a1, %0" ::"r"(APPS_ARG + 4));
@@ -137,119 +236,217 @@ static void proc_yield() {
         asm("csrw mepc, %0" ::"r"(APPS_ENTRY));
         asm("mret");
     }
+}
 
-    proc_set_running(curr_pid); // Update the process status to running.
+static void proc_idle() {
+    /* Nothing is runnable: do background work first, then sleep until an
+     * interrupt is pending.  Interrupts are masked in the kernel except
+     * around wfi, so that the tty interrupt can buffer input and output. */
+    if (earth->mmu_flush(1) > 0) return; // Write back one dirty frame, then look again.
+
+    proc_timer_arm(); // Wake up for the next sleeping process, if any.
+    this_hart->in_idle = 1;
+    spin_unlock(&kernel_lock); // Other harts, and interrupts of this one, may enter the kernel.
+    asm("csrs mstatus, 0x8");
+    asm("wfi");
+    asm("csrc mstatus, 0x8");
+    spin_lock(&kernel_lock);
+    this_hart->in_idle = 0;
+    proc_wakeup(earth->timer_get());
 }
 
+static void proc_charge(int voluntary) {
+    /* Charge the current process for the time since it was dispatched. */
+    struct proc_info* info = &proc_set[proc_curr_idx].info;
+    info->runtime += earth->timer_get() - this_hart->run_start;
+    if (voluntary) info->nvoluntary++;
+}
 
-static void proc_send(struct syscall *sc) {
-    /* Implementing a message sending syscall. */
-    sc->msg.sender = curr_pid; // Set the sender of the message.
-    int receiver = sc->msg.receiver;
+unsigned int proc_idle_time() { return idle_time; }
 
-    for (int i = 0; i < MAX_NPROCESS; i++) {
-        if (proc_set[i].pid == receiver) {
-            /* Find the process that should receive the message. */
-            if (proc_set[i].status != PROC_WAIT_TO_RECV) {
-                curr_status = PROC_WAIT_TO_SEND; // If receiver is not waiting to receive, set current process to waiting to send.
-                proc_set[proc_curr_idx].receiver_pid = receiver; // Record the receiver PID in the current process structure.
-            } else {
-                /* If receiver is ready to receive, perform message passing. */
-                struct sys_msg tmp;
-                earth->mmu_switch(curr_pid); // Switch MMU context to the current process.
-                memcpy(&tmp, &sc->msg, sizeof(tmp)); // Copy the message from the sender.
-
-                earth->mmu_switch(receiver); // Switch MMU context to the receiver.
-                memcpy(&sc->msg, &tmp, sizeof(tmp)); // Copy the message to the receiver.
-
-                proc_set_runnable(receiver); // Set the receiver process status to runnable.
-            }
-            proc_yield(); // Yield processor to handle scheduling.
-            return;
-        }
+static void proc_yield() {
+    /* Put the current process back in its ready queue if it is still running,
+     * then pick the first process of the highest non-empty priority level. */
+    proc_charge(curr_status != PROC_RUNNING); // A running process is being preempted, see proc_timer().
+    if (curr_status == PROC_RUNNING) proc_set_runnable(curr_pid); // Set the current process status to runnable if it's running.
+
+    int next_idx = proc_next();
+    if (next_idx == -1) {
+        unsigned long long start = earth->timer_get();
+        while ((next_idx = proc_next()) == -1) proc_idle(); // Idle until a process is runnable.
+        idle_time += earth->timer_get() - start;
     }
 
-    sc->retval = -1; // Set return value to -1 if receiver not found.
+    /* Switch to the next runnable process with a fresh time slice. */
+    this_hart->slice_end = earth->timer_get() + slice_length(next_idx);
+    proc_dispatch(next_idx);
 }
 
+static void proc_handoff(int pid) {
+    /* After a rendezvous, run the partner right away instead of going through
+     * the ready queues; it gets the rest of the current time slice. */
+    int next_idx = proc_idx(pid);
+    proc_charge(1);
+    if (curr_status == PROC_RUNNING) proc_set_runnable(curr_pid); // Set the current process status to runnable if it's running.
+    proc_set_running(pid); // Take the partner out of its ready queue.
 
+    unsigned long long now = earth->timer_get();
+    if (now >= this_hart->slice_end) this_hart->slice_end = now + slice_length(next_idx); // Nothing left to donate.
+    proc_dispatch(next_idx);
+}
 
-static void proc_recv(struct syscall *sc) {
-    /* This function handles the receiving part of inter-process communication. */
 
-    // Check if the syscall structure pointer is NULL, indicating an invalid argument.
-    if (sc == NULL) {
-        FATAL("proc_recv: Invalid syscall structure"); // Log a fatal error if the syscall structure is invalid.
-        return; // Exit the function early as it can't proceed without a valid syscall structure.
-    }
+static void proc_page_fault() {
+    /* A user app touched a page it has no frame for; unless the page is
+     * lazy, the app is killed as for other exceptions. */
+    unsigned int addr;
+    asm("csrr %0, mtval" : "=r"(addr)); // The faulting address.
+    if (proc_fault(proc_curr_idx, addr >> 12) == 0) return; // mepc still points at the faulting instruction.
 
-    int sender = -1; // Initialize the sender variable to -1, indicating no sender has been found yet.
-    for (int i = 0; i < MAX_NPROCESS; i++) {
-        /* Loop through all processes to find a potential sender. */
-        if (proc_set[i].status == PROC_WAIT_TO_SEND &&
-            proc_set[i].receiver_pid == curr_pid) {
-            // If a process is waiting to send a message to the current process, it's identified as the sender.
-            sender = proc_set[i].pid; // Store the sender's process ID.
-            break; // Break the loop as the sender has been found.
-        }
+    INFO("process %d killed due to page fault at 0x%.8x", curr_pid, addr);
+    proc_set[proc_curr_idx].mepc = (void*)0x800500C;
+}
+
+static int proc_grant(int src_pid, int src_page, int src_npages,
+                      int dst_pid, int dst_page, int dst_npages) {
+    /* Move up to min(src_npages, dst_npages) frames of the app region
+     * from src_pid to dst_pid; return the number of frames moved. */
+    int n = 0, first = APPS_ENTRY >> 12, end = (APPS_ENTRY + APPS_SIZE) >> 12;
+    int src_idx = proc_idx(src_pid), dst_idx = proc_idx(dst_pid);
+    for (; n < src_npages && n < dst_npages; n++) {
+        if (src_page + n < first || src_page + n >= end) break;
+        if (dst_page + n < first || dst_page + n >= end) break;
+        proc_fault(src_idx, src_page + n); // A lazy page has no frame to move yet.
+        proc_fault(dst_idx, dst_page + n);
+        if (earth->mmu_grant(src_pid, src_page + n, dst_pid, dst_page + n) < 0) break;
     }
+    return n;
+}
 
-    if (sender == -1) {
-        // If no sender is found, set the current process's status to waiting to receive.
-        curr_status = PROC_WAIT_TO_RECV;
-    } else {
-        /* If a sender is found, perform the message receiving operations. */
-        struct sys_msg tmp; // Temporary structure to hold the message.
-        earth->mmu_switch(sender); // Switch the MMU context to the sender process.
-        // Additional error checking after mmu_switch could be added here.
-
-        // Check if the message pointer in the syscall structure is valid.
-        if (&sc->msg == NULL) {
-            FATAL("proc_recv: Message structure is invalid"); // Log a fatal error if the message structure is invalid.
-            return; // Exit the function as it can't proceed with an invalid message structure.
-        }
-        memcpy(&tmp, &sc->msg, sizeof(tmp)); // Copy the message from the syscall structure to the temporary structure.
+static void proc_deliver(int src_idx, int dst_idx);
 
-        /* Switch the MMU context back to the current (receiver) process and copy the message. */
-        earth->mmu_switch(curr_pid); // Switch the MMU context to the current process.
-        // Additional error checking after mmu_switch could be added here as well.
-        memcpy(&sc->msg, &tmp, sizeof(tmp)); // Copy the message from the temporary structure to the syscall structure.
+static void proc_wait_recv(int idx) {
+    /* The process at idx wants a message: take the first matching sender
+     * from its queue, or wait for one. */
+    int sender_idx = proc_sender_dequeue(idx, proc_set[idx].recv_from);
+    if (sender_idx == -1)
+        proc_block(idx, PROC_WAIT_TO_RECV); // Wait for a sender; not in a ready queue.
+    else
+        proc_deliver(sender_idx, idx);
+}
 
-        /* Mark the sender process as runnable so it can continue execution. */
+static void proc_deliver(int src_idx, int dst_idx) {
+    /* Copy the message of the process at src_idx to the process at dst_idx,
+     * which is waiting to receive it; only the header and the bytes the
+     * sender wrote are copied.  The MMU is left in the receiver's context. */
+    struct syscall *sc = (struct syscall*)SYSCALL_ARG;
+    int sender = proc_set[src_idx].pid, receiver = proc_set[dst_idx].pid;
+
+    struct sys_msg *tmp = &deliver_msg[HART_ID()]; // Buffer to hold the message.
+    earth->mmu_switch(sender); // Switch MMU context to the sender.
+    memcpy(tmp, &sc->msg, SYS_MSG_COPY_LEN(&sc->msg)); // Copy the message from the sender.
+    int grant_page = (int)sc->pages >> 12, grant_npages = sc->npages; // Pages offered by the sender.
+
+    earth->mmu_switch(receiver); // Switch MMU context to the receiver.
+    memcpy(&sc->msg, tmp, SYS_MSG_COPY_LEN(tmp)); // Copy the message to the receiver.
+    sc->retval = 0; // The receiver may have waited with a deadline.
+    proc_set[dst_idx].wakeup = 0;
+    sc->npages = proc_grant(sender, grant_page, grant_npages,
+                            receiver, (int)sc->pages >> 12, sc->npages);
+    proc_set[src_idx].info.nsent++;
+    proc_set[dst_idx].info.nrecv++;
+    COUNT("ipc.msg", 1);
+    COUNT("ipc.bytes", SYS_MSG_COPY_LEN(tmp));
+    trace_record(TRACE_RECV, receiver, sender);
+
+    /* The current process keeps running; other processes become runnable
+     * unless the sender made a SYS_CALL or SYS_REPLY_RECV and now waits. */
+    if (dst_idx != proc_curr_idx) proc_set_runnable(receiver);
+    if (proc_set[src_idx].recv_after) {
+        proc_set[src_idx].recv_after = 0;
+        proc_wait_recv(src_idx);
+    } else if (src_idx != proc_curr_idx) {
         proc_set_runnable(sender);
     }
+}
 
-    proc_yield(); // Yield the CPU to allow other processes to run.
+static void proc_resume(int partner_idx) {
+    /* After a rendezvous, run the partner if it became runnable; otherwise
+     * keep running the current process or yield if it now waits. */
+    if (proc_set[partner_idx].status == PROC_RUNNABLE)
+        proc_handoff(proc_set[partner_idx].pid); // Let the partner run right away.
+    else if (curr_status == PROC_RUNNING)
+        earth->mmu_switch(curr_pid); // Continue the current process.
+    else
+        proc_yield();
 }
 
+static void proc_send(struct syscall *sc, int recv_after, int recv_from) {
+    /* Implementing a message sending syscall; for SYS_CALL and SYS_REPLY_RECV
+     * the sender then receives a message, from recv_from or from anyone if 0. */
+    sc->msg.sender = curr_pid; // Set the sender of the message.
+    int receiver = sc->msg.receiver;
+    if (sc->msg.size < 0 || sc->msg.size > SYSCALL_MSG_LEN) {
+        sc->retval = -1; // Set return value to -1 if the size is invalid.
+        return;
+    }
+
+    /* Find the process that should receive the message. */
+    int receiver_idx = proc_idx(receiver);
+    if (receiver_idx == -1) {
+        sc->retval = -1; // Set return value to -1 if receiver not found.
+        return;
+    }
+
+    proc_set[proc_curr_idx].recv_after = recv_after;
+    proc_set[proc_curr_idx].recv_from = recv_from;
+    trace_record(TRACE_SEND, curr_pid, receiver);
 
+    struct process *r = &proc_set[receiver_idx];
+    if (r->status != PROC_WAIT_TO_RECV || (r->recv_from != 0 && r->recv_from != curr_pid)) {
+        proc_block(proc_curr_idx, PROC_WAIT_TO_SEND); // If receiver is not waiting for this sender, set current process to waiting to send.
+        proc_set[proc_curr_idx].receiver_pid = receiver; // Record the receiver PID in the current process structure.
+        proc_sender_enqueue(receiver_idx, proc_curr_idx); // Wait behind earlier senders to the same receiver.
+        proc_yield(); // Yield processor to handle scheduling.
+        return;
+    }
 
+    /* If receiver is ready to receive, perform message passing. */
+    proc_deliver(proc_curr_idx, receiver_idx);
+    proc_resume(receiver_idx); // Let the receiver handle the message right away.
+}
 
-// static void proc_recv(struct syscall *sc) {
-//     int sender = -1;
-//     for (int i = 0; i < MAX_NPROCESS; i++)
-//         if (proc_set[i].status == PROC_WAIT_TO_SEND &&
-//             proc_set[i].receiver_pid == curr_pid)
-//             sender = proc_set[i].pid;
 
-//     if (sender == -1) {
-//         curr_status = PROC_WAIT_TO_RECV;
-//     } else {
-//         /* Copy message from sender to kernel stack */
-//         struct sys_msg tmp;
-//         earth->mmu_switch(sender);
-//         memcpy(&tmp, &sc->msg, sizeof(tmp));
+static void proc_recv(struct syscall *sc, int poll, unsigned int ticks) {
+    /* This function handles the receiving part of inter-process communication;
+     * with poll, it fails instead of waiting when no sender is waiting, and
+     * with ticks, it fails once they pass without a sender. */
+    proc_set[proc_curr_idx].recv_after = 0;
+    proc_set[proc_curr_idx].recv_from = 0;
 
-//         /* Copy message from kernel stack to receiver */
-//         earth->mmu_switch(curr_pid);
-//         memcpy(&sc->msg, &tmp, sizeof(tmp));
+    /* The first process waiting to send to the current process, if any. */
+    int sender_idx = proc_sender_dequeue(proc_curr_idx, 0);
 
-//         /* Set sender process as runnable */
-//         proc_set_runnable(sender);
-//     }
+    if (sender_idx == -1 && poll) {
+        sc->retval = -1; // The current process keeps running.
+        return;
+    }
+    if (sender_idx == -1) {
+        // If no sender is found, set the current process's status to waiting to receive.
+        proc_block(proc_curr_idx, PROC_WAIT_TO_RECV);
+        if (ticks) {
+            sc->retval = -1; // Unless proc_deliver() comes first.
+            proc_recv_deadline(proc_curr_idx, earth->timer_get() + ticks);
+        }
+        proc_yield(); // Yield the CPU to allow other processes to run.
+        return;
+    }
 
-//     proc_yield();
-// }
+    /* If a sender is found, receive its message and switch to it, so that
+     * a sender waiting for this reply continues without a detour. */
+    proc_deliver(sender_idx, proc_curr_idx);
+    proc_resume(sender_idx);
+}
 
 
 static void proc_syscall() {
@@ -270,24 +467,57 @@ static void proc_syscall() {
     }
 
     int type = sc->type; // Retrieve the type of the syscall from the syscall structure.
+    int caller = curr_pid;
+    trace_record(TRACE_SYSCALL, caller, type);
+    proc_restore(proc_curr_idx); // A process making system calls is interactive, see proc_demote().
+    proc_set[proc_curr_idx].mepc = (char*)proc_set[proc_curr_idx].mepc + 4; // Return to the instruction after ecall.
 
     // Initialize the return value of the syscall to 0 and reset the syscall type to SYS_UNUSED.
     sc->retval = 0;
     sc->type = SYS_UNUSED;
-    *((int*)0x2000000) = 0; // Reset a memory-mapped flag (possibly indicating syscall completion) to 0.
 
     // Switch statement to handle different types of syscalls.
     switch (type) {
     case SYS_RECV:
-        proc_recv(sc); // Handle a receive syscall.
+        proc_recv(sc, 0, 0); // Handle a receive syscall.
+        break;
+    case SYS_TRY_RECV:
+        proc_recv(sc, 1, 0); // Receive only if a sender is already waiting.
+        break;
+    case SYS_RECV_TIMED:
+        proc_recv(sc, 0, sc->ticks); // Receive, or give up at a one-shot deadline.
         break;
     case SYS_SEND:
-        proc_send(sc); // Handle a send syscall.
+        proc_send(sc, 0, 0); // Handle a send syscall.
+        break;
+    case SYS_CALL:
+        proc_send(sc, 1, sc->msg.receiver); // Send, then wait for the reply of the receiver.
+        break;
+    case SYS_REPLY_RECV:
+        proc_send(sc, 1, 0); // Reply to a client, then wait for the next request.
+        break;
+    case SYS_NULL:
+        break; // Nothing changed, so the timer needs no update.
+    case SYS_TTY_WAIT:
+        if (earth->tty_ready()) break; // A line arrived since tty_read() returned -1.
+        proc_tty_wait(proc_curr_idx);
+        proc_yield();
+        break;
+    case SYS_PIPE_READ:
+    case SYS_PIPE_WRITE:
+        sc->retval = pipe_rw(proc_curr_idx, type == SYS_PIPE_WRITE, &sc->msg);
+        if (sc->retval == PIPE_AGAIN) proc_yield(); // Retried once the other end moved bytes or exited.
+        break;
+    case SYS_SLEEP:
+        proc_sleep(proc_curr_idx, earth->timer_get() + sc->ticks); // Sleep with a one-shot deadline.
+        proc_yield();
         break;
     default:
         // Log a fatal error if an unknown syscall type is encountered.
         FATAL("proc_syscall: got unknown syscall type=%d", type);
     }
+    if (type != SYS_NULL) proc_timer_arm(); // A process may have become runnable or asleep.
+    trace_record(TRACE_SYSRET, caller, type); // The kernel may return to another process, see TRACE_SWITCH.
 }
 
 
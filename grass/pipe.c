@@ -0,0 +1,90 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: byte streams between the processes of a shell pipeline
+ * A pipe is a bounded buffer in the kernel with one writer and one reader,
+ * connected by sys_proc when it spawns "cmd1 | cmd2".  A writer finding the
+ * buffer full or a reader finding it empty waits in PROC_WAIT_PIPE and then
+ * retries the system call, as SYS_TTY_WAIT does for the tty; an end whose
+ * process exits is closed, so the reader then sees the end of the stream
+ * and the writer's later writes return 0.
+ */
+
+#include "egos.h"
+#include "process.h"
+#include "syscall.h"
+#include <string.h>
+
+#define NPIPES     2                    /* so at most 3 commands per pipeline */
+#define PIPE_SIZE  BLOCK_SIZE           /* power of 2 */
+
+static struct pipe {
+    int writer, reader;                 /* pid of each end, 0 once closed */
+    unsigned int head, tail;            /* bytes written and read so far */
+    char buf[PIPE_SIZE];
+} pipes[NPIPES];
+
+// Connect the output of writer to the input of reader; return -1 if all
+// pipes are in use or either process is in a pipe in that direction already
+int pipe_open(int writer, int reader) {
+    struct pipe* free = NULL;
+    for (struct pipe* p = pipes; p < pipes + NPIPES; p++) {
+        if (p->writer == writer || p->reader == reader) return -1;
+        if (!free && p->writer == 0 && p->reader == 0) free = p;
+    }
+    if (!free) return -1;
+
+    free->writer = writer;
+    free->reader = reader;
+    free->head = free->tail = 0;
+    return 0;
+}
+
+static void pipe_wake(int pid) {
+    int idx = proc_idx(pid);
+    if (idx != -1 && proc_set[idx].status == PROC_WAIT_PIPE) proc_set_runnable(pid);
+}
+
+// Close the ends held by pid, which exits, and wake up the other ends
+void pipe_close(int pid) {
+    for (struct pipe* p = pipes; p < pipes + NPIPES; p++) {
+        if (p->writer == pid) {
+            p->writer = 0;
+            pipe_wake(p->reader);
+        }
+        if (p->reader == pid) {
+            p->reader = 0;
+            pipe_wake(p->writer);
+        }
+    }
+}
+
+// SYS_PIPE_READ and SYS_PIPE_WRITE of the process at idx, which is the
+// current one, so msg is in its address space; return the bytes moved
+// (0 at the end of the stream or once the reader is gone), -1 without a
+// pipe, or PIPE_AGAIN if the process now waits
+int pipe_rw(int idx, int write, struct sys_msg* msg) {
+    int pid = proc_set[idx].pid;
+    if (msg->size <= 0 || msg->size > SYSCALL_MSG_LEN) return -1;
+    struct pipe* p = pipes;
+    while (p < pipes + NPIPES && (write? p->writer : p->reader) != pid) p++;
+    if (p == pipes + NPIPES) return -1;
+
+    unsigned int n = write? PIPE_SIZE - (p->head - p->tail) : p->head - p->tail;
+    int other = write? p->reader : p->writer;
+    if (write && other == 0) return 0;
+    if (n == 0 && other == 0) return 0;
+    if (n == 0) {
+        proc_pipe_wait(idx);
+        return PIPE_AGAIN;
+    }
+
+    if (n > msg->size) n = msg->size;
+    for (unsigned int i = 0; i < n; i++)
+        if (write) p->buf[p->head++ % PIPE_SIZE] = msg->content[i];
+        else msg->content[i] = p->buf[p->tail++ % PIPE_SIZE];
+    pipe_wake(other);
+    return n;
+}
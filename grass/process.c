@@ -5,25 +5,116 @@
 
 /* Author: Yunhao Zhang
  * Description: helper functions for managing processes
+ * Runnable processes wait in one FIFO ready queue per priority level;
+ * a bitmap of non-empty levels makes picking the next process O(1) and
+ * a hash table makes finding a process by pid O(1).  Each hart has its
+ * own ready queues, and a hart whose queues are empty steals from the
+ * queues of another hart.
+ * Processes blocked in PROC_WAIT_TO_SEND wait in a FIFO queue owned by
+ * their receiver, so the receiver serves its senders in arrival order.
+ * The process table fills the heap of grass and unused slots are kept
+ * on a free list, so pids keep growing while slots are recycled.
+ * The app pages of user processes are mapped lazily with page tables:
+ * the first touch faults and proc_fault() allocates the frame then.
  */
 
 #include "egos.h"
 #include "process.h"
 #include "syscall.h"
 #include <string.h>
-#include <stdatomic.h> // Include for atomic operations
 
-// Function to atomically set the status of a process with a given process ID (pid)
-// static void proc_set_status(int pid, int status) {
-//     for (int i = 0; i < MAX_NPROCESS; i++) // Loop through all processes
-//         if (atomic_load(&proc_set[i].pid) == pid) // Atomically load the pid and check
-//             atomic_store(&proc_set[i].status, status); // Atomically set the status if the pid matches
-// }
+static int ready_head[NHARTS][NPRIO], ready_tail[NHARTS][NPRIO]; // FIFO of proc_set indices per level
+static unsigned int ready_bitmap[NHARTS];         // Bit i is set if level i is non-empty
 
-// Function to set the status of a process with a given process ID (pid)
+#define PID_HASH_SIZE 32
+static int pid_hash[PID_HASH_SIZE];               // Chains of proc_set indices by pid
+static int free_head;                             // Unused slots, linked through next
+
+char *_sbrk(int size);
+extern char __heap_start, __heap_end;
+
+void proc_init() {
+    /* Grass makes no other heap allocation, so the table takes all of it */
+    proc_nslots = (&__heap_end - &__heap_start) / sizeof(struct process);
+    if (proc_nslots < MIN_NPROCESS)
+        FATAL("proc_init: room for %d processes only, need %d", proc_nslots, MIN_NPROCESS);
+    proc_set = (void*)_sbrk(proc_nslots * sizeof(struct process));
+    memset(proc_set, 0, proc_nslots * sizeof(struct process));
+    for (int i = 0; i < proc_nslots; i++) proc_set[i].next = (i == proc_nslots - 1)? -1 : i + 1;
+    free_head = 0;
+
+    memset(ready_head, 0xFF, sizeof(ready_head));
+    memset(ready_tail, 0xFF, sizeof(ready_tail));
+    memset(pid_hash, 0xFF, sizeof(pid_hash));
+    memset(ready_bitmap, 0, sizeof(ready_bitmap));
+}
+
+// Find the index in proc_set of the process with a given pid, or -1
+int proc_idx(int pid) {
+    if (pid <= 0) return -1;
+    for (int i = pid_hash[pid % PID_HASH_SIZE]; i != -1; i = proc_set[i].hash_next)
+        if (proc_set[i].pid == pid && proc_set[i].status != PROC_UNUSED) return i;
+    return -1;
+}
+
+static void proc_enqueue(int idx) {
+    int prio = proc_set[idx].priority, h = proc_set[idx].hart;
+    proc_set[idx].queued = 1;
+    proc_set[idx].next = -1;
+    if (ready_tail[h][prio] == -1) ready_head[h][prio] = idx;
+    else proc_set[ready_tail[h][prio]].next = idx;
+    ready_tail[h][prio] = idx;
+    ready_bitmap[h] |= (1 << prio);
+}
+
+static void proc_dequeue(int idx) {
+    int prio = proc_set[idx].priority, h = proc_set[idx].hart, prev = -1;
+    for (int i = ready_head[h][prio]; i != idx; i = proc_set[i].next) prev = i;
+
+    if (prev == -1) ready_head[h][prio] = proc_set[idx].next;
+    else proc_set[prev].next = proc_set[idx].next;
+    if (ready_tail[h][prio] == idx) ready_tail[h][prio] = prev;
+    if (ready_head[h][prio] == -1) ready_bitmap[h] &= ~(1 << prio);
+    proc_set[idx].queued = 0;
+}
+
+// Remove and return the first process of the highest non-empty level of
+// this hart, or steal it from the next hart with a runnable process; -1 if none
+int proc_next() {
+    int self = HART_ID(), h = self;
+    for (int i = 1; i < NHARTS && ready_bitmap[h] == 0; i++) h = (self + i) % NHARTS;
+    if (ready_bitmap[h] == 0) return -1;
+
+    int idx = ready_head[h][__builtin_ctz(ready_bitmap[h])];
+    proc_dequeue(idx);
+    proc_set[idx].hart = self; // A stolen process stays on this hart from now on.
+    return idx;
+}
+
+static int is_blocked(int status) {
+    return status == PROC_WAIT_TO_SEND || status == PROC_WAIT_TO_RECV;
+}
+
+// Set the status of a process at index idx, keeping the ready queues
+// and the time spent blocked in IPC in sync
+static void proc_set_status_idx(int idx, int status) {
+    int old = proc_set[idx].status;
+    if (is_blocked(old) && !is_blocked(status))
+        proc_set[idx].info.blocked += earth->timer_get() - proc_set[idx].blocked_since;
+    if ((is_blocked(old) || old == PROC_SLEEPING || old == PROC_WAIT_TTY || old == PROC_WAIT_PIPE) &&
+        !is_blocked(status) && status != PROC_UNUSED)
+        trace_record(TRACE_WAKE, proc_set[idx].pid, old);
+
+    int runnable = (status == PROC_READY || status == PROC_RUNNABLE);
+    if (proc_set[idx].queued && !runnable) proc_dequeue(idx);
+    proc_set[idx].status = status;
+    if (!proc_set[idx].queued && runnable) proc_enqueue(idx);
+}
+
+// Set the status of a process with a given process ID (pid)
 static void proc_set_status(int pid, int status) {
-    for (int i = 0; i < MAX_NPROCESS; i++) // Loop through all processes
-        if (proc_set[i].pid == pid) proc_set[i].status = status; // If the process ID matches, set its status
+    int idx = proc_idx(pid);
+    if (idx != -1) proc_set_status_idx(idx, status);
 }
 
 // Set the status of a process to PROC_READY
@@ -35,66 +126,239 @@ void proc_set_running(int pid) { proc_set_status(pid, PROC_RUNNING); }
 // Set the status of a process to PROC_RUNNABLE
 void proc_set_runnable(int pid) { proc_set_status(pid, PROC_RUNNABLE); }
 
+// Let the process at idx wait to send or receive a message
+void proc_block(int idx, int status) {
+    if (!is_blocked(proc_set[idx].status)) proc_set[idx].blocked_since = earth->timer_get();
+    trace_record(TRACE_BLOCK, proc_set[idx].pid, status);
+    proc_set_status_idx(idx, status);
+}
 
-// Atomically allocate a new process
-// int proc_alloc() {
-//     static _Atomic int proc_nprocs = 0; // Atomic counter for the number of processes
-//     for (int i = 0; i < MAX_NPROCESS; i++) // Loop through all processes
-//         if (atomic_load(&proc_set[i].status) == PROC_UNUSED) { // Atomically check if the status is unused
-//             int new_pid = atomic_fetch_add(&proc_nprocs, 1); // Atomically increment and fetch the process count
-//             atomic_store(&proc_set[i].pid, new_pid); // Atomically set the new process ID
-//             atomic_store(&proc_set[i].status, PROC_LOADING); // Atomically set the process status to loading
-//             return new_pid; // Return the new process ID
-//         }
+int proc_get_info(int idx, struct proc_info* info) {
+    if (idx < 0 || idx >= proc_nslots || proc_set[idx].status == PROC_UNUSED) return -1;
+    memcpy(info, &proc_set[idx].info, sizeof(*info));
+    info->pid = proc_set[idx].pid;
+    info->status = proc_set[idx].status;
+    return 0;
+}
 
-//     FATAL("proc_alloc: reach the limit of %d processes", MAX_NPROCESS); // If no process slot is available, raise a fatal error
-// }
+// Is any process waiting in a ready queue?
+int proc_ready() {
+    for (int h = 0; h < NHARTS; h++)
+        if (ready_bitmap[h]) return 1;
+    return 0;
+}
 
-// Allocate a new process
-int proc_alloc() {
-    static int proc_nprocs = 0; // Static counter for the number of processes
-    for (int i = 0; i < MAX_NPROCESS; i++) // Loop through all processes
-        if (proc_set[i].status == PROC_UNUSED) { // Find an unused process slot
-            proc_set[i].pid = ++proc_nprocs; // Assign a new process ID
-            proc_set[i].status = PROC_LOADING; // Set the process status to loading
-            return proc_nprocs; // Return the new process ID
+static unsigned long long next_wakeup = TIMER_NEVER; // Earliest deadline of PROC_SLEEPING or a timed receive
+
+void proc_sleep(int idx, unsigned long long deadline) {
+    trace_record(TRACE_BLOCK, proc_set[idx].pid, PROC_SLEEPING);
+    proc_set_status_idx(idx, PROC_SLEEPING);
+    proc_set[idx].wakeup = deadline;
+    if (deadline < next_wakeup) next_wakeup = deadline;
+}
+
+// Let the process at idx, which waits to receive, give up at deadline;
+// a wakeup of 0 means the receive has no deadline
+void proc_recv_deadline(int idx, unsigned long long deadline) {
+    proc_set[idx].wakeup = deadline;
+    if (deadline < next_wakeup) next_wakeup = deadline;
+}
+
+// Make the processes whose deadline has passed runnable and
+// return the earliest deadline of the others
+unsigned long long proc_wakeup(unsigned long long now) {
+    if (now < next_wakeup) return next_wakeup;
+
+    next_wakeup = TIMER_NEVER;
+    for (int i = 0; i < proc_nslots; i++) {
+        int timed = proc_set[i].status == PROC_WAIT_TO_RECV && proc_set[i].wakeup;
+        if (proc_set[i].status != PROC_SLEEPING && !timed) continue;
+        if (proc_set[i].wakeup <= now) {
+            proc_set[i].wakeup = 0;
+            proc_set_status_idx(i, PROC_RUNNABLE);
+        } else if (proc_set[i].wakeup < next_wakeup)
+            next_wakeup = proc_set[i].wakeup;
+    }
+    return next_wakeup;
+}
+
+void proc_tty_wait(int idx) {
+    trace_record(TRACE_BLOCK, proc_set[idx].pid, PROC_WAIT_TTY);
+    proc_set_status_idx(idx, PROC_WAIT_TTY);
+}
+
+void proc_pipe_wait(int idx) {
+    trace_record(TRACE_BLOCK, proc_set[idx].pid, PROC_WAIT_PIPE);
+    proc_set_status_idx(idx, PROC_WAIT_PIPE);
+}
+
+// Make the processes waiting for a tty line runnable; return their number
+int proc_tty_wakeup() {
+    int n = 0;
+    for (int i = 0; i < proc_nslots; i++)
+        if (proc_set[i].status == PROC_WAIT_TTY) {
+            proc_set_status_idx(i, PROC_RUNNABLE);
+            n++;
         }
+    return n;
+}
+
+// Map page_no of pid to a copy of frame_no, or to a zeroed frame if
+// frame_no is -1, when pid first touches it; the software TLB copies
+// every page at mmu_switch() and cannot fault, so it gets the copy now;
+// return -1 if no frame is left for the page
+int proc_map_lazy(int pid, int page_no, int frame_no) {
+    int idx = proc_idx(pid), i = page_no - (APPS_ENTRY >> 12);
+    if (idx == -1 || i < 0 || i >= APPS_NPAGES)
+        FATAL("proc_map_lazy: invalid page 0x%x of pid %d", page_no, pid);
+
+    proc_set[idx].lazy[i] = (frame_no == -1)? LAZY_ZERO : frame_no;
+    if (earth->translation == SOFT_TLB) return proc_fault(idx, page_no);
+    return earth->mmu_unmap(pid, page_no);
+}
+
+// Give the process at idx its own frame at page_no if the page is still
+// lazy; return -1 if it is not, e.g. for a fault on an unmapped address,
+// or if no frame is left, and the page then stays lazy
+int proc_fault(int idx, int page_no) {
+    int i = page_no - (APPS_ENTRY >> 12);
+    if (i < 0 || i >= APPS_NPAGES || proc_set[idx].lazy[i] == LAZY_NONE) return -1;
+
+    void* base;
+    int frame_no;
+    if (earth->mmu_alloc(&frame_no, &base, proc_set[idx].lazy[i] == LAZY_ZERO) < 0) return -1;
+    if (proc_set[idx].lazy[i] != LAZY_ZERO) earth->mmu_copy(frame_no, proc_set[idx].lazy[i]);
+    if (earth->mmu_map(proc_set[idx].pid, page_no, frame_no) < 0) {
+        earth->mmu_free_frame(frame_no);
+        return -1;
+    }
+    proc_set[idx].lazy[i] = LAZY_NONE;
+    return 0;
+}
+
+// frame_no is about to be freed, so copy it now to every process which
+// has not touched its lazy page yet; without a frame for the copy, the
+// page is no longer lazy and the process is killed when it touches it
+void proc_map_drop(int frame_no) {
+    for (int idx = 0; idx < proc_nslots; idx++) {
+        if (proc_set[idx].status == PROC_UNUSED) continue;
+        for (int i = 0; i < APPS_NPAGES; i++)
+            if (proc_set[idx].lazy[i] == frame_no &&
+                proc_fault(idx, (APPS_ENTRY >> 12) + i) < 0)
+                proc_set[idx].lazy[i] = LAZY_NONE;
+    }
+}
+
+// MLFQ: a process using its full quantum moves one level down, and a
+// process making a system call goes back to its initial level
+void proc_demote(int idx) {
+    if (proc_set[idx].priority < PRIO_LOWEST && !proc_set[idx].queued)
+        proc_set[idx].priority++;
+}
+
+void proc_restore(int idx) {
+    if (!proc_set[idx].queued) proc_set[idx].priority = proc_set[idx].base_priority;
+}
 
-    FATAL("proc_alloc: reach the limit of %d processes", MAX_NPROCESS); // If no process slot is available, raise a fatal error
+// Move every process back to its initial level, so nothing starves
+void proc_boost() {
+    for (int i = 0; i < proc_nslots; i++) {
+        if (proc_set[i].status == PROC_UNUSED) continue;
+        int queued = proc_set[i].queued;
+        if (queued) proc_dequeue(i);
+        proc_set[i].priority = proc_set[i].base_priority;
+        if (queued) proc_enqueue(i);
+    }
 }
 
+// Append the process at idx to the senders waiting for receiver_idx
+void proc_sender_enqueue(int receiver_idx, int idx) {
+    struct process* r = &proc_set[receiver_idx];
+    proc_set[idx].send_next = -1;
+    if (r->send_tail == -1) r->send_head = idx;
+    else proc_set[r->send_tail].send_next = idx;
+    r->send_tail = idx;
+}
 
+static void proc_sender_unlink(int receiver_idx, int idx) {
+    struct process* r = &proc_set[receiver_idx];
+    int prev = -1;
+    for (int i = r->send_head; i != -1; prev = i, i = proc_set[i].send_next) {
+        if (i != idx) continue;
+        if (prev == -1) r->send_head = proc_set[i].send_next;
+        else proc_set[prev].send_next = proc_set[i].send_next;
+        if (r->send_tail == idx) r->send_tail = prev;
+        return;
+    }
+}
+
+// Remove and return the first sender waiting for receiver_idx whose pid
+// is from, or any sender if from is 0; return -1 if there is none
+int proc_sender_dequeue(int receiver_idx, int from) {
+    int idx = proc_set[receiver_idx].send_head;
+    while (idx != -1 && from != 0 && proc_set[idx].pid != from)
+        idx = proc_set[idx].send_next;
+    if (idx != -1) proc_sender_unlink(receiver_idx, idx);
+    return idx;
+}
 
-// Atomically free a process with a given process ID
-// void proc_free(int pid) {
-//     if (pid != -1) { // If a specific process ID is provided
-//         earth->mmu_free(pid); // Free the memory associated with the process
-//         proc_set_status(pid, PROC_UNUSED); // Atomically set the process status to unused
-//         return;
-//     }
+static void proc_sender_remove(int idx) {
+    int receiver_idx = proc_idx(proc_set[idx].receiver_pid);
+    if (receiver_idx != -1) proc_sender_unlink(receiver_idx, idx);
+}
 
-//     // If no specific process ID is provided, free all user applications
-//     for (int i = 0; i < MAX_NPROCESS; i++) // Loop through all processes
-//         if (atomic_load(&proc_set[i].pid) >= GPID_USER_START &&
-//             atomic_load(&proc_set[i].status) != PROC_UNUSED) { // Atomically check if the process is a user application and not unused
-//             earth->mmu_free(atomic_load(&proc_set[i].pid)); // Free the memory associated with the process
-//             atomic_store(&proc_set[i].status, PROC_UNUSED); // Atomically set the process status to unused
-//         }
-// }
+// Allocate a new process in the first unused slot
+int proc_alloc() {
+    static int proc_nprocs = 0; // Static counter for the number of processes
+    int i = free_head;
+    if (i == -1) FATAL("proc_alloc: reach the limit of %d processes", proc_nslots); // If no process slot is available, raise a fatal error
+    free_head = proc_set[i].next;
+
+    int pid = ++proc_nprocs; // Assign a new process ID
+    proc_set[i].pid = pid;
+    proc_set[i].status = PROC_LOADING; // Set the process status to loading
+    proc_set[i].queued = 0;
+    proc_set[i].hart = pid % NHARTS; // Spread new processes over the harts.
+    proc_set[i].recv_after = 0;
+    proc_set[i].wakeup = 0;
+    memset(&proc_set[i].info, 0, sizeof(struct proc_info));
+    proc_set[i].send_head = proc_set[i].send_tail = -1;
+    proc_set[i].base_priority = (pid < GPID_SHELL)? PRIO_SERVER :
+                                (pid == GPID_SHELL)? PRIO_SHELL : PRIO_USER;
+    proc_set[i].priority = proc_set[i].base_priority;
+    for (int j = 0; j < APPS_NPAGES; j++) proc_set[i].lazy[j] = LAZY_NONE;
+
+    proc_set[i].hash_next = pid_hash[pid % PID_HASH_SIZE];
+    pid_hash[pid % PID_HASH_SIZE] = i;
+    return pid; // Return the new process ID
+}
+
+static void proc_unlink(int idx) {
+    if (proc_set[idx].status == PROC_WAIT_TO_SEND) proc_sender_remove(idx);
+    pipe_close(proc_set[idx].pid);
+
+    int* link = &pid_hash[proc_set[idx].pid % PID_HASH_SIZE];
+    while (*link != idx) link = &proc_set[*link].hash_next;
+    *link = proc_set[idx].hash_next;
+    proc_set_status_idx(idx, PROC_UNUSED);
+    proc_set[idx].next = free_head;
+    free_head = idx;
+}
 
 // Free a process with a given process ID
 void proc_free(int pid) {
     if (pid != -1) { // If a specific process ID is provided
+        int idx = proc_idx(pid);
         earth->mmu_free(pid); // Free the memory associated with the process
-        proc_set_status(pid, PROC_UNUSED); // Set the process status to unused
+        if (idx != -1) proc_unlink(idx); // Set the process status to unused
         return;
     }
 
     // If no specific process ID is provided, free all user applications
-    for (int i = 0; i < MAX_NPROCESS; i++) // Loop through all processes
+    for (int i = 0; i < proc_nslots; i++) // Loop through all processes
         if (proc_set[i].pid >= GPID_USER_START &&
             proc_set[i].status != PROC_UNUSED) { // If the process is a user application and not unused
             earth->mmu_free(proc_set[i].pid); // Free the memory associated with the process
-            proc_set[i].status = PROC_UNUSED; // Set the process status to unused
+            proc_unlink(i); // Set the process status to unused
         }
 }
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "egos.h"
 #include "elf.h"
 #include "disk.h"
+#include "servers.h"
 
 enum {
     PROC_UNUSED,
@@ -10,7 +12,20 @@ enum {
     PROC_RUNNING,
     PROC_RUNNABLE,
     PROC_WAIT_TO_SEND,
-    PROC_WAIT_TO_RECV
+    PROC_WAIT_TO_RECV,
+    PROC_SLEEPING, /* wait until the mtime in wakeup */
+    PROC_WAIT_TTY, /* wait until a line is typed, see SYS_TTY_WAIT */
+    PROC_WAIT_PIPE /* wait until a pipe has data or room, see grass/pipe.c */
+};
+
+/* Priority levels, 0 is the highest; user apps and the shell move
+ * down to PRIO_LOWEST when they keep using their full quantum */
+enum {
+    PRIO_SERVER,
+    PRIO_SHELL,
+    PRIO_USER,
+    PRIO_LOWEST,
+    NPRIO
 };
 
 struct process{
@@ -19,17 +34,80 @@ struct process{
     int receiver_pid; /* used when waiting to send a message */
     void *sp, *mepc;  /* process context = stack pointer (sp)
                        * + machine exception program counter (mepc) */
+    int priority, base_priority;
+    int queued, next; /* in a ready queue and the next process there */
+    int hart;         /* whose ready queues it waits in, see proc_next() */
+    int hash_next;    /* next process in the same pid hash chain */
+    int send_head, send_tail; /* FIFO of processes waiting to send to this one */
+    int send_next;    /* next process in the FIFO of receiver_pid */
+    int recv_after;   /* SYS_CALL or SYS_REPLY_RECV: receive once sent */
+    int recv_from;    /* only receive from this pid, or from anyone if 0 */
+    unsigned long long wakeup;
+    unsigned long long blocked_since;
+    struct proc_info info; /* CPU and IPC counters */
+    int lazy[APPS_NPAGES]; /* frame copied to an app page on first touch */
 };
 
-#define MAX_NPROCESS  16
-extern int proc_curr_idx;
-extern struct process proc_set[MAX_NPROCESS];
+/* Values of lazy[] besides frame numbers, see proc_map_lazy() */
+#define LAZY_NONE  -2     /* the page is mapped or was never mapped lazily */
+#define LAZY_ZERO  -1     /* the page is zeroed on first touch */
+
+/* The process table is sized at boot to fill the heap of grass */
+#define MIN_NPROCESS  16
+extern struct process* proc_set;
+extern int proc_nslots;
+
+/* Scheduler state of each hart, see NHARTS in egos.h */
+struct hart {
+    int curr_idx;                 /* index in proc_set of the running process */
+    void (*kernel_entry)();       /* called by ctx_entry() on the kernel stack */
+    unsigned long long slice_end; /* when the time slice of curr_idx ends */
+    unsigned long long run_start; /* when curr_idx was dispatched */
+    int in_idle;                  /* interrupts are taken in proc_idle() */
+};
+extern struct hart harts[NHARTS];
+#define proc_curr_idx harts[HART_ID()].curr_idx
 #define curr_pid      proc_set[proc_curr_idx].pid
 #define curr_status   proc_set[proc_curr_idx].status
 
 void intr_entry(int);
 void excp_entry(int);
 
+void proc_init();
+int  proc_idx(int pid);
+int  proc_next();
+void proc_demote(int idx);
+void proc_restore(int idx);
+void proc_boost();
+int  proc_ready();
+void proc_sleep(int idx, unsigned long long deadline);
+void proc_recv_deadline(int idx, unsigned long long deadline);
+void proc_block(int idx, int status);
+int  proc_get_info(int idx, struct proc_info* info);
+unsigned int proc_idle_time();
+
+void trace_init();
+void trace_record(int type, int pid, int arg);
+int  trace_read(unsigned int* seq, struct trace_event* buf, int n);
+
+struct sys_msg;
+int  pipe_open(int writer, int reader);
+void pipe_close(int pid);
+int  pipe_rw(int idx, int write, struct sys_msg* msg);
+
+int  prof_enabled();
+void prof_record(int pid, unsigned int pc);
+int  prof_ctl(int cmd, struct prof_reply* reply);
+unsigned long long proc_wakeup(unsigned long long now);
+void proc_tty_wait(int idx);
+int  proc_tty_wakeup();
+void proc_pipe_wait(int idx);
+int  proc_map_lazy(int pid, int page_no, int frame_no);
+void proc_map_drop(int frame_no);
+int  proc_fault(int idx, int page_no);
+void proc_sender_enqueue(int receiver_idx, int idx);
+int  proc_sender_dequeue(int receiver_idx, int from);
+
 int  proc_alloc();
 void proc_free(int);
 void proc_set_ready (int);
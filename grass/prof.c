@@ -0,0 +1,55 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: a PC sampling profiler
+ * intr_entry() records (pid, mepc) at every timer interrupt while the
+ * profiler runs; samples are counted in a small open-addressing table
+ * and dumped by "prof dump", see apps/user/prof.c and tools/prof.py
+ */
+
+#include "egos.h"
+#include "process.h"
+#include <string.h>
+
+static struct prof_reply prof;
+
+int prof_enabled() { return prof.running; }
+
+void prof_record(int pid, unsigned int pc) {
+    if (!prof.running) return;
+    prof.nsamples++;
+
+    unsigned int h = ((pc >> 2) ^ (pid * 2654435761u)) % PROF_NSAMPLES;
+    for (int i = 0; i < PROF_NSAMPLES; i++) {
+        struct prof_sample* s = &prof.samples[(h + i) % PROF_NSAMPLES];
+        if (s->count == 0) {
+            s->pid = pid;
+            s->pc = pc;
+        }
+        if (s->pid == pid && s->pc == pc) {
+            s->count++;
+            return;
+        }
+    }
+    prof.dropped++;
+}
+
+int prof_ctl(int cmd, struct prof_reply* reply) {
+    switch (cmd) {
+    case PROF_START:
+        memset(&prof, 0, sizeof(prof));
+        prof.running = 1;
+        break;
+    case PROF_STOP:
+        prof.running = 0;
+        break;
+    case PROF_DUMP:
+        break;
+    default:
+        return -1;
+    }
+    memcpy(reply, &prof, sizeof(prof));
+    return 0;
+}
@@ -16,19 +16,30 @@ static struct syscall *sc = (struct syscall*)SYSCALL_ARG;
    This structure is likely used for passing arguments to system calls. */
 
 static void sys_invoke() {
-    /* Function to trigger a system call. It uses a memory-mapped I/O technique instead of the standard 'ecall' instruction. */
+    /* Function to trigger a system call with the 'ecall' instruction.
+     * The kernel only preserves the callee-saved registers on this path,
+     * so every caller-saved register is declared as clobbered; the
+     * system call is complete when ecall returns. */
+    asm volatile("ecall" ::: "ra", "t0", "t1", "t2", "t3", "t4", "t5", "t6",
+                 "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "memory");
+}
 
-    *((int*)0x2000000) = 1; // Writes the value 1 to the memory address 0x2000000, likely signaling the system call handler.
-    while (sc->type != SYS_UNUSED); // Busy-waits until the syscall's type is set to SYS_UNUSED, indicating completion.
+int sys_null() {
+    /* A system call which does nothing, for measuring the system call cost. */
+    sc->type = SYS_NULL;
+    sys_invoke();
+    return sc->retval;
 }
 
 int sys_send(int receiver, char* msg, int size) {
     /* Function to send a message via a system call. */
 
-    if (size > SYSCALL_MSG_LEN) return -1; // If the message size exceeds the maximum, returns -1 indicating an error.
+    if (size < 0 || size > SYSCALL_MSG_LEN) return -1; // If the message size exceeds the maximum, returns -1 indicating an error.
 
     sc->type = SYS_SEND; // Sets the system call type to SYS_SEND.
     sc->msg.receiver = receiver; // Sets the message receiver.
+    sc->msg.size = size; // The kernel only copies this many bytes of content.
+    sc->npages = 0; // No pages are granted with this message.
     memcpy(sc->msg.content, msg, size); // Copies the message content to the syscall structure.
     sys_invoke(); // Invokes the system call.
     return sc->retval;  // Returns the return value from the syscall.  
@@ -40,10 +51,154 @@ int sys_recv(int* sender, char* buf, int size) {
     if (size > SYSCALL_MSG_LEN) return -1; // If the buffer size exceeds the maximum, returns -1 indicating an error.
 
     sc->type = SYS_RECV; // Sets the system call type to SYS_RECV.
+    sc->npages = 0; // No pages are accepted with this message.
     sys_invoke(); // Invokes the system call.
-    memcpy(buf, sc->msg.content, size); // Copies the received message into the buffer.
+    int len = sc->msg.size; // The number of bytes actually sent.
+    memcpy(buf, sc->msg.content, (len < size)? len : size); // Copies the received message into the buffer.
     if (sender) *sender = sc->msg.sender; // If a sender pointer is provided, sets it to the sender of the message.
-    return sc->retval; // Returns the return value from the syscall.
+    return len; // Returns the length of the received message.
+}
+
+int sys_try_recv(int* sender, char* buf, int size) {
+    /* Receive a message if a sender is already waiting, or return -1. */
+    if (size > SYSCALL_MSG_LEN) return -1;
+
+    sc->type = SYS_TRY_RECV;
+    sc->npages = 0;
+    sys_invoke();
+    if (sc->retval < 0) return -1; // No process is waiting to send.
+
+    int len = sc->msg.size;
+    memcpy(buf, sc->msg.content, (len < size)? len : size);
+    if (sender) *sender = sc->msg.sender;
+    return len;
+}
+
+int sys_recv_timed(int* sender, char* buf, int size, unsigned int ticks) {
+    /* Receive a message, or return -1 if none arrives within ticks. */
+    if (size > SYSCALL_MSG_LEN) return -1;
+
+    sc->type = SYS_RECV_TIMED;
+    sc->npages = 0;
+    sc->ticks = ticks;
+    sys_invoke();
+    if (sc->retval < 0) return -1; // The deadline passed first.
+
+    int len = sc->msg.size;
+    memcpy(buf, sc->msg.content, (len < size)? len : size);
+    if (sender) *sender = sc->msg.sender;
+    return len;
+}
+
+static int sys_send_recv(int type, int receiver, char* msg, int size, int* sender, char* buf, int buf_size) {
+    /* Send msg and receive the next message in a single system call. */
+    if (size < 0 || size > SYSCALL_MSG_LEN || buf_size > SYSCALL_MSG_LEN) return -1;
+
+    sc->type = type;
+    sc->msg.receiver = receiver;
+    sc->msg.size = size;
+    sc->npages = 0;
+    memcpy(sc->msg.content, msg, size);
+    sys_invoke();
+    if (sc->retval < 0) return -1; // The receiver does not exist.
+
+    int len = sc->msg.size;
+    memcpy(buf, sc->msg.content, (len < buf_size)? len : buf_size);
+    if (sender) *sender = sc->msg.sender;
+    return len;
+}
+
+int sys_call(int receiver, char* msg, int size, char* reply, int reply_size) {
+    /* Send a request and wait for the reply of the same process. */
+    return sys_send_recv(SYS_CALL, receiver, msg, size, NULL, reply, reply_size);
+}
+
+int sys_reply_recv(int client, char* msg, int size, int* sender, char* buf, int buf_size) {
+    /* Reply to a client and wait for the next request of any process. */
+    return sys_send_recv(SYS_REPLY_RECV, client, msg, size, sender, buf, buf_size);
+}
+
+/* Page grants move whole frames of the app region at page-aligned pages
+ * from the sender to the receiver instead of copying them; the sender gets
+ * the receiver's old frames in exchange and must treat them as garbage */
+int sys_grant(int receiver, char* msg, int size, void* pages, int npages) {
+    if ((int)pages & (PAGE_SIZE - 1)) return -1;
+    if (size < 0 || size > SYSCALL_MSG_LEN) return -1;
+
+    sc->type = SYS_SEND;
+    sc->msg.receiver = receiver;
+    sc->msg.size = size;
+    sc->pages = pages;
+    sc->npages = npages;
+    memcpy(sc->msg.content, msg, size);
+    sys_invoke();
+    return sc->retval;
+}
+
+int sys_accept(int* sender, char* buf, int size, void* pages, int* npages) {
+    /* On return *npages holds the number of pages actually granted */
+    if ((int)pages & (PAGE_SIZE - 1)) return -1;
+    if (size > SYSCALL_MSG_LEN) return -1;
+
+    sc->type = SYS_RECV;
+    sc->pages = pages;
+    sc->npages = *npages;
+    sys_invoke();
+    int len = sc->msg.size;
+    memcpy(buf, sc->msg.content, (len < size)? len : size);
+    if (sender) *sender = sc->msg.sender;
+    *npages = sc->npages;
+    return len;
+}
+
+int sys_sleep(unsigned int ticks) {
+    /* Sleep for ticks of earth->timer_get(), see earth->timer_quantum. */
+    sc->type = SYS_SLEEP;
+    sc->ticks = ticks;
+    sys_invoke();
+    return sc->retval;
+}
+
+int sys_tty_read(char* buf, int len) {
+    /* Read a line from the tty, waiting in the kernel until one is typed. */
+    int n;
+    while ((n = earth->tty_read(buf, len)) < 0) {
+        sc->type = SYS_TTY_WAIT;
+        sys_invoke();
+    }
+    return n;
+}
+
+int sys_pipe_read(char* buf, int len) {
+    /* Read up to len bytes from the pipe feeding this process, waiting in
+     * the kernel while it is empty; 0 at the end of the stream, -1 if no
+     * pipe feeds this process. */
+    if (len > SYSCALL_MSG_LEN) len = SYSCALL_MSG_LEN;
+    do {
+        sc->type = SYS_PIPE_READ;
+        sc->msg.size = len;
+        sys_invoke();
+    } while (sc->retval == PIPE_AGAIN);
+    if (sc->retval > 0) memcpy(buf, sc->msg.content, sc->retval);
+    return sc->retval;
+}
+
+int sys_pipe_write(char* buf, int len) {
+    /* Write len bytes to the pipe this process feeds, waiting in the kernel
+     * while it is full; return len, 0 once the reader has exited, or -1 if
+     * this process feeds no pipe. */
+    for (int nwritten = 0; nwritten < len; ) {
+        int n = len - nwritten;
+        if (n > SYSCALL_MSG_LEN) n = SYSCALL_MSG_LEN;
+        sc->type = SYS_PIPE_WRITE;
+        sc->msg.size = n;
+        memcpy(sc->msg.content, buf + nwritten, n);
+        sys_invoke();
+        if (sc->retval == PIPE_AGAIN) continue;
+        if (sc->retval <= 0) return sc->retval;
+        nwritten += sc->retval;
+    }
+    return len;
 }
 
 void sys_exit(int status) {
@@ -6,21 +6,51 @@ enum syscall_type {
 	SYS_UNUSED,
 	SYS_RECV,
 	SYS_SEND,
+	SYS_CALL,       /* send, then receive the reply of the receiver */
+	SYS_REPLY_RECV, /* send, then receive a message from anyone */
+	SYS_NULL,       /* do nothing, see apps/user/sysbench.c */
+	SYS_SLEEP,      /* wait for a number of mtime ticks */
+	SYS_TTY_WAIT,   /* wait until a line has been typed */
+	SYS_TRY_RECV,   /* SYS_RECV which fails instead of waiting for a sender */
+	SYS_PIPE_READ,  /* read from the pipe of a pipeline, see grass/pipe.c */
+	SYS_PIPE_WRITE, /* write to the pipe of a pipeline */
+	SYS_RECV_TIMED, /* SYS_RECV which fails once ticks pass without a sender */
 	SYS_NCALLS
 };
 
 struct sys_msg {
     int sender;
     int receiver;
+    int size;        /* number of valid bytes in content */
     char content[SYSCALL_MSG_LEN];
 };
 
+/* retval of SYS_PIPE_* after waiting for the pipe; the caller retries */
+#define PIPE_AGAIN -2
+
+/* Bytes of a message the kernel copies between two processes */
+#define SYS_MSG_COPY_LEN(msg) (sizeof(struct sys_msg) - SYSCALL_MSG_LEN + (msg)->size)
+
 struct syscall {
     enum syscall_type type;  /* Type of the system call */
     struct sys_msg msg;      /* Data of the system call */
     int retval;              /* Return value of the system call */
+    void* pages;             /* SYS_SEND: pages to grant, SYS_RECV: where to accept them */
+    int npages;              /* SYS_RECV: set to the number of pages granted */
+    unsigned int ticks;      /* SYS_SLEEP, SYS_RECV_TIMED: how long to wait */
 };
 
 void sys_exit(int status);
+int  sys_null();
+int  sys_sleep(unsigned int ticks);
+int  sys_tty_read(char* buf, int len);
+int  sys_pipe_read(char* buf, int len);
+int  sys_pipe_write(char* buf, int len);
 int  sys_send(int pid, char* msg, int size);
 int  sys_recv(int* pid, char* buf, int size);
+int  sys_try_recv(int* pid, char* buf, int size);
+int  sys_recv_timed(int* pid, char* buf, int size, unsigned int ticks);
+int  sys_call(int pid, char* msg, int size, char* reply, int reply_size);
+int  sys_reply_recv(int pid, char* msg, int size, int* sender, char* buf, int buf_size);
+int  sys_grant(int pid, char* msg, int size, void* pages, int npages);
+int  sys_accept(int* pid, char* buf, int size, void* pages, int* npages);
@@ -0,0 +1,44 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: a ring buffer of scheduler and IPC events
+ * Recording an event is a timer read and a few stores, so it can stay on
+ * in every handler; apps/user/trace.c reads the buffer with PROC_TRACE,
+ * which sys_proc serves with trace_read(), and formats it, since printing
+ * from the kernel costs milliseconds.
+ */
+
+#include "egos.h"
+#include "process.h"
+
+#define TRACE_NEVENTS 128               /* power of 2 */
+
+static struct trace_event trace_buf[TRACE_NEVENTS];
+static unsigned int trace_seq;          /* number of events ever recorded */
+
+void trace_record(int type, int pid, int arg) {
+    struct trace_event* e = &trace_buf[trace_seq++ % TRACE_NEVENTS];
+    e->time = (unsigned int)earth->timer_get();
+    e->type = type;
+    e->pid = pid;
+    e->arg = arg;
+}
+
+static void trace_earth(int type, int pid, int arg) {
+    trace_record(type, pid? pid : curr_pid, arg);
+}
+
+void trace_init() { earth->trace = trace_earth; }
+
+/* Copy up to n events, starting with event number *seq or the oldest one
+ * still in the buffer, and advance *seq; return the number of events copied */
+int trace_read(unsigned int* seq, struct trace_event* buf, int n) {
+    if (trace_seq - *seq > TRACE_NEVENTS) *seq = trace_seq - TRACE_NEVENTS;
+
+    int cnt = 0;
+    for (; cnt < n && *seq != trace_seq; cnt++, (*seq)++)
+        buf[cnt] = trace_buf[*seq % TRACE_NEVENTS];
+    return cnt;
+}
@@ -1,24 +1,69 @@
 #pragma once
 
+/* Named event counters shared by earth, grass and the apps, see
+ * library/libc/counter.c and apps/user/stat.c; the hardware counters
+ * are cycle, instret and the hpmcounters which the core provides */
+#define NCOUNTERS          24
+#define NCOUNTERS_HW       6            /* cycle, instret, hpmcounter3..6 */
+#define COUNTER_NAME_LEN   12
+struct counter {
+    char name[COUNTER_NAME_LEN];
+    unsigned int value;
+};
+struct counter_registry {
+    volatile int lock;                  /* a struct spinlock, see spinlock.h */
+    int ncounters;
+    int nhw;                            /* hardware counters of the core */
+    unsigned int hw_base[NCOUNTERS_HW]; /* their values at the last reset */
+    struct counter counters[NCOUNTERS];
+};
+
+/* Kernel event trace, see grass/trace.c and apps/user/trace.c; the
+ * events are read with PROC_TRACE, see library/servers/servers.h */
+enum trace_type {
+    TRACE_SWITCH,                       /* arg: pid switched away from */
+    TRACE_SEND,                         /* arg: receiver */
+    TRACE_RECV,                         /* arg: sender */
+    TRACE_BLOCK,                        /* arg: new process status */
+    TRACE_WAKE,                         /* arg: old process status */
+    TRACE_SYSCALL,                      /* arg: system call type */
+    TRACE_SYSRET,                       /* arg: system call type */
+    TRACE_PAGE_MISS,                    /* arg: frame number */
+    TRACE_NTYPES
+};
+
 struct earth {
     /* CPU interface */
     int (*timer_reset)();
+    unsigned long long (*timer_get)();
+    int (*timer_set)(unsigned long long deadline);  /* TIMER_NEVER disarms */
+    unsigned int timer_quantum;         /* mtime ticks of one time slice */
 
     int (*intr_register)(void (*handler)(int));
     int (*excp_register)(void (*handler)(int));
 
-    int (*mmu_alloc)(int* frame_no, void** cached_addr);
+    int (*mmu_alloc)(int* frame_no, void** cached_addr, int zeroed);
     int (*mmu_free)(int pid);
+    int (*mmu_free_frame)(int frame_no);
+    int (*mmu_copy)(int dst_frame_no, int src_frame_no);
     int (*mmu_map)(int pid, int page_no, int frame_no);
     int (*mmu_switch)(int pid);
+    struct counter_registry* counters;  /* set first by earth_init() */
+    int (*mmu_flush)(int nframes);      /* all dirty frames if nframes <= 0, see cpu_mmu.c */
+    int (*mmu_grant)(int src_pid, int src_page_no, int dst_pid, int dst_page_no);
+    int (*mmu_map_rom)(int pid, int page_no, int block_no);  /* -1 unless the disk is the ROM */
+    int (*mmu_unmap)(int pid, int page_no);  /* with page tables, page_no then faults */
+    void (*trace)(int type, int pid, int arg);  /* set by grass, pid 0 is the current one */
 
     /* Devices interface */
     int (*disk_read)(int block_no, int nblocks, char* dst);
     int (*disk_write)(int block_no, int nblocks, char* src);
 
-    int (*tty_recv_intr)();
-    int (*tty_read)(char* buf, int len);
+    int (*tty_recv_intr)();             /* Ctrl+C was typed since the last call */
+    int (*tty_ready)();                 /* a line is ready for tty_read */
+    int (*tty_read)(char* buf, int len);  /* -1 if no line is ready */
     int (*tty_write)(char* buf, int len);
+    int (*tty_drain)(int wait);         /* wait == 0 only refills the UART FIFO */
 
     int (*tty_printf)(const char *format, ...);
     int (*tty_info)(const char *format, ...);
@@ -31,25 +76,70 @@ struct earth {
     enum { PAGE_TABLE, SOFT_TLB } translation;
 };
 
+/* Boot phases; boot_time[phase] is the low 32 bits of mtime when the
+ * phase ends, and sys_proc prints the summary once the shell is spawned */
+enum boot_phase {
+    BOOT_START,                         /* entering earth */
+    BOOT_TTY,                           /* tty_init() */
+    BOOT_DISK,                          /* disk_init(), including the disk choice */
+    BOOT_CPU,                           /* mmu, timer and interrupt initialization */
+    BOOT_GRASS,                         /* loading the grass layer */
+    BOOT_PROC,                          /* loading sys_proc */
+    BOOT_SERVERS,                       /* spawning sys_file, sys_dir and sys_shell */
+    BOOT_NPHASES
+};
+
+struct proc_info;                       /* see library/servers/servers.h */
+struct prof_reply;
+struct trace_event;
 struct grass {
     /* Shell environment variables */
     int workdir_ino;
     char workdir[128];
 
+    /* Bumped by GPID_DIR whenever a directory changes, and by GPID_FILE
+     * on every write to inode ino at file_version[ino % NFILE_VERSIONS] */
+    unsigned int dir_generation;
+#define NFILE_VERSIONS 16
+    unsigned int file_version[NFILE_VERSIONS];
+
+    unsigned int boot_time[BOOT_NPHASES];
+
     /* Process control interface */
+    int  proc_nslots;                   /* slots of the process table */
     int  (*proc_alloc)();
     void (*proc_free)(int pid);
     void (*proc_set_ready)(int pid);
+    int  (*proc_info)(int idx, struct proc_info* info); /* -1 if idx is unused */
+    unsigned int (*proc_idle_time)();
+    int  (*proc_map_lazy)(int pid, int page_no, int frame_no); /* copied, or zeroed if -1, on first touch */
+    void (*proc_map_drop)(int frame_no);  /* copy frame_no now to the processes still waiting for it */
+    int  (*prof_ctl)(int cmd, struct prof_reply* reply);
+    int  (*trace_read)(unsigned int* seq, struct trace_event* buf, int n);
+    int  (*proc_pipe)(int writer, int reader); /* -1 if no pipe is free */
 
     /* System call interface */
     void (*sys_exit)(int status);
+    int  (*sys_null)();
+    int  (*sys_sleep)(unsigned int ticks);
+    int  (*sys_tty_read)(char* buf, int len);
+    int  (*sys_pipe_read)(char* buf, int len);  /* 0 at the end, -1 without a pipe */
+    int  (*sys_pipe_write)(char* buf, int len); /* 0 once the reader exited, -1 without a pipe */
     int  (*sys_send)(int pid, char* msg, int size);
     int  (*sys_recv)(int* pid, char* buf, int size);
+    int  (*sys_try_recv)(int* pid, char* buf, int size); /* -1 if no sender waits */
+    int  (*sys_recv_timed)(int* pid, char* buf, int size, unsigned int ticks); /* -1 after ticks */
+    int  (*sys_call)(int pid, char* msg, int size, char* reply, int reply_size);
+    int  (*sys_reply_recv)(int pid, char* msg, int size, int* sender, char* buf, int buf_size);
+    int  (*sys_grant)(int pid, char* msg, int size, void* pages, int npages);
+    int  (*sys_accept)(int* pid, char* buf, int size, void* pages, int* npages);
 };
 
 extern struct earth *earth;
 extern struct grass *grass;
 
+#define TIMER_NEVER        0x0FFFFFFFFFFFFFFFULL
+
 /* Memory layout */
 #define PAGE_SIZE          4096
 #define FRAME_CACHE_END    0x80020000
@@ -58,8 +148,8 @@ extern struct grass *grass;
 #define GRASS_STACK_TOP    0x80003f80  /* 8KB    earth/grass stack     */
                                        /*        grass interface       */
 #define APPS_STACK_TOP     0x80002000  /* 6KB    app stack             */
-#define SYSCALL_ARG        0x80000400  /* 1KB    system call args      */
-#define APPS_ARG           0x80000000  /* 1KB    app main() argc, argv */
+#define SYSCALL_ARG        0x80000300  /* 1.25KB system call args      */
+#define APPS_ARG           0x80000000  /* 768B   app main() argc, argv */
 #define APPS_SIZE          0x00003000  
 #define APPS_ENTRY         0x08005000  /* 12KB   app code+data         */
 #define GRASS_SIZE         0x00002800
@@ -67,6 +157,23 @@ extern struct grass *grass;
                                        /* 12KB   earth data            */
                                        /* earth code is in QSPI flash  */
 
+/* Harts running the kernel, e.g. make NHARTS=2; hart h runs on the
+ * kernel stack below KERNEL_STACK_TOP(h) and earth.s keeps its hart id
+ * in tp, which the compiler never allocates */
+#ifndef NHARTS
+#define NHARTS             1
+#endif
+#define HART_STACK_SIZE    0x800
+#define KERNEL_STACK_TOP(hart) (GRASS_STACK_TOP - (hart) * HART_STACK_SIZE)
+#if NHARTS > 1
+#define HART_ID() ({ int id; asm volatile("mv %0, tp" : "=r"(id)); id; })
+#else
+#define HART_ID() 0
+#endif
+#if NHARTS > 3
+#error "the 8KB earth/grass stack region holds at most 3 kernel stacks"
+#endif
+
 
 #ifndef LIBC_STDIO
 /* Only earth/dev_tty.c uses LIBC_STDIO and does not need these macros */
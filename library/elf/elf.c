@@ -6,6 +6,7 @@
 /* Author: Yunhao Zhang
  * Description: load an ELF-format executable file into memory
  * Only use the program header instead of the multiple section headers.
+ * Segments compressed by mkfs -z are decompressed while they are read.
  */
 
 #include "egos.h"
@@ -15,6 +16,59 @@
 
 #include <string.h>
 
+/* Read the compressed data of a segment one block at a time */
+struct lz4_stream {
+    elf_reader reader;
+    int block_no, pos;
+    unsigned char buf[BLOCK_SIZE];
+};
+
+static void lz4_open(struct lz4_stream* s, elf_reader reader, int block_no) {
+    s->reader = reader;
+    s->block_no = block_no;
+    s->pos = BLOCK_SIZE;
+}
+
+static int lz4_getc(struct lz4_stream* s) {
+    if (s->pos == BLOCK_SIZE) {
+        s->reader(s->block_no++, 1, (char*)s->buf);
+        s->pos = 0;
+    }
+    return s->buf[s->pos++];
+}
+
+static int lz4_length(struct lz4_stream* s, int len) {
+    for (int b = 255; len >= 15 && b == 255; len += b) b = lz4_getc(s);
+    return len;
+}
+
+/* Decompress one LZ4 block holding n bytes into dst */
+static void lz4_decode(struct lz4_stream* s, char* dst, int n) {
+    char *out = dst, *end = dst + n;
+    while (1) {
+        int token = lz4_getc(s);
+        for (int len = lz4_length(s, token >> 4); len; len--) *out++ = lz4_getc(s);
+        if (out >= end) return; /* the last sequence has no match */
+
+        int offset = lz4_getc(s);
+        offset |= lz4_getc(s) << 8;
+        for (int len = lz4_length(s, token & 0xF) + 4; len; len--, out++) *out = *(out - offset);
+    }
+}
+
+static int compressed;                  /* the binary being loaded is compressed */
+static int xip_npages;                  /* its leading pages without writable data */
+
+/* Put nbytes of a segment at dst, decompressed from s or else read from
+ * the blocks at block_offset */
+static void load_page(elf_reader reader, struct lz4_stream* s,
+                      int block_offset, int nbytes, char* dst) {
+    if (compressed)
+        lz4_decode(s, dst, nbytes);
+    else
+        reader(block_offset, (nbytes + BLOCK_SIZE - 1) / BLOCK_SIZE, dst);
+}
+
 static void load_grass(elf_reader reader,
                        struct elf32_program_header* pheader) {
     INFO("Grass kernel file size: 0x%.8x bytes", pheader->p_filesz);
@@ -22,48 +76,72 @@ static void load_grass(elf_reader reader,
 
     char* entry = (char*)GRASS_ENTRY;
     int block_offset = pheader->p_offset / BLOCK_SIZE;
-    for (int off = 0; off < pheader->p_filesz; off += BLOCK_SIZE)
-        reader(block_offset++, entry + off);
+    if (compressed) {
+        struct lz4_stream s;
+        lz4_open(&s, reader, block_offset);
+        for (int off = 0; off < pheader->p_filesz; off += ELF_LZ4_CHUNK) {
+            int nbytes = pheader->p_filesz - off;
+            lz4_decode(&s, entry + off, (nbytes < ELF_LZ4_CHUNK)? nbytes : ELF_LZ4_CHUNK);
+        }
+    } else {
+        int nblocks = (pheader->p_filesz + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        reader(block_offset, nblocks, entry);
+    }
 
     memset(entry + pheader->p_filesz, 0, GRASS_SIZE - pheader->p_filesz);
 }
 
-static void load_app(int pid, elf_reader reader,
-                     int argc, void** argv,
-                     struct elf32_program_header* pheader) {
-
-    /* Debug printing during bootup */
-    if (pid < GPID_USER_START) {
-        INFO("App file size: 0x%.8x bytes", pheader->p_filesz);
-        INFO("App memory size: 0x%.8x bytes", pheader->p_memsz);
-    }
-
-    void* base;
-    int frame_no, block_offset = pheader->p_offset / BLOCK_SIZE;
-    unsigned int code_start = APPS_ENTRY >> 12, stack_start = APPS_ARG >> 12;
-
-    /* Setup the text, rodata, data and bss sections */
-    for (int off = 0; off < pheader->p_filesz; off += BLOCK_SIZE) {
-        if (off % PAGE_SIZE == 0) {
-            earth->mmu_alloc(&frame_no, &base);
-            earth->mmu_map(pid, code_start++, frame_no);
+/* Load the segment into frames, except the first npages pages which are
+ * mapped in place already; return the number of pages holding the segment
+ * data, and the bss pages after them are left to the caller, or -1 with
+ * no frame allocated if the frames run out */
+static int load_app_code(elf_reader reader, struct elf32_program_header* pheader,
+                         int* frames, int npages) {
+    void* base = NULL;
+    int frame_no, first = npages, block_offset = pheader->p_offset / BLOCK_SIZE + npages * PAGE_SIZE / BLOCK_SIZE;
+    struct lz4_stream s;
+    lz4_open(&s, reader, block_offset);
+
+    /* Setup the text, rodata, data and bss sections, one page per read */
+    for (int off = npages * PAGE_SIZE; off < pheader->p_filesz; off += PAGE_SIZE) {
+        if (earth->mmu_alloc(&frame_no, &base, 0) < 0) {
+            while (npages > first) earth->mmu_free_frame(frames[--npages]);
+            return -1;
         }
-        reader(block_offset++, (char*)base + (off % PAGE_SIZE));
+        frames[npages++] = frame_no;
+
+        int nbytes = pheader->p_filesz - off;
+        if (nbytes > PAGE_SIZE) nbytes = PAGE_SIZE;
+        load_page(reader, &s, block_offset, nbytes, (char*)base);
+        block_offset += PAGE_SIZE / BLOCK_SIZE;
     }
+    /* base is the last page read, unless the pages were all in place */
     int last_page_filled = pheader->p_filesz % PAGE_SIZE;
     int last_page_nzeros = PAGE_SIZE - last_page_filled;
-    if (last_page_filled)
+    if (last_page_filled && npages > first)
         memset((char*)base + last_page_filled, 0, last_page_nzeros);
+    return npages;
+}
 
-    while (code_start < ((APPS_ENTRY + APPS_SIZE) >> 12)) {
-        earth->mmu_alloc(&frame_no, &base);
-        earth->mmu_map(pid, code_start++, frame_no);
-        memset((char*)base, 0, PAGE_SIZE);
+/* Allocate a frame and map it at page_no of pid; the frames mapped are
+ * freed along with pid */
+static void* load_page_map(int pid, int page_no) {
+    void* base;
+    int frame_no;
+    if (earth->mmu_alloc(&frame_no, &base, 0) < 0) return NULL;
+    if (earth->mmu_map(pid, page_no, frame_no) < 0) {
+        earth->mmu_free_frame(frame_no);
+        return NULL;
     }
+    return base;
+}
+
+int elf_load_args(int pid, int argc, void** argv) {
+    void* base;
+    unsigned int stack_start = APPS_ARG >> 12;
 
     /* Setup two pages for argc, argv and stack */
-    earth->mmu_alloc(&frame_no, &base);
-    earth->mmu_map(pid, stack_start++, frame_no);
+    if ((base = load_page_map(pid, stack_start++)) == NULL) return -1;
 
     int* argc_addr = (int*)base;
     int* argv_addr = argc_addr + 1;
@@ -74,23 +152,72 @@ static void load_app(int pid, elf_reader reader,
     for (int i = 0; i < argc; i++)
         argv_addr[i] = APPS_ARG + 4 + 4 * CMD_NARGS + i * CMD_ARG_LEN;
 
-    earth->mmu_alloc(&frame_no, &base);
-    earth->mmu_map(pid, stack_start++, frame_no);
+    return load_page_map(pid, stack_start++) == NULL? -1 : 0;
+}
+
+static void load_app(int pid, elf_reader reader, int xip_base,
+                     int argc, void** argv,
+                     struct elf32_program_header* pheader) {
+
+    /* Debug printing during bootup */
+    if (pid < GPID_USER_START) {
+        INFO("App file size: 0x%.8x bytes", pheader->p_filesz);
+        INFO("App memory size: 0x%.8x bytes", pheader->p_memsz);
+    }
+
+    /* Execute the read-only pages from the disk if it is memory-mapped */
+    int nxip = 0, block_no = xip_base + pheader->p_offset / BLOCK_SIZE;
+    if (xip_base >= 0 && !compressed && pheader->p_offset % PAGE_SIZE == 0)
+        for (; nxip < xip_npages && nxip < APPS_NPAGES; nxip++, block_no += PAGE_SIZE / BLOCK_SIZE)
+            if (earth->mmu_map_rom(pid, (APPS_ENTRY >> 12) + nxip, block_no) < 0) break;
+
+    /* Kernel processes run in machine mode and cannot fault pages in,
+     * so their bss pages are zeroed here, unlike those of user apps */
+    void* base;
+    int frames[APPS_NPAGES];
+    int npages = load_app_code(reader, pheader, frames, nxip);
+    for (int i = npages; npages >= 0 && i < APPS_NPAGES; i++)
+        if (earth->mmu_alloc(&frames[i], &base, 1) < 0) npages = -1;
+    for (int i = nxip; npages >= 0 && i < APPS_NPAGES; i++)
+        if (earth->mmu_map(pid, (APPS_ENTRY >> 12) + i, frames[i]) < 0) npages = -1;
+
+    if (npages < 0 || elf_load_args(pid, argc, argv) < 0)
+        FATAL("load_app: no more available frames for pid %d", pid);
+}
+
+int elf_load_image(elf_reader reader, int* frames) {
+    char buf[BLOCK_SIZE];
+    reader(0, 1, buf);
+
+    struct elf32_header *header = (void*) buf;
+    struct elf32_program_header *pheader = (void*)(buf + header->e_phoff);
+    compressed = header->e_ident[ELF_IDENT_LZ4];
+
+    for (int i = 0; i < header->e_phnum; i++)
+        if (pheader[i].p_memsz && pheader[i].p_vaddr == APPS_ENTRY) {
+            int npages = load_app_code(reader, &pheader[i], frames, 0);
+            if (npages < 0) return -1;
+            for (int j = npages; j < APPS_NPAGES; j++) frames[j] = -1;
+            return 0;
+        }
+    return -1;
 }
 
-void elf_load(int pid, elf_reader reader, int argc, void** argv) {
+void elf_load(int pid, elf_reader reader, int xip_base, int argc, void** argv) {
     char buf[BLOCK_SIZE];
-    reader(0, buf);
+    reader(0, 1, buf);
 
     struct elf32_header *header = (void*) buf;
     struct elf32_program_header *pheader = (void*)(buf + header->e_phoff);
+    compressed = header->e_ident[ELF_IDENT_LZ4];
+    xip_npages = header->e_ident[ELF_IDENT_XIP];
 
     for (int i = 0; i < header->e_phnum; i++) {
         if (pheader[i].p_memsz == 0) continue;
         else if (pheader[i].p_vaddr == GRASS_ENTRY)
             load_grass(reader, &pheader[i]);
         else if (pheader[i].p_vaddr == APPS_ENTRY)
-            load_app(pid, reader, argc, argv, &pheader[i]);
+            load_app(pid, reader, xip_base, argc, argv, &pheader[i]);
         else FATAL("elf_load: Invalid p_vaddr: 0x%.8x", pheader->p_vaddr);
     }
 }
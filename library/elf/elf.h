@@ -31,5 +31,42 @@ struct elf32_program_header {
     uint32_t       p_align;
 };
 
-typedef int (*elf_reader)(int block_no, char* dst);
-void elf_load(int pid, elf_reader reader, int argc, void** argv);
+/* With mkfs -z, the segments of the kernel binaries are compressed: the
+ * data at p_offset is one LZ4 block per PAGE_SIZE bytes of the segment,
+ * so each page can be decompressed on its own; p_filesz is unchanged */
+#define ELF_IDENT_LZ4  9                /* first padding byte of e_ident */
+#define ELF_LZ4_CHUNK  4096
+
+/* mkfs also records how many pages of an uncompressed kernel binary hold
+ * no writable section; with the on-board ROM as the disk, they execute
+ * in place instead of taking frames, see mmu_map_rom() in earth */
+#define ELF_IDENT_XIP  10
+
+#define SHF_WRITE      0x1
+#define SHF_ALLOC      0x2
+struct elf32_section_header {
+    uint32_t       sh_name;
+    uint32_t       sh_type;
+    uint32_t       sh_flags;
+    uint32_t       sh_addr;
+    uint32_t       sh_offset;
+    uint32_t       sh_size;
+    uint32_t       sh_link;
+    uint32_t       sh_info;
+    uint32_t       sh_addralign;
+    uint32_t       sh_entsize;
+};
+
+/* An elf_reader reads nblocks contiguous blocks starting at block_no;
+ * xip_base is the disk block where reader's block 0 is, or -1 if the
+ * binary is not in the kernel binary area and cannot execute in place */
+typedef int (*elf_reader)(int block_no, int nblocks, char* dst);
+void elf_load(int pid, elf_reader reader, int xip_base, int argc, void** argv);
+
+/* An app image is the APPS_NPAGES frames holding its code, data and bss,
+ * where -1 stands for a bss page which is all zeros; elf_load_image()
+ * loads one into unmapped frames and elf_load_args() maps the argument
+ * and stack pages of pid; both return -1 when no frame is left */
+#define APPS_NPAGES (APPS_SIZE / PAGE_SIZE)
+int  elf_load_image(elf_reader reader, int* frames);
+int  elf_load_args(int pid, int argc, void** argv);
@@ -0,0 +1,217 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: a write-back block cache with LRU replacement
+ *
+ * This code implements an inode store that caches the blocks of the
+ * inode store below it.  The interface is as follows:
+ *
+ *		inode_store_t *cachedisk_init(inode_store_t *below, unsigned int nblocks)
+ *			Creates a cache of nblocks blocks in front of "below".  Reads
+ *			are served from the cache when possible; writes only update
+ *			the cache and mark the block dirty.
+ *
+ *		int cachedisk_sync(inode_store_t *this_bs)
+ *			Writes every dirty block back to the inode store below.
+ *
+ *		int cachedisk_stats(inode_store_t *this_bs, struct cache_stats *stats)
+ *			Copies the hit/miss/eviction/writeback counters to *stats.
+ *
+ * Dirty blocks are also written back when they are evicted.  The least
+ * recently used block is evicted first.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "inode.h"
+
+#ifdef MKFS
+#define COUNT(name, n)
+#else
+#include "counter.h"
+#endif
+
+struct cache_entry {
+    int valid, dirty;
+    unsigned int ino;
+    block_no offset;
+    int prev, next;                     /* LRU list, -1 terminates */
+};
+
+struct cachedisk_state {
+    inode_store_t *below;               /* inode store below */
+    unsigned int nblocks;               /* number of cached blocks */
+    struct cache_entry *entries;
+    block_t *blocks;
+    int head, tail;                     /* most and least recently used */
+    struct cache_stats stats;
+};
+
+/* Move entry i to the head of the LRU list.
+ */
+static void cache_touch(struct cachedisk_state *cs, int i){
+    struct cache_entry *e = &cs->entries[i];
+    if (cs->head == i) return;
+
+    /* Unlink entry i.
+     */
+    if (e->prev != -1) cs->entries[e->prev].next = e->next;
+    if (e->next != -1) cs->entries[e->next].prev = e->prev;
+    if (cs->tail == i) cs->tail = e->prev;
+
+    /* Insert entry i at the head.
+     */
+    e->prev = -1;
+    e->next = cs->head;
+    if (cs->head != -1) cs->entries[cs->head].prev = i;
+    cs->head = i;
+    if (cs->tail == -1) cs->tail = i;
+}
+
+static int cache_writeback(struct cachedisk_state *cs, int i){
+    struct cache_entry *e = &cs->entries[i];
+    if (!e->valid || !e->dirty) return 0;
+
+    if ((*cs->below->write)(cs->below, e->ino, e->offset, &cs->blocks[i]) < 0)
+        return -1;
+    e->dirty = 0;
+    cs->stats.writebacks++;
+    return 0;
+}
+
+static int cache_lookup(struct cachedisk_state *cs, unsigned int ino, block_no offset){
+    for (int i = cs->head; i != -1; i = cs->entries[i].next)
+        if (cs->entries[i].valid && cs->entries[i].ino == ino &&
+            cs->entries[i].offset == offset)
+            return i;
+    return -1;
+}
+
+/* Find a slot for (ino, offset), evicting the least recently used block.
+ */
+static int cache_alloc(struct cachedisk_state *cs, unsigned int ino, block_no offset){
+    int i = cs->tail;
+    if (cs->entries[i].valid) {
+        if (cache_writeback(cs, i) < 0)
+            return -1;
+        cs->stats.evictions++;
+    }
+
+    cs->entries[i].valid = 1;
+    cs->entries[i].dirty = 0;
+    cs->entries[i].ino = ino;
+    cs->entries[i].offset = offset;
+    cache_touch(cs, i);
+    return i;
+}
+
+static int cachedisk_getsize(inode_store_t *this_bs, unsigned int ino){
+    struct cachedisk_state *cs = this_bs->state;
+    return (*cs->below->getsize)(cs->below, ino);
+}
+
+static int cachedisk_setsize(inode_store_t *this_bs, unsigned int ino, block_no nblocks){
+    struct cachedisk_state *cs = this_bs->state;
+
+    /* Drop cached blocks beyond the new size.
+     */
+    for (int i = 0; i < cs->nblocks; i++)
+        if (cs->entries[i].valid && cs->entries[i].ino == ino &&
+            cs->entries[i].offset >= nblocks)
+            cs->entries[i].valid = 0;
+
+    return (*cs->below->setsize)(cs->below, ino, nblocks);
+}
+
+static int cachedisk_read(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block){
+    struct cachedisk_state *cs = this_bs->state;
+
+    int i = cache_lookup(cs, ino, offset);
+    if (i != -1) {
+        cs->stats.hits++;
+        COUNT("bcache.hit", 1);
+        cache_touch(cs, i);
+        memcpy(block, &cs->blocks[i], BLOCK_SIZE);
+        return 0;
+    }
+
+    cs->stats.misses++;
+    COUNT("bcache.miss", 1);
+    if ((i = cache_alloc(cs, ino, offset)) < 0)
+        return -1;
+    if ((*cs->below->read)(cs->below, ino, offset, &cs->blocks[i]) < 0) {
+        cs->entries[i].valid = 0;
+        return -1;
+    }
+    memcpy(block, &cs->blocks[i], BLOCK_SIZE);
+    return 0;
+}
+
+static int cachedisk_write(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block){
+    struct cachedisk_state *cs = this_bs->state;
+
+    int i = cache_lookup(cs, ino, offset);
+    if (i != -1) {
+        cs->stats.hits++;
+        COUNT("bcache.hit", 1);
+        cache_touch(cs, i);
+    }
+    else {
+        cs->stats.misses++;
+        COUNT("bcache.miss", 1);
+        if ((i = cache_alloc(cs, ino, offset)) < 0)
+            return -1;
+    }
+
+    memcpy(&cs->blocks[i], block, BLOCK_SIZE);
+    cs->entries[i].dirty = 1;
+    return 0;
+}
+
+int cachedisk_sync(inode_store_t *this_bs){
+    struct cachedisk_state *cs = this_bs->state;
+
+    int r = 0;
+    for (int i = 0; i < cs->nblocks; i++)
+        if (cache_writeback(cs, i) < 0)
+            r = -1;
+    return r;
+}
+
+int cachedisk_stats(inode_store_t *this_bs, struct cache_stats *stats){
+    struct cachedisk_state *cs = this_bs->state;
+    memcpy(stats, &cs->stats, sizeof(struct cache_stats));
+    return 0;
+}
+
+inode_store_t *cachedisk_init(inode_store_t *below, unsigned int nblocks){
+    /* Create the cache state structure; all blocks start out invalid and
+     * linked in the LRU list in index order.
+     */
+    struct cachedisk_state *cs = malloc(sizeof(struct cachedisk_state));
+    memset(cs, 0, sizeof(struct cachedisk_state));
+    cs->below = below;
+    cs->nblocks = nblocks;
+    cs->entries = malloc(nblocks * sizeof(struct cache_entry));
+    cs->blocks = malloc(nblocks * sizeof(block_t));
+    for (int i = 0; i < nblocks; i++) {
+        cs->entries[i].valid = cs->entries[i].dirty = 0;
+        cs->entries[i].prev = i - 1;
+        cs->entries[i].next = (i == nblocks - 1)? -1 : i + 1;
+    }
+    cs->head = 0;
+    cs->tail = nblocks - 1;
+
+    /* Return a block interface to the cache.
+     */
+    inode_store_t *this_bs = malloc(sizeof(inode_store_t));
+    memset(this_bs, 0, sizeof(inode_store_t));
+    this_bs->state = cs;
+    this_bs->getsize = cachedisk_getsize;
+    this_bs->setsize = cachedisk_setsize;
+    this_bs->read = cachedisk_read;
+    this_bs->write = cachedisk_write;
+    return this_bs;
+}
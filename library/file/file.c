@@ -10,17 +10,28 @@
  * a so-called "inode number", which indexes into an array of inodes.  The 
  * interface is as follows:
  *
- *		void treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes)
+ *		void treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes,
+ *		                     int free_space)
  *			Initializes the underlying inode store "below" with a file system
  *			stored within inode below_ino. If "below" is a simple
  * 			non-virtualized inode store like the disk server, below_ino is
  * 			probably 0. The file system consists of one "superblock", a number
  * 			of blocks containing inodes, and the remaining blocks explained
  * 			below. The file system can support up to ninodes inodes.
+ *			free_space is TREEDISK_FREE_LIST or TREEDISK_FREE_BITMAP.
  *
  *		inode_store_t *treedisk_init(inode_store_t *below, unsigned int below_ino)
  *			Opens a virtual inode store within inode below_ino of the inode store below.
  *
+ *		int treedisk_reserve(inode_store_t *this_bs, unsigned int ino, block_no nblocks)
+ *			Reserves a contiguous run of blocks below for the next nblocks
+ *			blocks appended to inode ino, which the caller then writes.
+ *
+ *		int treedisk_extents(inode_store_t *this_bs, unsigned int ino, block_no offset,
+ *		                     block_no nblocks, struct treedisk_extent *runs, int nruns)
+ *			Finds the runs of contiguous blocks below which hold blocks
+ *			[offset, offset+nblocks) of inode ino.
+ *
  * The layout of the file system is described in the file "file.h".
  */
 
@@ -36,20 +47,63 @@
 
 /* Temporary information about the file system and a particular inode.
  * Convenient for all operations. See "file.h" for field details.
+ * The superblock itself stays resident in struct treedisk_state.
  */
 struct treedisk_snapshot {
-    union treedisk_block superblock;   // Superblock of the file system
     union treedisk_block inodeblock;   // Block containing the inode
     block_no inode_blockno;            // Block number of the inode
     struct treedisk_inode *inode;      // Pointer to the inode
 };
 
+/* A decoded inode, so that reads do not fetch the inode block and
+ * recompute the depth of the tree every time.
+ */
+#define NCACHED_INODES  8
+struct treedisk_cached_inode {
+    int valid;
+    unsigned int ino;
+    block_no root, nblocks;
+    unsigned int nlevels;              // depth of the tree = # of indirect levels
+};
+
+/* The bottom-level indirect block of the last inode accessed.  Reading the
+ * next offset of the same inode then costs a single data block read.
+ */
+struct treedisk_last_indir {
+    int valid;
+    unsigned int ino;
+    block_no base;                     // offset >> log_rpb of the covered blocks
+    struct treedisk_indirblock tib;
+};
+
+/* Blocks [offset, offset+nblocks) of inode ino go to the run of blocks
+ * starting at block start below, see treedisk_reserve().
+ */
+struct treedisk_reservation {
+    int valid;
+    unsigned int ino;
+    block_no offset, nblocks, start;
+};
+
 /* The state of a virtual inode store, which is identified by an inode number.
  */
 struct treedisk_state {
     inode_store_t *below;			/* inode store below */
     unsigned int below_ino;			/* inode number to use for the inode store below */
     unsigned int ninodes;			/* number of inodes in the treedisk */
+
+    int has_superblock;			/* superblock has been read */
+    union treedisk_block superblock;	/* resident copy of the superblock */
+    struct treedisk_cached_inode inodes[NCACHED_INODES];
+    struct treedisk_last_indir last_indir;
+    struct treedisk_reservation reservation;
+
+    /* TREEDISK_FREE_BITMAP: the last bitmap block accessed, and where the
+     * search for a free block without a hint starts.
+     */
+    block_no bitmap_blockno;		/* 0 if bitmap_block is not valid */
+    struct treedisk_bitmapblock bitmap_block;
+    block_no next_fit;
 };
 
 static unsigned int log_rpb;                    /* log2(REFS_PER_BLOCK) */
@@ -75,18 +129,39 @@ static block_no log_shift_r(block_no x, unsigned int nbits){
     return x >> nbits; // Otherwise, perform the right shift
 }
 
-/* Get a snapshot of the file system, including the superblock and the block
- * containing the inode, from the inode store below.
+/* Figure out how many levels of indirect blocks a tree of nblocks needs.
+ */
+static unsigned int treedisk_nlevels(block_no nblocks){
+    unsigned int nlevels = 0;
+    if (nblocks > 0)
+        while (log_shift_r(nblocks - 1, nlevels * log_rpb) != 0) {
+            nlevels++;
+        }
+    return nlevels;
+}
+
+/* Read the superblock from the inode store below the first time only.
+ */
+static int treedisk_get_superblock(struct treedisk_state *ts){
+    if (ts->has_superblock)
+        return 0;
+    if ((*ts->below->read)(ts->below, ts->below_ino, 0, (block_t *) &ts->superblock) < 0)
+        return -1; // Return -1 on failure
+    ts->has_superblock = 1;
+    return 0;
+}
+
+/* Get a snapshot of the block containing the inode from the inode store below.
  */
 static int treedisk_get_snapshot(struct treedisk_snapshot *snapshot,
                                  struct treedisk_state *ts, unsigned int inode_no){
     // Get the superblock
-    if ((*ts->below->read)(ts->below, ts->below_ino, 0, (block_t *) &snapshot->superblock) < 0)
+    if (treedisk_get_superblock(ts) < 0)
         return -1; // Return -1 on failure
 
     // Check if the inode number is valid
-    if (inode_no >= snapshot->superblock.superblock.n_inodeblocks * INODES_PER_BLOCK) {
-        printf("!!TDERR: inode number too large %u %u\n", inode_no, snapshot->superblock.superblock.n_inodeblocks);
+    if (inode_no >= ts->superblock.superblock.n_inodeblocks * INODES_PER_BLOCK) {
+        printf("!!TDERR: inode number too large %u %u\n", inode_no, ts->superblock.superblock.n_inodeblocks);
         return -1; // Return -1 if inode number is too large
     }
 
@@ -99,14 +174,94 @@ static int treedisk_get_snapshot(struct treedisk_snapshot *snapshot,
     return 0; // Return 0 on success
 }
 
-/* Allocate a block from the free list.
+/* Remember the decoded form of an inode.
+ */
+static struct treedisk_cached_inode *treedisk_cache_inode(struct treedisk_state *ts,
+                                         unsigned int ino, struct treedisk_inode *inode){
+    struct treedisk_cached_inode *ci = &ts->inodes[ino % NCACHED_INODES];
+    ci->valid = 1;
+    ci->ino = ino;
+    ci->root = inode->root;
+    ci->nblocks = inode->nblocks;
+    ci->nlevels = treedisk_nlevels(inode->nblocks);
+    return ci;
+}
+
+/* Get the decoded inode, reading the inode block only on a cache miss.
+ */
+static struct treedisk_cached_inode *treedisk_get_inode(struct treedisk_state *ts, unsigned int ino){
+    struct treedisk_cached_inode *ci = &ts->inodes[ino % NCACHED_INODES];
+    if (ci->valid && ci->ino == ino)
+        return ci;
+
+    struct treedisk_snapshot snapshot;
+    if (treedisk_get_snapshot(&snapshot, ts, ino) < 0)
+        return NULL;
+    return treedisk_cache_inode(ts, ino, snapshot.inode);
+}
+
+/* Get bitmap block i, which covers blocks i * BITS_PER_BLOCK and up.
+ */
+static struct treedisk_bitmapblock *treedisk_get_bitmap(struct treedisk_state *ts, block_no i){
+    block_no blockno = ts->superblock.superblock.bitmap + i;
+    if (ts->bitmap_blockno != blockno) {
+        if ((*ts->below->read)(ts->below, ts->below_ino, blockno, (block_t *) &ts->bitmap_block) < 0)
+            panic("treedisk_get_bitmap");
+        ts->bitmap_blockno = blockno;
+    }
+    return &ts->bitmap_block;
+}
+
+static void treedisk_put_bitmap(struct treedisk_state *ts){
+    if ((*ts->below->write)(ts->below, ts->below_ino, ts->bitmap_blockno, (block_t *) &ts->bitmap_block) < 0)
+        panic("treedisk_put_bitmap");
+}
+
+/* Take the first free block at or after hint from the bitmap, wrapping
+ * around at the end; a whole word of bits is checked at a time.
+ */
+static block_no treedisk_bitmap_alloc(struct treedisk_state *ts, block_no hint){
+    block_no n_bitmapblocks = ts->superblock.superblock.n_bitmapblocks;
+    if (hint == 0 || hint >= n_bitmapblocks * BITS_PER_BLOCK)
+        hint = ts->next_fit;
+    block_no first = hint / BITS_PER_BLOCK;
+    unsigned int first_word = (hint % BITS_PER_BLOCK) / 32;
+
+    /* The last round scans the first bitmap block again from its start.
+     */
+    for (block_no n = 0; n <= n_bitmapblocks; n++) {
+        block_no i = (first + n) % n_bitmapblocks;
+        struct treedisk_bitmapblock *bm = treedisk_get_bitmap(ts, i);
+        for (unsigned int w = (n == 0)? first_word : 0; w < WORDS_PER_BLOCK; w++) {
+            unsigned int used = bm->words[w];
+            if (n == 0 && w == first_word)
+                used |= (1u << (hint % 32)) - 1;
+            if (used == ~0u)
+                continue;
+
+            unsigned int bit = __builtin_ctz(~used);
+            bm->words[w] |= 1u << bit;
+            treedisk_put_bitmap(ts);
+            block_no b = i * BITS_PER_BLOCK + w * 32 + bit;
+            ts->next_fit = b + 1;
+            return b;
+        }
+    }
+    panic("treedisk_alloc_block: inode store is full\n");
+    return 0;
+}
+
+/* Allocate a block, from the bitmap near hint if the file system has a
+ * bitmap, or from the free list otherwise.  A hint of 0 means none.
  */
-static block_no treedisk_alloc_block(struct treedisk_state *ts, struct treedisk_snapshot *snapshot){
+static block_no treedisk_alloc_block(struct treedisk_state *ts, block_no hint){
+    if (ts->superblock.superblock.bitmap != 0)
+        return treedisk_bitmap_alloc(ts, hint);
+
     block_no b;
-    static int count;
-    count++;
+    union treedisk_block *superblock = &ts->superblock;
 
-    if ((b = snapshot->superblock.superblock.free_list) == 0)
+    if ((b = superblock->superblock.free_list) == 0)
         panic("treedisk_alloc_block: inode store is full\n");
 
     /* Read the freelist block and scan for a free block reference.
@@ -126,8 +281,8 @@ static block_no treedisk_alloc_block(struct treedisk_state *ts, struct treedisk_
     block_no free_blockno;
     if (i == 0) {
         free_blockno = b;
-        snapshot->superblock.superblock.free_list = freelistblock.freelistblock.refs[0];
-        if ((*ts->below->write)(ts->below, ts->below_ino, 0, (block_t *) &snapshot->superblock) < 0) {
+        superblock->superblock.free_list = freelistblock.freelistblock.refs[0];
+        if ((*ts->below->write)(ts->below, ts->below_ino, 0, (block_t *) superblock) < 0) {
             panic("treedisk_alloc_block: superblock");
         }
     }
@@ -142,80 +297,314 @@ static block_no treedisk_alloc_block(struct treedisk_state *ts, struct treedisk_
     return free_blockno;
 }
 
+/* Return block b to the bitmap or the free list.
+ */
+static void treedisk_free_block(struct treedisk_state *ts, block_no b){
+    union treedisk_block *superblock = &ts->superblock;
+    if (superblock->superblock.bitmap != 0) {
+        struct treedisk_bitmapblock *bm = treedisk_get_bitmap(ts, b / BITS_PER_BLOCK);
+        bm->words[(b % BITS_PER_BLOCK) / 32] &= ~(1u << (b % 32));
+        treedisk_put_bitmap(ts);
+        return;
+    }
+
+    /* Put b in an empty slot of the first free list block, or make b
+     * the new first free list block if there is none.
+     */
+    union treedisk_block freelistblock;
+    block_no head = superblock->superblock.free_list;
+    if (head != 0) {
+        (*ts->below->read)(ts->below, ts->below_ino, head, (block_t *) &freelistblock);
+        for (unsigned int i = 1; i < REFS_PER_BLOCK; i++)
+            if (freelistblock.freelistblock.refs[i] == 0) {
+                freelistblock.freelistblock.refs[i] = b;
+                if ((*ts->below->write)(ts->below, ts->below_ino, head, (block_t *) &freelistblock) < 0)
+                    panic("treedisk_free_block: freelistblock");
+                return;
+            }
+    }
+
+    memset(&freelistblock, 0, BLOCK_SIZE);
+    freelistblock.freelistblock.refs[0] = head;
+    if ((*ts->below->write)(ts->below, ts->below_ino, b, (block_t *) &freelistblock) < 0)
+        panic("treedisk_free_block: freelistblock");
+    superblock->superblock.free_list = b;
+    if ((*ts->below->write)(ts->below, ts->below_ino, 0, (block_t *) superblock) < 0)
+        panic("treedisk_free_block: superblock");
+}
+
+/* Take a run of n contiguous free blocks and return the first one, or 0
+ * if there is no such run.  This walks the whole free list twice or
+ * scans the whole bitmap, so it is meant for files whose size is known
+ * up front.
+ */
+static block_no treedisk_bitmap_alloc_run(struct treedisk_state *ts, block_no n){
+    block_no nbits = ts->superblock.superblock.n_bitmapblocks * BITS_PER_BLOCK;
+    block_no start = 0, len = 0, b;
+    for (b = 1; b < nbits && len < n; b++) {
+        struct treedisk_bitmapblock *bm = treedisk_get_bitmap(ts, b / BITS_PER_BLOCK);
+        if (bm->words[(b % BITS_PER_BLOCK) / 32] & (1u << (b % 32))) {
+            len = 0;
+        }
+        else if (len++ == 0) {
+            start = b;
+        }
+    }
+    if (len < n)
+        return 0;
+
+    for (b = start; b < start + n; b++) {
+        struct treedisk_bitmapblock *bm = treedisk_get_bitmap(ts, b / BITS_PER_BLOCK);
+        bm->words[(b % BITS_PER_BLOCK) / 32] |= 1u << (b % 32);
+        if (b == start + n - 1 || (b + 1) % BITS_PER_BLOCK == 0)
+            treedisk_put_bitmap(ts);
+    }
+    return start;
+}
+
+static block_no treedisk_alloc_run(struct treedisk_state *ts, block_no n){
+    if (ts->superblock.superblock.bitmap != 0)
+        return treedisk_bitmap_alloc_run(ts, n);
+
+    unsigned int nbelow = (*ts->below->getsize)(ts->below, ts->below_ino);
+    unsigned char *free_map = malloc((nbelow + 7) / 8);
+    memset(free_map, 0, (nbelow + 7) / 8);
+
+    /* Mark the blocks referenced by free list blocks.  The free list
+     * blocks themselves hold the list, so they are not part of a run.
+     */
+    union treedisk_block flb;
+    block_no b;
+    for (b = ts->superblock.superblock.free_list; b != 0; b = flb.freelistblock.refs[0]) {
+        (*ts->below->read)(ts->below, ts->below_ino, b, (block_t *) &flb);
+        for (unsigned int i = 1; i < REFS_PER_BLOCK; i++)
+            if (flb.freelistblock.refs[i] != 0)
+                free_map[flb.freelistblock.refs[i] / 8] |= 1 << (flb.freelistblock.refs[i] % 8);
+    }
+
+    /* Find the first run of n free blocks.
+     */
+    block_no start = 0, len = 0;
+    for (b = 1; b < nbelow && len < n; b++)
+        if (free_map[b / 8] & (1 << (b % 8))) {
+            if (len++ == 0) start = b;
+        }
+        else {
+            len = 0;
+        }
+    free(free_map);
+    if (len < n)
+        return 0;
+
+    /* Remove the run from the free list.
+     */
+    for (b = ts->superblock.superblock.free_list; b != 0; b = flb.freelistblock.refs[0]) {
+        (*ts->below->read)(ts->below, ts->below_ino, b, (block_t *) &flb);
+        int dirty = 0;
+        for (unsigned int i = 1; i < REFS_PER_BLOCK; i++)
+            if (flb.freelistblock.refs[i] >= start && flb.freelistblock.refs[i] < start + n) {
+                flb.freelistblock.refs[i] = 0;
+                dirty = 1;
+            }
+        if (dirty && (*ts->below->write)(ts->below, ts->below_ino, b, (block_t *) &flb) < 0)
+            panic("treedisk_alloc_run: freelistblock");
+    }
+    return start;
+}
+
+/* Allocate the block for data at 'offset' of inode ino, from the
+ * reservation if it covers the offset, or else near hint.
+ */
+static block_no treedisk_alloc_data(struct treedisk_state *ts, unsigned int ino, block_no offset, block_no hint){
+    struct treedisk_reservation *rs = &ts->reservation;
+    if (rs->valid && rs->ino == ino && offset >= rs->offset && offset < rs->offset + rs->nblocks)
+        return rs->start + (offset - rs->offset);
+    return treedisk_alloc_block(ts, hint);
+}
+
 /* Retrieve the number of blocks in the file referenced by 'this_bs'.  This
  * information is maintained in the inode itself.
  */
 static int treedisk_getsize(inode_store_t *this_bs, unsigned int ino){
     struct treedisk_state *ts = this_bs->state;
-    struct treedisk_snapshot snapshot;
-    if (treedisk_get_snapshot(&snapshot, ts, ino) < 0)
+    struct treedisk_cached_inode *ci = treedisk_get_inode(ts, ino);
+    if (ci == NULL)
         return -1;
 
-    return snapshot.inode->nblocks; 
+    return ci->nblocks; 
 }
 
-/* Set the size of the file 'this_bs' to 'nblocks'.
+/* Free the blocks holding offsets keep and up in the subtree rooted at
+ * block b, which has nlevels levels of indirect blocks and starts at
+ * offset base.  Return 1 if b itself is freed.
  */
-static int treedisk_setsize(inode_store_t *this_bs, unsigned int ino, block_no nblocks){
-    return -1;
+static int treedisk_trim(struct treedisk_state *ts, block_no b, unsigned int nlevels,
+                         block_no base, block_no keep){
+    if (b == 0)
+        return 0;
+
+    struct treedisk_indirblock tib;
+    if (nlevels > 0 && (*ts->below->read)(ts->below, ts->below_ino, b, (block_t *) &tib) < 0)
+        panic("treedisk_trim");
+
+    /* The whole subtree goes.
+     */
+    if (base >= keep) {
+        for (unsigned int i = 0; nlevels > 0 && i < REFS_PER_BLOCK; i++)
+            treedisk_trim(ts, tib.refs[i], nlevels - 1, 0, 0);
+        treedisk_free_block(ts, b);
+        return 1;
+    }
+    if (nlevels == 0)
+        return 0;
+
+    /* Trim the children which cover offsets keep and up.
+     */
+    block_no span = 1u << ((nlevels - 1) * log_rpb);
+    int dirty = 0;
+    for (unsigned int i = 0; i < REFS_PER_BLOCK; i++) {
+        if (base + (i + 1) * span <= keep)
+            continue;
+        if (treedisk_trim(ts, tib.refs[i], nlevels - 1, base + i * span, keep)) {
+            tib.refs[i] = 0;
+            dirty = 1;
+        }
+    }
+    if (dirty && (*ts->below->write)(ts->below, ts->below_ino, b, (block_t *) &tib) < 0)
+        panic("treedisk_trim: indirect block");
+    return 0;
 }
 
-/* Read a block at the given block number 'offset' and return in *block.
+/* Set the size of the file 'this_bs' to 'nblocks' and return the old
+ * size.  Shrinking frees the blocks beyond the new size and growing
+ * adds holes.
  */
-static int treedisk_read(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block){
+static int treedisk_setsize(inode_store_t *this_bs, unsigned int ino, block_no nblocks){
     struct treedisk_state *ts = this_bs->state;
 
-    /* Get info from underlying file system.
-     */
     struct treedisk_snapshot snapshot;
     if (treedisk_get_snapshot(&snapshot, ts, ino) < 0)
         return -1;
+    struct treedisk_inode *inode = snapshot.inode;
+    block_no old_nblocks = inode->nblocks;
+    unsigned int nlevels = treedisk_nlevels(old_nblocks);
+    unsigned int nlevels_after = treedisk_nlevels(nblocks);
 
-    /* See if the offset is too big.
+    /* The memoized indirect block may be freed, and the reservation
+     * no longer starts at the end of the file.
      */
-    if (offset >= snapshot.inode->nblocks) {
-        /* printf("!!TDERR: offset too large %u %u\n", offset, snapshot.inode->nblocks); */
-        return -1;
+    ts->last_indir.valid = 0;
+    if (ts->reservation.ino == ino)
+        ts->reservation.valid = 0;
+
+    if (nblocks < old_nblocks) {
+        if (treedisk_trim(ts, inode->root, nlevels, 0, nblocks))
+            inode->root = 0;
+
+        /* Drop the levels which are no longer needed; only the first
+         * reference of the root block can still be in use.
+         */
+        for (; nlevels > nlevels_after && inode->root != 0; nlevels--) {
+            struct treedisk_indirblock tib;
+            if ((*ts->below->read)(ts->below, ts->below_ino, inode->root, (block_t *) &tib) < 0)
+                panic("treedisk_setsize");
+            treedisk_free_block(ts, inode->root);
+            inode->root = tib.refs[0];
+        }
+    }
+    else {
+        /* Grow the number of levels as treedisk_write() does.
+         */
+        for (; nlevels < nlevels_after && inode->root != 0; nlevels++) {
+            struct treedisk_indirblock tib;
+            memset(&tib, 0, BLOCK_SIZE);
+            tib.refs[0] = inode->root;
+            inode->root = treedisk_alloc_block(ts, inode->root + 1);
+            if ((*ts->below->write)(ts->below, ts->below_ino, inode->root, (block_t *) &tib) < 0)
+                panic("treedisk_setsize: indirect block");
+        }
     }
 
-    /* Figure out how many levels there are in the tree.
+    inode->nblocks = nblocks;
+    if ((*ts->below->write)(ts->below, ts->below_ino, snapshot.inode_blockno, (block_t *) &snapshot.inodeblock) < 0)
+        panic("treedisk_setsize: inode block");
+    treedisk_cache_inode(ts, ino, inode);
+    return old_nblocks;
+}
+
+/* Find the block below which holds block 'offset' of the inode, or 0 for
+ * a hole.  Upper indirect blocks are read into *scratch, while the
+ * bottom-level one is kept in ts->last_indir.
+ */
+static int treedisk_bmap(struct treedisk_state *ts, struct treedisk_cached_inode *ci,
+                         block_no offset, block_t *scratch, block_no *result){
+    /* If the last indirect block covers this offset, skip the walk.
      */
-    unsigned int nlevels = 0;
-    if (snapshot.inode->nblocks > 0)
-        while (log_shift_r(snapshot.inode->nblocks - 1, nlevels * log_rpb) != 0) {
-            nlevels++;
-        }
+    unsigned int nlevels = ci->nlevels;
+    struct treedisk_last_indir *li = &ts->last_indir;
+    if (nlevels > 0 && li->valid && li->ino == ci->ino && li->base == (offset >> log_rpb)) {
+        *result = li->tib.refs[offset % REFS_PER_BLOCK];
+        return 0;
+    }
 
-    /* Walk down from the root block.
+    /* Walk down from the root block until the data block or a hole.
      */
-    block_no b = snapshot.inode->root;
-    for (;;) {
-        /* If there's a hole, return the null block.
-         */
-        if (b == 0) {
-            memset(block, 0, BLOCK_SIZE);
-            return 0;
-        }
+    block_no b = ci->root;
+    while (nlevels > 0 && b != 0) {
+        block_t *dst = (nlevels == 1)? (block_t *) &li->tib : scratch;
+        if (nlevels == 1)
+            li->valid = 0;
+        if ((*ts->below->read)(ts->below, ts->below_ino, b, dst) < 0)
+            return -1;
 
-        /* Return the next level.  If the last level, we're done.
-         */
-        int result = (*ts->below->read)(ts->below, ts->below_ino, b, block);
-        if (result < 0)
-            return result;
-        if (nlevels == 0)
-            return 0;
-
-        /* The block is an indirect block.  Figure out the index into this
-         * block and get the block number.
+        /* Figure out the index into this block and get the block number.
          */
         nlevels--;
-        struct treedisk_indirblock *tib = (struct treedisk_indirblock *) block;
+        struct treedisk_indirblock *tib = (struct treedisk_indirblock *) dst;
         unsigned int index = log_shift_r(offset, nlevels * log_rpb) % REFS_PER_BLOCK;
         b = tib->refs[index];
+
+        if (nlevels == 0) {
+            li->valid = 1;
+            li->ino = ci->ino;
+            li->base = offset >> log_rpb;
+        }
     }
+    *result = b;
     return 0;
 }
 
+/* Read a block at the given block number 'offset' and return in *block.
+ */
+static int treedisk_read(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block){
+    struct treedisk_state *ts = this_bs->state;
+
+    /* Get info from the inode cache or the underlying file system.
+     */
+    struct treedisk_cached_inode *ci = treedisk_get_inode(ts, ino);
+    if (ci == NULL)
+        return -1;
+
+    /* See if the offset is too big.
+     */
+    if (offset >= ci->nblocks) {
+        /* printf("!!TDERR: offset too large %u %u\n", offset, ci->nblocks); */
+        return -1;
+    }
+
+    /* *block serves as the buffer of the walk until the data is read.
+     * If there's a hole, return the null block.
+     */
+    block_no b;
+    if (treedisk_bmap(ts, ci, offset, block, &b) < 0)
+        return -1;
+    if (b == 0) {
+        memset(block, 0, BLOCK_SIZE);
+        return 0;
+    }
+    return (*ts->below->read)(ts->below, ts->below_ino, b, block);
+}
+
 /* Write *block at the given block number 'offset'.
  */
 static int treedisk_write(inode_store_t *this_bs, unsigned int ino, block_no offset, block_t *block){
@@ -229,13 +618,14 @@ static int treedisk_write(inode_store_t *this_bs, unsigned int ino, block_no off
     if (treedisk_get_snapshot(snapshot, ts, ino) < 0)
         return -1;
 
+    /* The walk below uses the memoized indirect block as its buffer,
+     * so forget it; it is set again at the end of the walk.
+     */
+    ts->last_indir.valid = 0;
+
     /* Figure out how many levels there are in the tree now.
      */
-    unsigned int nlevels = 0;
-    if (snapshot->inode->nblocks > 0)
-        while (log_shift_r(snapshot->inode->nblocks - 1, nlevels * log_rpb) != 0) {
-            nlevels++;
-        }
+    unsigned int nlevels = treedisk_nlevels(snapshot->inode->nblocks);
 
     /* Figure out how many levels we need after writing.  Files cannot shrink
      * by writing.
@@ -244,10 +634,7 @@ static int treedisk_write(inode_store_t *this_bs, unsigned int ino, block_no off
     if (offset >= snapshot->inode->nblocks) {
         snapshot->inode->nblocks = offset + 1;
         dirty_inode = 1;
-        nlevels_after = 0;
-        while (log_shift_r(offset, nlevels_after * log_rpb) != 0) {
-            nlevels_after++;
-        }
+        nlevels_after = treedisk_nlevels(offset + 1);
     }
     else {
         nlevels_after = nlevels;
@@ -255,11 +642,11 @@ static int treedisk_write(inode_store_t *this_bs, unsigned int ino, block_no off
 
     /* Grow the number of levels as needed by inserting indirect blocks.
      */
-    if (snapshot->inode->nblocks == 0) {
+    if (snapshot->inode->root == 0) {
         nlevels = nlevels_after;
     } else if (nlevels_after > nlevels) {
         while (nlevels_after > nlevels) {
-            block_no indir = treedisk_alloc_block(ts, snapshot);
+            block_no indir = treedisk_alloc_block(ts, snapshot->inode->root + 1);
 
             /* Insert the new indirect block into the inode.
              */
@@ -284,84 +671,111 @@ static int treedisk_write(inode_store_t *this_bs, unsigned int ino, block_no off
         }
 
     /* Find the block by walking the tree, allocating new blocks
-     * (and indirect blocks) if necessary.
+     * (and indirect blocks) if necessary.  A newly allocated block is
+     * recorded in its parent, which is written back right away.
      */
+    unsigned int depth = nlevels;
     block_no b;
     block_no *parent_no = &snapshot->inode->root;
     block_no parent_off = snapshot->inode_blockno;
     block_t *parent_block = (block_t *) &snapshot->inodeblock;
-    // for (;;) {
-    //     /* Get or allocate the next block.
-    //      */
-    //     struct treedisk_indirblock tib;
-    //     if ((b = *parent_no) == 0) {
-    //         b = *parent_no = treedisk_alloc_block(ts, snapshot);
-    //         if ((*ts->below->write)(ts->below, ts->below_ino, parent_off, parent_block) < 0)
-    //             panic("treedisk_write: parent");
-    //         if (nlevels == 0)
-    //             break;
-    //         memset(&tib, 0, BLOCK_SIZE);
-    //     }
-    //     else {
-    //         if (nlevels == 0)
-    //             break;
-    //         if ((*ts->below->read)(ts->below, ts->below_ino, b, (block_t *) &tib) < 0)
-    //             panic("treedisk_write");
-    //     }
-
-    //     /* Figure out the index into this block and get the block number.
-    //      */
-    //     nlevels--;
-    //     unsigned int index = log_shift_r(offset, nlevels * log_rpb) % REFS_PER_BLOCK;
-    //     parent_no = &tib.refs[index];
-    //     parent_block = (block_t *) &tib;
-    //     parent_off = b;
-    // }
-
-
-
-    // Key Points for Zero-Copy Optimization:
-    // Direct Write to Disk: Wherever possible, write data directly from the user-space memory buffer to the disk without intermediate copies. This can be implemented using direct I/O techniques if supported by the underlying system.
-    // Minimize Internal Copying: Avoid unnecessary copying of data within the function. For instance, if indirect blocks are used, consider ways to manipulate these blocks directly in memory.
-    // Buffer Management: Efficiently manage buffers used for reading blocks (like indirect blocks) to reduce the overhead of memory operations.
-    
-    // Proposed Optimizations:
-    // Direct Disk Writes: When writing block to the disk, use direct I/O techniques to write the data directly from the buffer to the disk. This might require support from the underlying ts->below->write function.
-    // Optimized Indirect Block Handling: When handling indirect blocks (struct treedisk_indirblock tib), try to minimize the number of times these blocks are read into and written from memory. 
-    // For example, if we're only updating a single reference in an indirect block, read the block, update the reference, and write it back in a single sequence to avoid multiple I/O operations.
-    // Inode Updates: Group inode updates (dirty_inode) to reduce the number of write operations. If multiple updates to the inode are required, perform them all at once before writing the inode block back to disk.
-    // Error Handling and Recovery: Implement robust error handling, especially for write operations. Ensure that in case of a failure, the file system can recover or maintain consistency.
-    
+    struct treedisk_indirblock *tib = &ts->last_indir.tib;
+    block_no hint = 0;
     for (;;) {
-        struct treedisk_indirblock tib;
-
-        // Directly allocate or fetch the block
-        b = *parent_no = (*parent_no == 0) ? treedisk_alloc_block(ts, snapshot) : *parent_no;
-
-        // Handle the indirect block only if needed
-        if (nlevels > 0) {
-            if ((*ts->below->read)(ts->below, ts->below_ino, b, (block_t *)&tib) < 0)
-                panic("treedisk_write: read indirect block");
-
-            // Update the reference in the indirect block
-            unsigned int index = log_shift_r(offset, nlevels * log_rpb) % REFS_PER_BLOCK;
-            parent_no = &tib.refs[index];
-            if (nlevels == 1) { // If it's the last indirect level, update the reference to the data block
-                *parent_no = (*parent_no == 0) ? treedisk_alloc_block(ts, snapshot) : *parent_no;
-                if ((*ts->below->write)(ts->below, ts->below_ino, b, (block_t *)&tib) < 0)
-                    panic("treedisk_write: write indirect block");
-            }
-        } else {
-            break; // Exit the loop if no more levels are left
+        /* Get or allocate the next block, next to the block before it
+         * in the file or else next to its parent.
+         */
+        if ((b = *parent_no) == 0) {
+            b = *parent_no = (nlevels == 0)? treedisk_alloc_data(ts, ino, offset, hint) : treedisk_alloc_block(ts, hint);
+            if ((*ts->below->write)(ts->below, ts->below_ino, parent_off, parent_block) < 0)
+                panic("treedisk_write: parent");
+            if (nlevels == 0)
+                break;
+            memset(tib, 0, BLOCK_SIZE);
         }
+        else {
+            if (nlevels == 0)
+                break;
+            if ((*ts->below->read)(ts->below, ts->below_ino, b, (block_t *) tib) < 0)
+                panic("treedisk_write");
+        }
+
+        /* Figure out the index into this block and get the block number.
+         */
         nlevels--;
+        unsigned int index = log_shift_r(offset, nlevels * log_rpb) % REFS_PER_BLOCK;
+        parent_no = &tib->refs[index];
+        parent_block = (block_t *) tib;
+        parent_off = b;
+        hint = (index > 0 && tib->refs[index - 1] != 0)? tib->refs[index - 1] + 1 : b + 1;
     }
 
     if ((*ts->below->write)(ts->below, ts->below_ino, b, block) < 0)
         panic("treedisk_write: data block");
+
+    /* The inode and the bottom-level indirect block are now up to date.
+     */
+    treedisk_cache_inode(ts, ino, snapshot->inode);
+    if (depth > 0) {
+        ts->last_indir.valid = 1;
+        ts->last_indir.ino = ino;
+        ts->last_indir.base = offset >> log_rpb;
+    }
     return 0;
 }
 
+int treedisk_reserve(inode_store_t *this_bs, unsigned int ino, block_no nblocks){
+    struct treedisk_state *ts = this_bs->state;
+    struct treedisk_cached_inode *ci = treedisk_get_inode(ts, ino);
+    if (ci == NULL || nblocks == 0)
+        return -1;
+
+    /* Blocks reserved earlier and not written stay allocated, so the
+     * caller is expected to write the whole reservation.
+     */
+    block_no start = treedisk_alloc_run(ts, nblocks);
+    if (start == 0)
+        return -1;
+    ts->reservation.valid = 1;
+    ts->reservation.ino = ino;
+    ts->reservation.offset = ci->nblocks;
+    ts->reservation.nblocks = nblocks;
+    ts->reservation.start = start;
+    return 0;
+}
+
+int treedisk_extents(inode_store_t *this_bs, unsigned int ino, block_no offset,
+                     block_no nblocks, struct treedisk_extent *runs, int nruns){
+    /* Holes are runs starting at block 0.  Return the number of runs,
+     * which end early if the file does or if nruns runs are not enough.
+     */
+    struct treedisk_state *ts = this_bs->state;
+    struct treedisk_cached_inode *ci = treedisk_get_inode(ts, ino);
+    if (ci == NULL)
+        return -1;
+    if (offset + nblocks > ci->nblocks)
+        nblocks = offset < ci->nblocks? ci->nblocks - offset : 0;
+
+    int n = 0;
+    block_t scratch;
+    for (block_no off = offset; off < offset + nblocks; off++) {
+        block_no b;
+        if (treedisk_bmap(ts, ci, off, &scratch, &b) < 0)
+            return -1;
+        if (n > 0 && ((b == 0 && runs[n - 1].start == 0) ||
+                      (b != 0 && b == runs[n - 1].start + runs[n - 1].nblocks))) {
+            runs[n - 1].nblocks++;
+            continue;
+        }
+        if (n == nruns)
+            break;
+        runs[n].start = b;
+        runs[n].nblocks = 1;
+        n++;
+    }
+    return n;
+}
+
 /* Open a virtual inode store on the specified inode of the inode store below.
  */
 
@@ -399,21 +813,32 @@ inode_store_t *treedisk_init(inode_store_t *below, unsigned int below_ino){
  ************************************************************************/
 
 /* Create the free list and return the block number of the first
- * block on it.
+ * block on it.  The free list blocks come first and the blocks they
+ * reference follow in one contiguous range.  treedisk_alloc_block()
+ * takes the last reference of a free list block first, so references
+ * are stored in reverse and files written one after another get
+ * ascending, contiguous blocks.
  */
 block_no setup_freelist(inode_store_t *below, unsigned int below_ino, block_no next_free, block_no nblocks){
     block_no freelist_data[REFS_PER_BLOCK];
     block_no freelist_block = 0;
     unsigned int i;
 
-    while (next_free < nblocks) {
-        freelist_data[0] = freelist_block;
-        freelist_block = next_free++;
-        for (i = 1; i < REFS_PER_BLOCK && next_free < nblocks; i++)
-            freelist_data[i] = next_free++;
+    /* Each free list block references up to REFS_PER_BLOCK - 1 blocks.
+     */
+    if (next_free >= nblocks)
+        return 0;
+    block_no nfreelist = (nblocks - next_free + REFS_PER_BLOCK - 1) / REFS_PER_BLOCK;
+    block_no data = next_free + nfreelist;
 
-        for (; i < REFS_PER_BLOCK; i++)
-            freelist_data[i] = 0;
+    for (block_no k = nfreelist; k-- > 0;) {
+        block_no first = data + k * (REFS_PER_BLOCK - 1);
+        freelist_data[0] = freelist_block;
+        freelist_block = next_free + k;
+        for (i = 1; i < REFS_PER_BLOCK; i++) {
+            block_no b = first + (REFS_PER_BLOCK - 1 - i);
+            freelist_data[i] = b < nblocks? b : 0;
+        }
 
         if ((*below->write)(below, below_ino, freelist_block, (block_t *) freelist_data) < 0)
             panic("treedisk_setup_freelist");
@@ -423,7 +848,25 @@ block_no setup_freelist(inode_store_t *below, unsigned int below_ino, block_no n
 
 /* Create a new file system on the specified inode of the inode store below.
  */
-int treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes){
+/* Create the bitmap, marking the blocks before next_free and the blocks
+ * beyond the end of the inode store as in use.
+ */
+static void setup_bitmap(inode_store_t *below, unsigned int below_ino, block_no bitmap,
+                         block_no n_bitmapblocks, block_no next_free, block_no nblocks){
+    struct treedisk_bitmapblock bm;
+    for (block_no i = 0; i < n_bitmapblocks; i++) {
+        memset(&bm, 0, BLOCK_SIZE);
+        for (unsigned int bit = 0; bit < BITS_PER_BLOCK; bit++) {
+            block_no b = i * BITS_PER_BLOCK + bit;
+            if (b < next_free || b >= nblocks)
+                bm.words[bit / 32] |= 1u << (bit % 32);
+        }
+        if ((*below->write)(below, below_ino, bitmap + i, (block_t *) &bm) < 0)
+            panic("treedisk_setup_bitmap");
+    }
+}
+
+int treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int ninodes, int free_space){
     if (sizeof(union treedisk_block) != BLOCK_SIZE)
         panic("treedisk_create: block has wrong size");
 
@@ -451,8 +894,17 @@ int treedisk_create(inode_store_t *below, unsigned int below_ino, unsigned int n
         union treedisk_block superblock;
         memset(&superblock, 0, BLOCK_SIZE);
         superblock.superblock.n_inodeblocks = n_inodeblocks;
-        superblock.superblock.free_list =
-            setup_freelist(below, below_ino, n_inodeblocks + 1, nblocks);
+        if (free_space == TREEDISK_FREE_BITMAP) {
+            block_no n_bitmapblocks = (nblocks + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK;
+            superblock.superblock.bitmap = n_inodeblocks + 1;
+            superblock.superblock.n_bitmapblocks = n_bitmapblocks;
+            setup_bitmap(below, below_ino, n_inodeblocks + 1, n_bitmapblocks,
+                         n_inodeblocks + 1 + n_bitmapblocks, nblocks);
+        }
+        else {
+            superblock.superblock.free_list =
+                setup_freelist(below, below_ino, n_inodeblocks + 1, nblocks);
+        }
         if ((*below->write)(below, below_ino, 0, (block_t *) &superblock) < 0)
             return -1;
 
@@ -29,18 +29,26 @@
  * block indices, the first of which is either 0 to indicate the end of
  * the list, or otherwise a pointer to the next block on the list.  The
  * remaining slots point to free blocks, or 0 if the slot is empty.
+ *
+ * Alternatively, chosen when the file system is created, free space is
+ * kept in a bitmap which follows the inode blocks; bit b of the bitmap
+ * is set if block b is in use, including the metadata blocks.
  */
 #pragma once
 #include "inode.h"
 
 #define REFS_PER_BLOCK    (BLOCK_SIZE / sizeof(block_no))
 #define INODES_PER_BLOCK  (BLOCK_SIZE / sizeof(struct treedisk_inode))
+#define BITS_PER_BLOCK    (BLOCK_SIZE * 8)
+#define WORDS_PER_BLOCK   (BLOCK_SIZE / sizeof(unsigned int))
 
 /* Contents of the "superblock".  There is only one of these.
  */
 struct treedisk_superblock {
     block_no n_inodeblocks;		/* # blocks with inodes */
     block_no free_list;			/* pointer to first block on free list */
+    block_no bitmap;			/* first bitmap block, 0 if the free list is used */
+    block_no n_bitmapblocks;		/* # blocks of the bitmap */
 };
 
 /* An inode describes a file (= virtual inode store).  "nblocks" contains
@@ -68,6 +76,12 @@ struct treedisk_freelistblock {
     block_no refs[REFS_PER_BLOCK];
 };
 
+/* A bitmap block holds the bits of BITS_PER_BLOCK blocks, 32 per word.
+ */
+struct treedisk_bitmapblock {
+    unsigned int words[WORDS_PER_BLOCK];
+};
+
 /* An indirect block is an internal node in the tree rooted at an inode.
  */
 struct treedisk_indirblock {
@@ -82,5 +96,6 @@ union treedisk_block {
     struct treedisk_superblock superblock;
     struct treedisk_inodeblock inodeblock;
     struct treedisk_freelistblock freelistblock;
+    struct treedisk_bitmapblock bitmapblock;
     struct treedisk_indirblock indirblock;
 };
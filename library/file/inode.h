@@ -52,4 +52,26 @@ typedef inode_store_t *inode_intf;    /* inode store interface */
 
 inode_intf fs_disk_init();
 inode_intf treedisk_init(inode_intf below, unsigned int below_ino);
-int treedisk_create(inode_intf below, unsigned int below_ino, unsigned int ninodes);
\ No newline at end of file
+/* Free space of a new treedisk is tracked by a free list or a bitmap */
+#define TREEDISK_FREE_LIST    0
+#define TREEDISK_FREE_BITMAP  1
+int treedisk_create(inode_intf below, unsigned int below_ino, unsigned int ninodes, int free_space);
+
+/* A run of contiguous blocks in the inode store below a treedisk */
+struct treedisk_extent {
+    block_no start;                     /* 0 for a hole */
+    block_no nblocks;
+};
+
+int treedisk_reserve(inode_intf bs, unsigned int ino, block_no nblocks);
+int treedisk_extents(inode_intf bs, unsigned int ino, block_no offset, block_no nblocks,
+                     struct treedisk_extent *runs, int nruns);
+
+/* Block cache counters, see library/file/cache.c */
+struct cache_stats {
+    unsigned int hits, misses, evictions, writebacks;
+};
+
+inode_intf cachedisk_init(inode_intf below, unsigned int nblocks);
+int cachedisk_sync(inode_intf bs);
+int cachedisk_stats(inode_intf bs, struct cache_stats *stats);
\ No newline at end of file
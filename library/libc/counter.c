@@ -0,0 +1,62 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: the performance counter registry
+ * earth keeps the registry and probes the hardware counters, see
+ * earth/cpu_counter.c; every layer and app registers and bumps its
+ * counters here, so `stat` shows them all in one place.  The hardware
+ * counters are read through the unprivileged CSRs, which earth opens
+ * to grass and the user apps with mcounteren and scounteren.
+ */
+
+#include "counter.h"
+#include "spinlock.h"
+#include <string.h>
+
+static char* hw_names[NCOUNTERS_HW] = {"cycle", "instret", "hpm3", "hpm4", "hpm5", "hpm6"};
+
+unsigned int* counter(const char* name) {
+    struct counter_registry* reg = earth->counters;
+    if (!reg) return NULL;
+
+    struct spinlock* lock = (void*)&reg->lock;
+    spin_lock(lock);
+    int i;
+    for (i = 0; i < reg->ncounters; i++)
+        if (!strncmp(reg->counters[i].name, name, COUNTER_NAME_LEN)) break;
+    if (i == reg->ncounters && i < NCOUNTERS) {
+        strncpy(reg->counters[i].name, name, COUNTER_NAME_LEN);
+        reg->counters[i].name[COUNTER_NAME_LEN - 1] = 0;
+        reg->counters[i].value = 0;
+        reg->ncounters++;
+    }
+    spin_unlock(lock);
+    return i < NCOUNTERS? &reg->counters[i].value : NULL;
+}
+
+static unsigned int hw_read(int idx) {
+    unsigned int val = 0;
+    switch (idx) {
+    case 0: asm volatile("csrr %0, cycle" : "=r"(val)); break;
+    case 1: asm volatile("csrr %0, instret" : "=r"(val)); break;
+    case 2: asm volatile("csrr %0, hpmcounter3" : "=r"(val)); break;
+    case 3: asm volatile("csrr %0, hpmcounter4" : "=r"(val)); break;
+    case 4: asm volatile("csrr %0, hpmcounter5" : "=r"(val)); break;
+    case 5: asm volatile("csrr %0, hpmcounter6" : "=r"(val)); break;
+    }
+    return val;
+}
+
+unsigned int counter_hw(int idx) {
+    return hw_read(idx) - earth->counters->hw_base[idx];
+}
+
+const char* counter_hw_name(int idx) { return hw_names[idx]; }
+
+void counter_reset() {
+    struct counter_registry* reg = earth->counters;
+    for (int i = 0; i < reg->ncounters; i++) reg->counters[i].value = 0;
+    for (int i = 0; i < reg->nhw; i++) reg->hw_base[i] = hw_read(i);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "egos.h"
+
+/* Named event counters in the registry of earth->counters; a counter is
+ * registered by its first use and keeps its slot until the reboot */
+unsigned int* counter(const char* name);   /* NULL if the registry is full */
+void counter_reset();                      /* zero every counter */
+
+/* Hardware counter idx < earth->counters->nhw, since the last reset */
+unsigned int counter_hw(int idx);
+const char* counter_hw_name(int idx);
+
+/* Add n to the counter name, a string literal; the slot is looked up
+ * once per layer or app, and the addition is not atomic across harts */
+#define COUNT(name, n) do {                                         \
+        static unsigned int* _counter;                              \
+        if (!_counter) _counter = counter(name);                    \
+        if (_counter) *_counter += (n);                             \
+    } while (0)
@@ -0,0 +1,110 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: string formatting for printf() in the apps
+ * earth->tty_printf() formats with newlib and prints to the tty right
+ * away, so the apps format into a buffer with vformat() instead when
+ * the output may go to a pipe, see stdout_write() in servers.c.
+ */
+
+#include "format.h"
+
+struct out {
+    char *buf;
+    int size, len;
+};
+
+static void out_char(struct out* o, char c) {
+    if (o->len < o->size - 1) o->buf[o->len] = c;
+    o->len++;
+}
+
+/* Put the nchars bytes at s, padded to width with pad on the left or,
+ * with left, with spaces on the right */
+static void out_field(struct out* o, const char* s, int nchars,
+                      int width, int left, char pad) {
+    if (!left) for (int i = nchars; i < width; i++) out_char(o, pad);
+    for (int i = 0; i < nchars; i++) out_char(o, s[i]);
+    if (left) for (int i = nchars; i < width; i++) out_char(o, ' ');
+}
+
+static void out_number(struct out* o, unsigned int n, int base, int negative,
+                       int width, int precision, int left, char pad, int upper) {
+    const char* digits = upper? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[16];
+    int len = 0;
+    do {
+        tmp[sizeof(tmp) - 1 - len++] = digits[n % base];
+        n /= base;
+    } while (n);
+    while (len < precision && len < sizeof(tmp) - 1) tmp[sizeof(tmp) - 1 - len++] = '0';
+    if (negative) tmp[sizeof(tmp) - 1 - len++] = '-';
+
+    /* A zero-padded negative number keeps its sign in front */
+    if (negative && pad == '0' && !left) {
+        out_char(o, '-');
+        out_field(o, tmp + sizeof(tmp) - len + 1, len - 1, width - 1, 0, '0');
+    } else {
+        out_field(o, tmp + sizeof(tmp) - len, len, width, left, pad);
+    }
+}
+
+int vformat(char* buf, int size, const char* format, va_list args) {
+    struct out o = { buf, size, 0 };
+    for (const char* f = format; *f; f++) {
+        if (*f != '%') {
+            out_char(&o, *f);
+            continue;
+        }
+
+        int left = 0, width = 0, precision = -1;
+        char pad = ' ';
+        for (f++; *f == '-' || *f == '0'; f++)
+            if (*f == '-') left = 1;
+            else pad = '0';
+        for (; *f >= '0' && *f <= '9'; f++) width = width * 10 + *f - '0';
+        if (*f == '.')
+            for (precision = 0, f++; *f >= '0' && *f <= '9'; f++)
+                precision = precision * 10 + *f - '0';
+        while (*f == 'l' || *f == 'h') f++;
+        if (precision >= 0) pad = ' ';  /* as in C, the precision overrides '0' */
+
+        char c;
+        const char* s;
+        int n, len;
+        switch (*f) {
+        case 'd':
+        case 'i':
+            n = va_arg(args, int);
+            out_number(&o, n < 0? -(unsigned int)n : n, 10, n < 0, width, precision, left, pad, 0);
+            break;
+        case 'u':
+            out_number(&o, va_arg(args, unsigned int), 10, 0, width, precision, left, pad, 0);
+            break;
+        case 'p':
+        case 'x':
+        case 'X':
+            out_number(&o, va_arg(args, unsigned int), 16, 0, width, precision, left, pad, *f == 'X');
+            break;
+        case 'c':
+            c = va_arg(args, int);
+            out_field(&o, &c, 1, width, left, ' ');
+            break;
+        case 's':
+            if (!(s = va_arg(args, const char*))) s = "(null)";
+            for (len = 0; s[len] && (precision < 0 || len < precision); len++);
+            out_field(&o, s, len, width, left, ' ');
+            break;
+        case 0:
+            f--;  /* a lone '%' ends the format */
+            break;
+        default:
+            out_char(&o, *f);
+        }
+    }
+
+    if (size > 0) buf[o.len < size? o.len : size - 1] = 0;
+    return o.len < size? o.len : size - 1;
+}
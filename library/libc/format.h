@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdarg.h>
+
+/* A small vsnprintf() for the apps, which cannot afford the one of newlib
+ * in their 12KB; it knows the flags '-' and '0', a width, a precision and
+ * the conversions d, i, u, x, X, p, c, s and %, and returns the length of
+ * the string in buf, which is truncated to size - 1 bytes */
+int vformat(char* buf, int size, const char* format, va_list args);
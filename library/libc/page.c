@@ -0,0 +1,74 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: whole-page copy, zero and compare
+ * newlib's memcpy(), memset() and memcmp() handle any length and
+ * alignment, and on rv32i they spend much of a 4KB page in the byte
+ * loops around the word loop.  These routines know the length and the
+ * alignment, so they move 32 bytes per iteration with lw/sw only.
+ */
+
+#include "egos.h"
+#include "page.h"
+
+void page_copy(void* dst, const void* src) {
+    const char* end = (const char*)src + PAGE_SIZE;
+    asm volatile("1:\n\t"
+                 "lw t0, 0(%1)\n\t"  "lw t1, 4(%1)\n\t"
+                 "lw t2, 8(%1)\n\t"  "lw t3, 12(%1)\n\t"
+                 "lw t4, 16(%1)\n\t" "lw t5, 20(%1)\n\t"
+                 "lw a6, 24(%1)\n\t" "lw a7, 28(%1)\n\t"
+                 "sw t0, 0(%0)\n\t"  "sw t1, 4(%0)\n\t"
+                 "sw t2, 8(%0)\n\t"  "sw t3, 12(%0)\n\t"
+                 "sw t4, 16(%0)\n\t" "sw t5, 20(%0)\n\t"
+                 "sw a6, 24(%0)\n\t" "sw a7, 28(%0)\n\t"
+                 "addi %0, %0, 32\n\t"
+                 "addi %1, %1, 32\n\t"
+                 "bltu %1, %2, 1b"
+                 : "+r"(dst), "+r"(src)
+                 : "r"(end)
+                 : "t0", "t1", "t2", "t3", "t4", "t5", "a6", "a7", "memory");
+}
+
+void page_zero(void* dst) {
+    char* end = (char*)dst + PAGE_SIZE;
+    asm volatile("1:\n\t"
+                 "sw zero, 0(%0)\n\t"  "sw zero, 4(%0)\n\t"
+                 "sw zero, 8(%0)\n\t"  "sw zero, 12(%0)\n\t"
+                 "sw zero, 16(%0)\n\t" "sw zero, 20(%0)\n\t"
+                 "sw zero, 24(%0)\n\t" "sw zero, 28(%0)\n\t"
+                 "addi %0, %0, 32\n\t"
+                 "bltu %0, %1, 1b"
+                 : "+r"(dst)
+                 : "r"(end)
+                 : "memory");
+}
+
+/* Return 1 if the two pages hold the same bytes and 0 otherwise */
+int page_equal(const void* a, const void* b) {
+    const char* end = (const char*)a + PAGE_SIZE;
+    int diff;
+    asm volatile("1:\n\t"
+                 "lw t0, 0(%1)\n\t"  "lw t1, 0(%2)\n\t"
+                 "lw t2, 4(%1)\n\t"  "lw t3, 4(%2)\n\t"
+                 "lw t4, 8(%1)\n\t"  "lw t5, 8(%2)\n\t"
+                 "lw a6, 12(%1)\n\t" "lw a7, 12(%2)\n\t"
+                 "xor t0, t0, t1\n\t"
+                 "xor t2, t2, t3\n\t"
+                 "xor t4, t4, t5\n\t"
+                 "xor a6, a6, a7\n\t"
+                 "or t0, t0, t2\n\t"
+                 "or t4, t4, a6\n\t"
+                 "or %0, t0, t4\n\t"
+                 "bnez %0, 2f\n\t"
+                 "addi %1, %1, 16\n\t"
+                 "addi %2, %2, 16\n\t"
+                 "bltu %1, %3, 1b\n"
+                 "2:"
+                 : "=&r"(diff), "+r"(a), "+r"(b)
+                 : "r"(end)
+                 : "t0", "t1", "t2", "t3", "t4", "t5", "a6", "a7", "memory");
+    return diff == 0;
+}
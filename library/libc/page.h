@@ -0,0 +1,7 @@
+#pragma once
+
+/* Copy, zero and compare one PAGE_SIZE page; every pointer must be
+ * word-aligned, which holds for pages, frames and page tables */
+void page_copy(void* dst, const void* src);
+void page_zero(void* dst);
+int page_equal(const void* a, const void* b);
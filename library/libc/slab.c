@@ -0,0 +1,62 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: a slab allocator for fixed-size objects
+ * slab_alloc() and slab_free() only push and pop the free list of a
+ * cache, so both take constant time; slabs are never returned to the
+ * heap, but a freed object is reused by the next allocation of the same
+ * size, so the heap does not fragment.
+ */
+
+#include "slab.h"
+#include <stdlib.h>
+
+static struct slab_cache* slab_list;
+
+static int slab_grow(struct slab_cache* cache) {
+    struct slab_stats* s = &cache->stats;
+    if (s->nslabs == 0) {
+        /* Every object holds a free list pointer and stays word-aligned */
+        if (s->size < sizeof(void*)) s->size = sizeof(void*);
+        s->size = (s->size + 3) & ~3;
+        cache->next = slab_list;
+        slab_list = cache;
+    }
+
+    unsigned int nobjs = (s->size < SLAB_BYTES)? SLAB_BYTES / s->size : 1;
+    char* slab = malloc(nobjs * s->size);
+    if (slab == 0) return -1;
+    for (int i = nobjs - 1; i >= 0; i--) {
+        *(void**)(slab + i * s->size) = cache->free;
+        cache->free = slab + i * s->size;
+    }
+    s->nslabs++;
+    s->ntotal += nobjs;
+    return 0;
+}
+
+void* slab_alloc(struct slab_cache* cache) {
+    if (cache->free == 0 && slab_grow(cache) < 0) return 0;
+
+    void* obj = cache->free;
+    cache->free = *(void**)obj;
+    struct slab_stats* s = &cache->stats;
+    s->nallocs++;
+    if (++s->ninuse > s->npeak) s->npeak = s->ninuse;
+    return obj;
+}
+
+void slab_free(struct slab_cache* cache, void* obj) {
+    if (obj == 0) return;
+    *(void**)obj = cache->free;
+    cache->free = obj;
+    cache->stats.nfrees++;
+    cache->stats.ninuse--;
+}
+
+/* Return the cache used after cache, or the first one if cache is NULL */
+struct slab_cache* slab_next(struct slab_cache* cache) {
+    return cache? cache->next : slab_list;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+/* Each cache hands out objects of one fixed size; a slab is a chunk of
+ * SLAB_BYTES (or one object if larger) taken from the heap and split
+ * into objects, and free objects are kept in a singly linked list */
+#define SLAB_BYTES 2048
+
+struct slab_stats {
+    unsigned int size;       /* object size in bytes                 */
+    unsigned int nslabs;     /* slabs taken from the heap            */
+    unsigned int ntotal;     /* objects carved out of those slabs    */
+    unsigned int ninuse;     /* objects currently allocated          */
+    unsigned int npeak;      /* largest ninuse so far                */
+    unsigned int nallocs;    /* calls to slab_alloc()                */
+    unsigned int nfrees;     /* calls to slab_free()                 */
+};
+
+struct slab_cache {
+    const char* name;
+    void* free;              /* free list, linked through the objects */
+    struct slab_cache* next; /* registry of caches used at least once */
+    struct slab_stats stats;
+};
+
+#define SLAB_CACHE(name, size) { name, 0, 0, { size } }
+
+void* slab_alloc(struct slab_cache* cache);  /* NULL if the heap is full */
+void slab_free(struct slab_cache* cache, void* obj);
+struct slab_cache* slab_next(struct slab_cache* cache);
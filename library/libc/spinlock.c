@@ -0,0 +1,31 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: spinlocks for multiple harts
+ * The lock is taken with amoswap.w.aq from the A extension, spelled with
+ * .insn since rv32i toolchains reject the mnemonic, and released with a
+ * fence followed by a plain store.
+ */
+
+#include "egos.h"
+#include "spinlock.h"
+
+void spin_lock(struct spinlock* lock) {
+#if NHARTS > 1
+    int busy;
+    do {
+        /* amoswap.w.aq busy, one, (lock) */
+        asm volatile(".insn r 0x2f, 2, 0x6, %0, %1, %2"
+                     : "=r"(busy) : "r"(&lock->locked), "r"(1) : "memory");
+    } while (busy);
+#endif
+}
+
+void spin_unlock(struct spinlock* lock) {
+#if NHARTS > 1
+    asm volatile("fence rw, w" ::: "memory");
+    lock->locked = 0;
+#endif
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+/* A test-and-set lock for state shared by the harts, see NHARTS in
+ * egos.h; with a single hart the kernel runs with interrupts masked, so
+ * nothing can contend and both operations do nothing */
+struct spinlock {
+    volatile int locked;
+};
+
+void spin_lock(struct spinlock* lock);
+void spin_unlock(struct spinlock* lock);
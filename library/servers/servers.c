@@ -10,9 +10,10 @@
 
 #include "egos.h"
 #include "servers.h"
+#include "format.h"
+#include "counter.h"
 #include <string.h>
 
-static int sender;
 static char buf[SYSCALL_MSG_LEN];
 
 void exit(int status) {
@@ -20,18 +21,144 @@ void exit(int status) {
     while(1);
 }
 
+int stdout_write(char* buf, int len) {
+    /* Write to the pipe of a pipeline if this process feeds one, and to
+     * the tty otherwise; once the reader of the pipe is gone, exit as
+     * the output has nowhere to go */
+    static int piped = 1;
+    if (len <= 0) return 0;
+    if (piped) {
+        int ret = grass->sys_pipe_write(buf, len);
+        if (ret > 0) return ret;
+        if (ret == 0) exit(0);
+        piped = 0;
+    }
+    return earth->tty_write(buf, len);
+}
+
+int app_printf(const char* format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vformat(buf, sizeof(buf), format, args);
+    va_end(args);
+    return stdout_write(buf, len);
+}
+
+int proc_info(struct proc_info_reply* reply) {
+    struct proc_request req;
+    req.type = PROC_INFO;
+    if (grass->sys_call(GPID_PROCESS, (void*)&req, sizeof(req.type), (void*)reply, sizeof(*reply)) < 0)
+        return -1;
+    return 0;
+}
+
+int proc_prof(int cmd, struct prof_reply* reply) {
+    struct proc_request req;
+    req.type = PROC_PROF;
+    req.argc = cmd;
+    if (grass->sys_call(GPID_PROCESS, (void*)&req, 2 * sizeof(int), (void*)reply, sizeof(*reply)) < 0)
+        return -1;
+    return 0;
+}
+
+/* Copy up to n events from the kernel trace, as trace_read() of grass,
+ * through GPID_PROCESS; return the number of events copied, or -1 */
+int proc_trace(unsigned int* seq, struct trace_event* buf, int n) {
+    struct proc_request req;
+    struct trace_reply reply;
+    req.type = PROC_TRACE;
+    req.argc = *seq;
+    if (grass->sys_call(GPID_PROCESS, (void*)&req, 2 * sizeof(int), (void*)&reply, sizeof(reply)) < 0)
+        return -1;
+
+    if (n > reply.nevents) n = reply.nevents;
+    memcpy(buf, reply.events, n * sizeof(struct trace_event));
+    *seq = reply.seq - (reply.nevents - n);
+    return n;
+}
+
+int proc_spawn(int argc, char** argv) {
+    /* Run argv[0] from /bin and return its pid, or -1; unless the last
+     * argument is "&", wait until the new process exits */
+    struct proc_request req;
+    struct proc_reply reply;
+    if (argc <= 0 || argc > CMD_NARGS) return -1;
+    req.type = PROC_SPAWN;
+    req.argc = argc;
+    for (int i = 0; i < argc; i++) {
+        strncpy(req.argv[i], argv[i], CMD_ARG_LEN);
+        req.argv[i][CMD_ARG_LEN - 1] = 0;
+    }
+    if (grass->sys_call(GPID_PROCESS, (void*)&req, sizeof(req), (void*)&reply, sizeof(reply)) < 0 ||
+        reply.type != CMD_OK)
+        return -1;
+
+    int pid = reply.pid, sender = 0;
+    if (argv[argc - 1][0] != '&')
+        while (sender != GPID_PROCESS) grass->sys_recv(&sender, (void*)&reply, sizeof(reply));
+    return pid;
+}
+
+/* A direct-mapped cache of (dir_ino, name) -> ino, including failed
+ * lookups; entries from an older grass->dir_generation are stale */
+#define DCACHE_SIZE 8
+static struct {
+    int valid, dir_ino, ino;
+    unsigned int generation;
+    char name[DIR_NAME_SIZE];
+} dcache[DCACHE_SIZE];
+
 int dir_lookup(int dir_ino, char* name) {
+    int i = (dir_hash(name) + dir_ino) % DCACHE_SIZE;
+    if (dcache[i].valid && dcache[i].generation == grass->dir_generation &&
+        dcache[i].dir_ino == dir_ino && !strncmp(dcache[i].name, name, DIR_NAME_SIZE)) {
+        COUNT("dcache.hit", 1);
+        return dcache[i].ino;
+    }
+    COUNT("dcache.miss", 1);
+
+    /* Read the generation first so that a concurrent update is not missed */
+    unsigned int generation = grass->dir_generation;
     struct dir_request req;
     req.type = DIR_LOOKUP;
     req.ino = dir_ino;
     strcpy(req.name, name);
-    grass->sys_send(GPID_DIR, (void*)&req, sizeof(req));
+    if (grass->sys_call(GPID_DIR, (void*)&req, sizeof(req), buf, SYSCALL_MSG_LEN) < 0)
+        FATAL("dir_lookup: an error occurred");
+    struct dir_reply *reply = (void*)buf;
 
-    grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
-    if (sender != GPID_DIR) FATAL("dir_lookup: an error occurred");
+    int ino = reply->status == DIR_OK? reply->ino : -1;
+    if (strlen(name) < DIR_NAME_SIZE) {
+        dcache[i].valid = 1;
+        dcache[i].generation = generation;
+        dcache[i].dir_ino = dir_ino;
+        dcache[i].ino = ino;
+        strcpy(dcache[i].name, name);
+    }
+    return ino;
+}
+
+static int dir_update(int type, int dir_ino, char* name, int ino) {
+    struct dir_request req;
+    req.type = type;
+    req.ino = dir_ino;
+    req.entry_ino = ino;
+    strncpy(req.name, name, DIR_NAME_SIZE);
+    req.name[DIR_NAME_SIZE - 1] = 0;
+    if (grass->sys_call(GPID_DIR, (void*)&req, sizeof(req), buf, SYSCALL_MSG_LEN) < 0)
+        FATAL("dir_update: an error occurred");
     struct dir_reply *reply = (void*)buf;
 
-    return reply->status == DIR_OK? reply->ino : -1;
+    return reply->status == DIR_OK? 0 : -1;
+}
+
+int dir_insert(int dir_ino, char* name, int ino) {
+    return dir_update(DIR_INSERT, dir_ino, name, ino);
+}
+
+int dir_remove(int dir_ino, char* name) {
+    return dir_update(DIR_REMOVE, dir_ino, name, 0);
 }
 
 int file_read(int file_ino, int offset, char* block) {
@@ -39,12 +166,66 @@ int file_read(int file_ino, int offset, char* block) {
     req.type = FILE_READ;
     req.ino = file_ino;
     req.offset = offset;
-    grass->sys_send(GPID_FILE, (void*)&req, sizeof(req));
+    if (grass->sys_call(GPID_FILE, (void*)&req, sizeof(req), buf, SYSCALL_MSG_LEN) < 0)
+        FATAL("file_read: an error occurred");
+    struct file_reply *reply = (void*)buf;
+    memcpy(block, reply->block[0].bytes, BLOCK_SIZE);
+
+    return reply->status == FILE_OK? 0 : -1;
+}
+
+int file_read_range(int file_ino, int offset, int nblocks, char* dst) {
+    /* Each round-trip returns up to FILE_RANGE_NBLOCKS contiguous blocks;
+     * return the number of blocks read, or -1 if none could be read */
+    int nread = 0;
+    while (nread < nblocks) {
+        struct file_request req;
+        req.type = FILE_READ_RANGE;
+        req.ino = file_ino;
+        req.offset = offset + nread;
+        req.nblocks = nblocks - nread;
+        if (grass->sys_call(GPID_FILE, (void*)&req, sizeof(req), buf, SYSCALL_MSG_LEN) < 0)
+            FATAL("file_read_range: an error occurred");
+        struct file_reply *reply = (void*)buf;
+        if (reply->status != FILE_OK || reply->nblocks == 0) break;
 
-    grass->sys_recv(&sender, buf, SYSCALL_MSG_LEN);
-    if (sender != GPID_FILE) FATAL("file_read: an error occurred");
+        memcpy(dst + nread * BLOCK_SIZE, reply->block, reply->nblocks * BLOCK_SIZE);
+        nread += reply->nblocks;
+    }
+
+    return nread? nread : -1;
+}
+
+int file_write_range(int file_ino, int offset, int nblocks, char* src) {
+    /* Return 0 if all nblocks blocks were written, or -1 otherwise */
+    for (int nwritten = 0; nwritten < nblocks; ) {
+        struct file_request req;
+        req.type = FILE_WRITE_RANGE;
+        req.ino = file_ino;
+        req.offset = offset + nwritten;
+        req.nblocks = nblocks - nwritten;
+        if (req.nblocks > FILE_RANGE_NBLOCKS) req.nblocks = FILE_RANGE_NBLOCKS;
+        memcpy(req.block, src + nwritten * BLOCK_SIZE, req.nblocks * BLOCK_SIZE);
+        if (grass->sys_call(GPID_FILE, (void*)&req, sizeof(req), buf, SYSCALL_MSG_LEN) < 0)
+            FATAL("file_write_range: an error occurred");
+        struct file_reply *reply = (void*)buf;
+        if (reply->status != FILE_OK) return -1;
+        nwritten += req.nblocks;
+    }
+
+    return 0;
+}
+
+int file_write(int file_ino, int offset, char* block) {
+    return file_write_range(file_ino, offset, 1, block);
+}
+
+int file_sync() {
+    struct file_request req;
+    req.type = FILE_SYNC;
+    if (grass->sys_call(GPID_FILE, (void*)&req, sizeof(req), buf, SYSCALL_MSG_LEN) < 0)
+        FATAL("file_sync: an error occurred");
     struct file_reply *reply = (void*)buf;
-    memcpy(block, reply->block.bytes, BLOCK_SIZE);
 
     return reply->status == FILE_OK? 0 : -1;
 }
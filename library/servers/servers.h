@@ -1,11 +1,27 @@
 #pragma once
 
 #include "inode.h"
-#define SYSCALL_MSG_LEN    1024
+#define FILE_RANGE_NBLOCKS 2     /* blocks per FILE_READ_RANGE reply    */
+#define SYSCALL_MSG_LEN    1088  /* FILE_RANGE_NBLOCKS blocks + headers */
 
+struct proc_info_reply;
+struct prof_reply;
+struct trace_event;
 void exit(int status);
+int stdout_write(char* buf, int len);
+int app_printf(const char* format, ...);
 int dir_lookup(int dir_ino, char* name);
 int file_read(int file_ino, int offset, char* block);
+int file_read_range(int file_ino, int offset, int nblocks, char* dst);
+int file_write(int file_ino, int offset, char* block);
+int file_write_range(int file_ino, int offset, int nblocks, char* src);
+int file_sync();
+int dir_insert(int dir_ino, char* name, int ino);
+int dir_remove(int dir_ino, char* name);
+int proc_info(struct proc_info_reply* reply);
+int proc_prof(int cmd, struct prof_reply* reply);
+int proc_trace(unsigned int* seq, struct trace_event* buf, int n);
+int proc_spawn(int argc, char** argv);
 
 enum grass_servers {
     GPID_UNUSED,
@@ -23,7 +39,11 @@ struct proc_request {
     enum {
           PROC_SPAWN,
           PROC_EXIT,
-          PROC_KILLALL
+          PROC_KILLALL,
+          PROC_INFO,
+          PROC_PROF,    /* argc holds the enum prof_cmd */
+          PROC_TRACE,   /* argc holds the number of the first event */
+          PROC_NULL     /* reply at once, for measuring IPC */
     } type;
     int argc;
     char argv[CMD_NARGS][CMD_ARG_LEN];
@@ -34,6 +54,54 @@ struct proc_reply {
           CMD_OK,
           CMD_ERROR
     } type;
+    int pid;                            /* of the spawned process */
+};
+
+/* Per-process CPU and IPC counters kept by the kernel; times are in
+ * mtime ticks and wrap around, so only differences are meaningful */
+struct proc_info {
+    int pid, status;
+    unsigned int runtime;               /* running on the CPU */
+    unsigned int blocked;               /* waiting to send or receive */
+    unsigned int nvoluntary;            /* switches in system calls */
+    unsigned int ninvoluntary;          /* preemptions by the timer */
+    unsigned int nsent, nrecv;          /* messages */
+};
+
+/* Reply to PROC_INFO */
+#define PROC_INFO_MAX   16
+struct proc_info_reply {
+    int nprocs;
+    unsigned int idle;                  /* mtime ticks with nothing to run */
+    struct proc_info procs[PROC_INFO_MAX];
+};
+
+/* Reply to PROC_PROF, see grass/prof.c */
+#define PROF_NSAMPLES   32
+enum prof_cmd { PROF_START, PROF_STOP, PROF_DUMP };
+struct prof_sample {
+    int pid;
+    unsigned int pc;                    /* mepc at the timer interrupt */
+    unsigned int count;
+};
+struct prof_reply {
+    int running;
+    unsigned int nsamples;              /* all samples taken */
+    unsigned int dropped;               /* samples which found no free slot */
+    struct prof_sample samples[PROF_NSAMPLES];
+};
+
+/* Reply to PROC_TRACE, see grass/trace.c and enum trace_type in egos.h */
+#define TRACE_NREAD     16
+struct trace_event {
+    unsigned int time;                  /* low 32 bits of mtime */
+    unsigned short pid, arg;            /* pids are not bounded by the slots */
+    unsigned char type;
+};
+struct trace_reply {
+    unsigned int seq;                   /* number of the next event */
+    int nevents;
+    struct trace_event events[TRACE_NREAD];
 };
 
 /* GPID_FILE */
@@ -42,15 +110,20 @@ struct file_request {
           FILE_UNUSED,
           FILE_READ,
           FILE_WRITE,
+          FILE_READ_RANGE,
+          FILE_WRITE_RANGE,
+          FILE_SYNC
     } type;
     unsigned int ino;
     unsigned int offset;
-    block_t block;
+    unsigned int nblocks;   /* number of blocks for FILE_*_RANGE */
+    block_t block[FILE_RANGE_NBLOCKS];
 };
 
 struct file_reply {
     enum file_status { FILE_OK, FILE_ERROR } status;
-    block_t block;
+    unsigned int nblocks;   /* number of blocks in the reply */
+    block_t block[FILE_RANGE_NBLOCKS];
 };
 
 
@@ -64,6 +137,7 @@ struct dir_request {
           DIR_REMOVE
     } type;
     int ino;
+    int entry_ino;          /* inode of the new entry for DIR_INSERT */
     char name[DIR_NAME_SIZE];
 };
 
@@ -71,3 +145,39 @@ struct dir_reply {
     enum dir_status { DIR_OK, DIR_ERROR } status;
     int ino;
 };
+
+/* Hashed directory format (see tools/mkfs.c)
+ * A directory is an open-addressing hash table of fixed-size entries
+ * spanning one or more blocks; slot 0 of block 0 holds the header and
+ * the other slots are probed linearly from dir_hash(name) */
+#define DIR_MAGIC              0x52494445  /* "EDIR" */
+#define DIR_ENTRY_NAME_SIZE    24
+#define DIR_HASH_EMPTY         0
+#define DIR_HASH_REMOVED       1
+
+struct dir_entry {
+    unsigned int hash;      /* DIR_HASH_EMPTY, DIR_HASH_REMOVED or a name hash */
+    int ino;
+    char name[DIR_ENTRY_NAME_SIZE];
+};
+
+struct dir_header {
+    unsigned int magic;
+    unsigned int nblocks;   /* number of blocks in the hash table */
+    char unused[sizeof(struct dir_entry) - 8];
+};
+
+#define DIR_ENTRIES_PER_BLOCK  (BLOCK_SIZE / sizeof(struct dir_entry))
+#define DIR_NSLOTS(nblocks)    ((nblocks) * DIR_ENTRIES_PER_BLOCK)
+
+/* FNV-1a; values 0 and 1 are reserved for empty and removed slots */
+static inline unsigned int dir_hash(char* name) {
+    unsigned int hash = 2166136261u;
+    while (*name) hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    return hash > DIR_HASH_REMOVED? hash : hash + 2;
+}
+
+/* The first slot to probe for hash; slot 0 is the header */
+static inline int dir_slot(unsigned int hash, int nblocks) {
+    return 1 + hash % (DIR_NSLOTS(nblocks) - 1);
+}
@@ -0,0 +1,250 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: cooperative user-level threads and semaphores
+ * Runnable threads wait in one FIFO ready queue and blocked threads in
+ * the FIFO queue of a semaphore, a joiner or the receivers, so yielding,
+ * blocking and waking up take constant time.  The stacks of exited
+ * threads are kept in a pool and reused by thread_create().
+ *
+ * A thread calling thread_recv() while siblings are runnable parks in
+ * the receiver queue instead of blocking the whole process in sys_recv;
+ * thread_yield() polls for messages on its behalf, and only when no
+ * thread can run does the process block in sys_recv.  A process can
+ * thus serve several clients at once, with one thread per request.
+ */
+
+#include "egos.h"
+#include "thread.h"
+#include "slab.h"
+#include <stdlib.h>
+
+enum thread_state { THREAD_NEW, THREAD_RUNNING, THREAD_BLOCKED, THREAD_DONE };
+
+struct thread {
+    void* sp;                    /* saved by thread_ctx_switch()      */
+    char* stack;                 /* NULL for the thread running main  */
+    unsigned int stack_size;
+    enum thread_state state;
+    void (*func)(void*);
+    void* arg;
+    struct thread* next;         /* link in the queue it waits in     */
+    struct thread* joiner;       /* waits in thread_join() for this   */
+
+    int* recv_sender;            /* arguments of a parked thread_recv */
+    char* recv_buf;
+    int recv_size, recv_len;
+};
+
+/* A pooled stack starts with this header */
+struct stack {
+    struct stack* next;
+    unsigned int size;
+};
+
+static struct slab_cache slab_threads = SLAB_CACHE("thread", sizeof(struct thread));
+static struct thread main_thread, *curr;
+static struct thread_queue ready, receivers;
+static struct stack* stack_pool;
+static unsigned int default_stack_size = THREAD_STACK_SIZE;
+
+/* Save the callee-saved registers on the current stack and switch to
+ * new_sp; thread_ctx_start() then calls thread_entry() on a new stack */
+void thread_ctx_start(void** old_sp, void* new_sp);
+void thread_ctx_switch(void** old_sp, void* new_sp);
+asm(".section .text.thread_ctx,\"ax\",@progbits\n"
+    ".global thread_ctx_start, thread_ctx_switch\n"
+    "thread_ctx_save:\n\t"
+    "sw s0,4(sp)\n\t"   "sw s1,8(sp)\n\t"   "sw s2,12(sp)\n\t"  "sw s3,16(sp)\n\t"
+    "sw s4,20(sp)\n\t"  "sw s5,24(sp)\n\t"  "sw s6,28(sp)\n\t"  "sw s7,32(sp)\n\t"
+    "sw s8,36(sp)\n\t"  "sw s9,40(sp)\n\t"  "sw s10,44(sp)\n\t" "sw s11,48(sp)\n\t"
+    "sw ra,52(sp)\n\t"
+    "sw sp,0(a0)\n\t"
+    "mv sp,a1\n\t"
+    "jr t0\n"
+    "thread_ctx_start:\n\t"
+    "addi sp,sp,-64\n\t"
+    "jal t0,thread_ctx_save\n\t"
+    "call thread_entry\n"
+    "thread_ctx_switch:\n\t"
+    "addi sp,sp,-64\n\t"
+    "jal t0,thread_ctx_save\n\t"
+    "lw s0,4(sp)\n\t"   "lw s1,8(sp)\n\t"   "lw s2,12(sp)\n\t"  "lw s3,16(sp)\n\t"
+    "lw s4,20(sp)\n\t"  "lw s5,24(sp)\n\t"  "lw s6,28(sp)\n\t"  "lw s7,32(sp)\n\t"
+    "lw s8,36(sp)\n\t"  "lw s9,40(sp)\n\t"  "lw s10,44(sp)\n\t" "lw s11,48(sp)\n\t"
+    "lw ra,52(sp)\n\t"
+    "addi sp,sp,64\n\t"
+    "ret\n"
+    ".text\n");
+
+static void queue_push(struct thread_queue* q, struct thread* t) {
+    t->next = NULL;
+    if (q->tail) q->tail->next = t;
+    else q->head = t;
+    q->tail = t;
+}
+
+static struct thread* queue_pop(struct thread_queue* q) {
+    struct thread* t = q->head;
+    if (t && !(q->head = t->next)) q->tail = NULL;
+    return t;
+}
+
+/* Hand a message to the first parked receiver; with block, wait for the
+ * message in sys_recv, which stops every thread of this process */
+static void recv_deliver(int block) {
+    struct thread* t = receivers.head;
+    int len = block? grass->sys_recv(t->recv_sender, t->recv_buf, t->recv_size) :
+                     grass->sys_try_recv(t->recv_sender, t->recv_buf, t->recv_size);
+    if (len < 0) return;
+
+    queue_pop(&receivers);
+    t->recv_len = len;
+    t->state = THREAD_RUNNING;
+    queue_push(&ready, t);
+}
+
+static void thread_switch(struct thread* t) {
+    struct thread* prev = curr;
+    curr = t;
+    if (t->state == THREAD_NEW) {
+        t->state = THREAD_RUNNING;
+        thread_ctx_start(&prev->sp, (void*)((unsigned int)(t->stack + t->stack_size) & ~15));
+    } else {
+        thread_ctx_switch(&prev->sp, t->sp);
+    }
+}
+
+/* Run the next thread; the current one is done or waits in a queue */
+static void thread_schedule() {
+    while (!ready.head) {
+        if (!receivers.head) {
+            if (curr->state == THREAD_DONE) exit(0);
+            FATAL("thread_schedule: all threads are blocked");
+        }
+        recv_deliver(1);
+    }
+
+    struct thread* t = queue_pop(&ready);
+    if (t != curr) thread_switch(t);
+}
+
+void thread_entry() {
+    curr->func(curr->arg);
+    thread_exit();
+}
+
+void thread_init(unsigned int stack_size) {
+    if (stack_size) default_stack_size = stack_size;
+    main_thread.state = THREAD_RUNNING;
+    curr = &main_thread;
+}
+
+struct thread* thread_self() { return curr; }
+
+struct thread* thread_create(void (*f)(void*), void* arg, unsigned int stack_size) {
+    if (!curr) thread_init(0);
+    if (stack_size == 0) stack_size = default_stack_size;
+    stack_size = (stack_size + 15) & ~15;
+
+    struct thread* t = slab_alloc(&slab_threads);
+    if (!t) return NULL;
+
+    /* Reuse the first pooled stack which is large enough */
+    struct stack *s, **link = &stack_pool;
+    while ((s = *link) && s->size < stack_size) link = &s->next;
+    if (s) {
+        *link = s->next;
+        stack_size = s->size;
+    } else if (!(s = malloc(stack_size))) {
+        slab_free(&slab_threads, t);
+        return NULL;
+    }
+
+    t->stack = (char*)s;
+    t->stack_size = stack_size;
+    t->state = THREAD_NEW;
+    t->func = f;
+    t->arg = arg;
+    t->joiner = NULL;
+    queue_push(&ready, t);
+    return t;
+}
+
+void thread_yield() {
+    if (receivers.head) recv_deliver(0);
+    if (!ready.head) return;
+    queue_push(&ready, curr);
+    thread_schedule();
+}
+
+void thread_exit() {
+    /* The stack is only reused after the switch away from it */
+    if (curr->stack) {
+        struct stack* s = (void*)curr->stack;
+        s->size = curr->stack_size;
+        s->next = stack_pool;
+        stack_pool = s;
+    }
+
+    curr->state = THREAD_DONE;
+    if (curr->joiner) {
+        curr->joiner->state = THREAD_RUNNING;
+        queue_push(&ready, curr->joiner);
+    }
+    thread_schedule();
+    FATAL("thread_exit: an exited thread was resumed");
+}
+
+/* Wait until t exits and free it; a thread is joined at most once */
+void thread_join(struct thread* t) {
+    if (t->state != THREAD_DONE) {
+        t->joiner = curr;
+        curr->state = THREAD_BLOCKED;
+        thread_schedule();
+    }
+    if (t != &main_thread) slab_free(&slab_threads, t);
+}
+
+int thread_recv(int* sender, char* buf, int size) {
+    if (!ready.head && !receivers.head) return grass->sys_recv(sender, buf, size);
+
+    int len = grass->sys_try_recv(sender, buf, size);
+    if (len >= 0) return len;
+
+    curr->recv_sender = sender;
+    curr->recv_buf = buf;
+    curr->recv_size = size;
+    curr->state = THREAD_BLOCKED;
+    queue_push(&receivers, curr);
+    thread_schedule();
+    return curr->recv_len;
+}
+
+void sema_init(struct sema* sema, unsigned int count) {
+    sema->count = count;
+    sema->waiters.head = sema->waiters.tail = NULL;
+}
+
+/* A waiter takes the count directly, so it need not check the count again */
+void sema_inc(struct sema* sema) {
+    struct thread* t = queue_pop(&sema->waiters);
+    if (!t) {
+        sema->count++;
+        return;
+    }
+    t->state = THREAD_RUNNING;
+    queue_push(&ready, t);
+}
+
+void sema_dec(struct sema* sema) {
+    if (sema->count > 0) {
+        sema->count--;
+        return;
+    }
+    curr->state = THREAD_BLOCKED;
+    queue_push(&sema->waiters, curr);
+    thread_schedule();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+/* Cooperative user-level threads within one process, see thread.c */
+#define THREAD_STACK_SIZE 2048   /* default stack size in bytes */
+
+struct thread;
+
+struct thread_queue {
+    struct thread *head, *tail;  /* FIFO linked through the threads */
+};
+
+struct sema {
+    int count;
+    struct thread_queue waiters;
+};
+
+void thread_init(unsigned int stack_size);
+struct thread* thread_create(void (*f)(void*), void* arg, unsigned int stack_size);
+struct thread* thread_self();
+void thread_yield();
+void thread_exit();
+void thread_join(struct thread* t);
+
+/* Receive a message, letting the sibling threads run meanwhile */
+int  thread_recv(int* sender, char* buf, int size);
+
+void sema_init(struct sema* sema, unsigned int count);
+void sema_inc(struct sema* sema);
+void sema_dec(struct sema* sema);
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Usage: bench.sh <qemu command line>
+# Boot egos-2000 on QEMU, type the benchmark commands into its shell and
+# print the "BENCH <name> <iterations> <cycles/iteration> <iterations/s>"
+# lines of their output; the whole console output goes to build/bench.log
+BENCHES="bench_ipc bench_fs bench_spawn bench_page"
+BOOT_SECONDS=10
+BENCH_SECONDS=20
+
+mkdir -p build
+{
+    sleep $BOOT_SECONDS
+    for b in $BENCHES; do
+        printf '%s\r' "$b"
+        sleep $BENCH_SECONDS
+    done
+    printf '\001x'  # Ctrl+A x terminates QEMU
+} | "$@" | tr -d '\r' | tee build/bench.log | grep '^BENCH'
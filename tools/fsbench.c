@@ -0,0 +1,239 @@
+/*
+ * (C) 2022, Cornell University
+ * All rights reserved.
+ */
+
+/* Description: benchmark and stress test of the treedisk file system
+ * on the host, without booting QEMU; usage:
+ *     fsbench [-c nblocks] [-s seed] [-n nops]
+ * The file system is created on a RAM inode store which counts the block
+ * reads and writes reaching it, once with a free list and once with a
+ * free bitmap.  With -c, a block cache of nblocks sits between the
+ * treedisk and the RAM store, as in sys_file.  The stress
+ * test runs nops random operations and checks every result against a
+ * reference model of the files.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "disk.h"
+#include "file.h"
+
+char disk[FS_DISK_SIZE];
+unsigned long nreads, nwrites;
+
+int ram_getsize(inode_intf bs, unsigned int ino) { return FS_DISK_SIZE / BLOCK_SIZE; }
+
+int ram_setsize(inode_intf bs, unsigned int ino, block_no nblocks) { return -1; }
+
+int ram_read(inode_intf bs, unsigned int ino, block_no offset, block_t *block) {
+    assert(offset < FS_DISK_SIZE / BLOCK_SIZE);
+    memcpy(block, disk + offset * BLOCK_SIZE, BLOCK_SIZE);
+    nreads++;
+    return 0;
+}
+
+int ram_write(inode_intf bs, unsigned int ino, block_no offset, block_t *block) {
+    assert(offset < FS_DISK_SIZE / BLOCK_SIZE);
+    memcpy(disk + offset * BLOCK_SIZE, block, BLOCK_SIZE);
+    nwrites++;
+    return 0;
+}
+
+inode_store_t ramdisk = { ram_getsize, ram_setsize, ram_read, ram_write, NULL };
+int ncached, free_space;
+inode_intf cache, fs;
+
+/* Open the file system on the RAM store, as sys_file does at boot */
+void fs_mount() {
+    cache = ncached? cachedisk_init(&ramdisk, ncached) : NULL;
+    fs = treedisk_init(cache? cache : &ramdisk, 0);
+}
+
+void fs_unmount() {
+    if (cache) cachedisk_sync(cache);
+}
+
+void fs_format() {
+    memset(disk, 0, FS_DISK_SIZE);
+    assert(treedisk_create(&ramdisk, 0, NINODES, free_space) >= 0);
+    fs_mount();
+}
+
+/* The content of a block is determined by its tag; tag 0 is a hole */
+void block_fill(block_t *block, unsigned int tag) {
+    unsigned int *word = (void*)block;
+    for (int i = 0; i < BLOCK_SIZE / sizeof(int); i++)
+        word[i] = tag? tag * 2654435761u + i : 0;
+}
+
+/* Benchmarks */
+#define NFILES       16
+#define FILE_NBLOCKS 192          /* needs two levels of indirect blocks */
+#define NMETA_FILES  (NINODES - 1)
+
+struct timespec t0;
+unsigned long reads0, writes0;
+
+void bench_start() {
+    reads0 = nreads;
+    writes0 = nwrites;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+}
+
+void bench_end(char *name, int nops) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("%-12s %8d ops %8.2f reads/op %8.2f writes/op %10.1f ns/op\n", name, nops,
+           (double)(nreads - reads0) / nops, (double)(nwrites - writes0) / nops, ns / nops);
+}
+
+/* The average number of runs of contiguous blocks below per file */
+double runs_per_file() {
+    struct treedisk_extent runs[FILE_NBLOCKS];
+    int nruns = 0;
+    for (int ino = 1; ino <= NFILES; ino++)
+        nruns += treedisk_extents(fs, ino, 0, FILE_NBLOCKS, runs, FILE_NBLOCKS);
+    return (double)nruns / NFILES;
+}
+
+void bench() {
+    block_t block;
+    fs_format();
+
+    bench_start();
+    for (int ino = 1; ino <= NFILES; ino++)
+        for (int off = 0; off < FILE_NBLOCKS; off++) {
+            block_fill(&block, ino * FILE_NBLOCKS + off);
+            fs->write(fs, ino, off, &block);
+        }
+    bench_end("seq_write", NFILES * FILE_NBLOCKS);
+    printf("%-12s %8.2f runs/file\n", "seq_write", runs_per_file());
+
+    bench_start();
+    for (int ino = 1; ino <= NFILES; ino++)
+        for (int off = 0; off < FILE_NBLOCKS; off++) fs->read(fs, ino, off, &block);
+    bench_end("seq_read", NFILES * FILE_NBLOCKS);
+
+    bench_start();
+    for (int i = 0; i < NFILES * FILE_NBLOCKS; i++)
+        fs->read(fs, 1 + rand() % NFILES, rand() % FILE_NBLOCKS, &block);
+    bench_end("rand_read", NFILES * FILE_NBLOCKS);
+
+    bench_start();
+    for (int i = 0; i < NFILES * FILE_NBLOCKS; i++) {
+        block_fill(&block, i + 1);
+        fs->write(fs, 1 + rand() % NFILES, rand() % FILE_NBLOCKS, &block);
+    }
+    bench_end("rand_write", NFILES * FILE_NBLOCKS);
+
+    /* Files written after reserving their blocks, as mkfs does */
+    fs_unmount();
+    fs_format();
+    bench_start();
+    for (int ino = 1; ino <= NFILES; ino++) {
+        assert(treedisk_reserve(fs, ino, FILE_NBLOCKS) == 0);
+        for (int off = 0; off < FILE_NBLOCKS; off++) {
+            block_fill(&block, ino * FILE_NBLOCKS + off);
+            fs->write(fs, ino, off, &block);
+        }
+    }
+    bench_end("rsv_write", NFILES * FILE_NBLOCKS);
+    printf("%-12s %8.2f runs/file\n", "rsv_write", runs_per_file());
+
+    /* Small files: one block each, then their sizes and contents */
+    fs_unmount();
+    fs_format();
+    bench_start();
+    for (int ino = 1; ino <= NMETA_FILES; ino++) {
+        block_fill(&block, ino);
+        fs->write(fs, ino, 0, &block);
+    }
+    for (int ino = 1; ino <= NMETA_FILES; ino++) fs->getsize(fs, ino);
+    for (int ino = 1; ino <= NMETA_FILES; ino++) fs->read(fs, ino, 0, &block);
+    bench_end("meta", 3 * NMETA_FILES);
+    fs_unmount();
+}
+
+/* Stress test against a reference model */
+#define MAX_NBLOCKS  200
+unsigned int model[NFILES + 1][MAX_NBLOCKS], model_size[NFILES + 1];
+
+void check(int ok, char *op, int ino, int off, int nop) {
+    if (ok) return;
+    fprintf(stderr, "[FATAL] fsbench: op #%d %s ino=%d off=%d differs from the model\n",
+            nop, op, ino, off);
+    exit(1);
+}
+
+void stress(int nops) {
+    block_t block, expected;
+    int nsetsize = 0, nunsupported = 0;
+    memset(model, 0, sizeof(model));
+    memset(model_size, 0, sizeof(model_size));
+    fs_format();
+
+    for (int i = 0; i < nops; i++) {
+        int ino = 1 + rand() % NFILES, size = model_size[ino], r = rand() % 100, off;
+
+        if (r < 45) {
+            off = rand() % (size + 8 < MAX_NBLOCKS? size + 8 : MAX_NBLOCKS);
+            if (rand() % 1000 == 0 && size + 16 < MAX_NBLOCKS)
+                treedisk_reserve(fs, ino, 1 + rand() % 16);
+            model[ino][off] = i + 1;
+            block_fill(&block, i + 1);
+            check(fs->write(fs, ino, off, &block) == 0, "write", ino, off, i);
+            if (off >= size) model_size[ino] = off + 1;
+        } else if (r < 90) {
+            off = rand() % (size + 2);
+            int ret = fs->read(fs, ino, off, &block);
+            check(ret == (off < size? 0 : -1), "read", ino, off, i);
+            block_fill(&expected, off < size? model[ino][off] : 0);
+            check(ret < 0 || memcmp(&block, &expected, BLOCK_SIZE) == 0, "read", ino, off, i);
+        } else if (r < 95) {
+            check(fs->getsize(fs, ino) == size, "getsize", ino, 0, i);
+        } else if (r < 99) {
+            /* Files may not support resizing, and then stay unchanged */
+            off = rand() % (size + 8 < MAX_NBLOCKS? size + 8 : MAX_NBLOCKS);
+            nsetsize++;
+            int old_size = fs->setsize(fs, ino, off);
+            if (old_size < 0) {
+                nunsupported++;
+                continue;
+            }
+            check(old_size == size, "setsize", ino, off, i);
+            for (int b = off; b < MAX_NBLOCKS; b++) model[ino][b] = 0;
+            model_size[ino] = off;
+        } else {
+            /* Everything must survive a fresh mount */
+            fs_unmount();
+            fs_mount();
+        }
+    }
+    fs_unmount();
+
+    printf("stress       %8d ops passed", nops);
+    if (nunsupported) printf(", setsize unsupported in %d of %d", nunsupported, nsetsize);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    int seed = 1, nops = 100000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-c")) ncached = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-s")) seed = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-n")) nops = atoi(argv[i + 1]);
+    }
+    for (free_space = TREEDISK_FREE_LIST; free_space <= TREEDISK_FREE_BITMAP; free_space++) {
+        srand(seed);
+        printf("[INFO] treedisk with a free %s on a RAM store, %d cached blocks, seed %d\n",
+               free_space == TREEDISK_FREE_LIST? "list" : "bitmap", ncached, seed);
+        bench();
+        stress(nops);
+    }
+    return 0;
+}
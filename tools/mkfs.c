@@ -10,6 +10,9 @@
  *     the next  1MB contains some ELF binary executables for booting;
  *     the last  2MB is managed by a file system.
  * The output is in binary format (disk.img).
+ * With -z, the segments of the kernel binaries are LZ4-compressed, see
+ * library/elf/elf.h, so that booting reads fewer blocks.  Otherwise the
+ * kernel processes are prepared to execute in place from the ROM.
  */
 
 #include <stdio.h>
@@ -21,6 +24,8 @@
 
 #include "disk.h"
 #include "file.h"
+#include "servers.h"
+#include "elf.h"
 
 #define NKERNEL_PROC 5
 char* kernel_processes[] = {
@@ -35,8 +40,11 @@ char* kernel_processes[] = {
 #4: /home/lorenzo  #5: /home/yunhao/README  #6: /bin          #7: /bin/echo
 #8: /bin/cat       #9: /bin/ls              #10:/bin/cd       #11:/bin/pwd
 #12:/bin/clock     #13:/bin/crash1          #14:/bin/crash2   #15:/bin/ult
+#16:/bin/sysbench  #17:/bin/top             #18:/bin/prof     #19:/bin/trace
+#20:/bin/bench_page #21:/bin/bench_fs       #22:/bin/bench_ipc #23:/bin/bench_spawn
+#24:/bin/wc         #25:/bin/stat           #26:/bin/sync
 */
-#define NINODE 16
+#define NINODE 27
 char* contents[] = {
                     "./   0 ../   0 home/   1 bin/   6 ",
                     "./   1 ../   0 yunhao/   2 rvr/   3 lorenzo/   4 ",
@@ -44,7 +52,7 @@ char* contents[] = {
                     "./   3 ../   1 ",
                     "./   4 ../   1 ",
                     "With only 2000 lines of code, egos-2000 implements boot loader, microSD driver, tty driver, memory paging, address translation, interrupt handling, process scheduling and messaging, system call, file system, shell, 7 user commands and the `mkfs/mkrom` tools.",
-                    "./   6 ../   0 echo   7 cat   8 ls   9 cd  10 pwd  11 clock  12 crash1  13 crash2  14 ult  15 ",
+                    "./   6 ../   0 echo   7 cat   8 ls   9 cd  10 pwd  11 clock  12 crash1  13 crash2  14 ult  15 sysbench  16 top  17 prof  18 trace  19 bench_page  20 bench_fs  21 bench_ipc  22 bench_spawn  23 wc  24 stat  25 sync  26 ",
                     "#../build/release/echo.elf",
                     "#../build/release/cat.elf",
                     "#../build/release/ls.elf",
@@ -53,14 +61,37 @@ char* contents[] = {
                     "#../build/release/clock.elf",
                     "#../build/release/crash1.elf",
                     "#../build/release/crash2.elf",
-                    "#../build/release/ult.elf"};
+                    "#../build/release/ult.elf",
+                    "#../build/release/sysbench.elf",
+                    "#../build/release/top.elf",
+                    "#../build/release/prof.elf",
+                    "#../build/release/trace.elf",
+                    "#../build/release/bench_page.elf",
+                    "#../build/release/bench_fs.elf",
+                    "#../build/release/bench_ipc.elf",
+                    "#../build/release/bench_spawn.elf",
+                    "#../build/release/wc.elf",
+                    "#../build/release/stat.elf",
+                    "#../build/release/sync.elf"};
 
 char fs[FS_DISK_SIZE], exec[GRASS_EXEC_SIZE];
 
 void mkfs();
 inode_intf ramdisk_init();
 
-int main() {
+/* Directories are written in the hashed format unless mkfs is run with
+ * -t, which keeps the legacy single-block text format; free space is
+ * kept in a bitmap unless mkfs is run with -f, which keeps the free list */
+int text_dirs, lz4, free_list;
+int compress_elf(char* elf, int size, char* dst);
+int prepare_xip(char* elf, int size, int max_size);
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t")) text_dirs = 1;
+        if (!strcmp(argv[i], "-z")) lz4 = 1;
+        if (!strcmp(argv[i], "-f")) free_list = 1;
+    }
     mkfs();
 
     /* Paging area */
@@ -82,11 +113,22 @@ int main() {
         for (int nread = 0; nread < st.st_size; )
             nread += read(0, exec + nread, exec_size - nread);
 
-        write(1, exec, st.st_size);
+        int size = st.st_size;
+        if (!lz4 && i > 0) {
+            size = prepare_xip(exec, st.st_size, exec_size);
+            fprintf(stderr, "[INFO] %d pages can execute in place\n", exec[ELF_IDENT_XIP]);
+        }
+        if (lz4) {
+            size = compress_elf(exec, st.st_size, exec + exec_size);
+            assert(size <= exec_size);
+            memcpy(exec, exec + exec_size, size);
+            fprintf(stderr, "[INFO] Compressed to %d bytes\n", size);
+        }
+        write(1, exec, size);
 
         /* Fill 0s as padding */
         memset(exec, 0, GRASS_EXEC_SIZE);
-        write(1, exec, exec_size - st.st_size);
+        write(1, exec, exec_size - size);
     }
     memset(exec, 0, GRASS_EXEC_SIZE);
     write(1, exec, (GRASS_NEXEC - NKERNEL_PROC) * exec_size);
@@ -100,17 +142,167 @@ int main() {
 }
 
 
+/* LZ4 block compression of n bytes from src into dst, greedy with a
+ * hash table of 4-byte sequences; return the compressed size.  As the
+ * format requires, the last 5 bytes are literals and no match starts in
+ * the last 12 bytes */
+#define LZ4_HASH_BITS 12
+#define READ32(p) (*(unsigned int*)(p))
+
+static unsigned char* lz4_length(unsigned char* out, int len) {
+    for (len -= 15; len >= 255; len -= 255) *out++ = 255;
+    *out++ = len;
+    return out;
+}
+
+static unsigned char* lz4_sequence(unsigned char* out, unsigned char* lit, int nlit,
+                                   int offset, int mlen) {
+    int m = mlen? mlen - 4 : 0;
+    *out++ = ((nlit < 15)? nlit : 15) << 4 | ((m < 15)? m : 15);
+    if (nlit >= 15) out = lz4_length(out, nlit);
+    memcpy(out, lit, nlit);
+    out += nlit;
+    if (mlen == 0) return out;
+
+    *out++ = offset & 0xFF;
+    *out++ = offset >> 8;
+    if (m >= 15) out = lz4_length(out, m);
+    return out;
+}
+
+int lz4_compress(unsigned char* src, int n, unsigned char* dst) {
+    int table[1 << LZ4_HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    unsigned char* out = dst;
+    int anchor = 0;
+    for (int i = 0; i < n - 12; ) {
+        unsigned int h = (READ32(src + i) * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        int ref = table[h];
+        table[h] = i;
+        if (ref < 0 || i - ref > 0xFFFF || READ32(src + ref) != READ32(src + i)) {
+            i++;
+            continue;
+        }
+
+        int len = 4;
+        while (i + len < n - 5 && src[ref + len] == src[i + len]) len++;
+        out = lz4_sequence(out, src + anchor, i - anchor, i - ref, len);
+        anchor = (i += len);
+    }
+    out = lz4_sequence(out, src + anchor, n - anchor, 0, 0);
+    return out - dst;
+}
+
+/* Write elf to dst with each loaded segment compressed in chunks of
+ * ELF_LZ4_CHUNK bytes, starting at a block boundary; return the size */
+int compress_elf(char* elf, int size, char* dst) {
+    struct elf32_header* header = (void*)dst;
+    struct elf32_program_header* pheader;
+    assert(((struct elf32_header*)elf)->e_phoff + sizeof(*pheader) *
+           ((struct elf32_header*)elf)->e_phnum <= BLOCK_SIZE);
+
+    memcpy(dst, elf, BLOCK_SIZE);
+    header->e_ident[ELF_IDENT_LZ4] = 1;
+    pheader = (void*)(dst + header->e_phoff);
+
+    int off = BLOCK_SIZE;
+    for (int i = 0; i < header->e_phnum; i++) {
+        if (pheader[i].p_memsz == 0 || pheader[i].p_filesz == 0) continue;
+        assert(pheader[i].p_offset + pheader[i].p_filesz <= size);
+
+        unsigned char* src = (void*)(elf + pheader[i].p_offset);
+        pheader[i].p_offset = off;
+        for (int pos = 0; pos < pheader[i].p_filesz; pos += ELF_LZ4_CHUNK) {
+            int n = pheader[i].p_filesz - pos;
+            off += lz4_compress(src + pos, (n < ELF_LZ4_CHUNK)? n : ELF_LZ4_CHUNK,
+                                (void*)(dst + off));
+        }
+        off = (off + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    }
+    return off;
+}
+
+/* Record in e_ident how many leading pages of the app segment hold no
+ * writable section and page-align the segment in the file, so that the
+ * pages can be mapped from the ROM; return the new size */
+#define PAGE_SIZE 4096                  /* see library/egos.h */
+
+int prepare_xip(char* elf, int size, int max_size) {
+    struct elf32_header* header = (void*)elf;
+    struct elf32_program_header* pheader = (void*)(elf + header->e_phoff);
+    struct elf32_section_header* sheader = (void*)(elf + header->e_shoff);
+
+    for (int i = 0; i < header->e_phnum; i++) {
+        struct elf32_program_header* p = &pheader[i];
+        if (p->p_memsz == 0) continue;
+
+        unsigned int writable = p->p_vaddr + p->p_memsz;
+        for (int j = 0; j < header->e_shnum; j++)
+            if ((sheader[j].sh_flags & (SHF_ALLOC | SHF_WRITE)) == (SHF_ALLOC | SHF_WRITE) &&
+                sheader[j].sh_size && sheader[j].sh_addr < writable)
+                writable = sheader[j].sh_addr;
+
+        int npages = (writable - p->p_vaddr) / PAGE_SIZE;
+        if (npages > p->p_filesz / PAGE_SIZE) npages = p->p_filesz / PAGE_SIZE;
+        elf[ELF_IDENT_XIP] = npages;
+
+        if (p->p_offset % PAGE_SIZE) {
+            int offset = (p->p_offset + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+            assert(offset + p->p_filesz <= max_size);
+            memmove(elf + offset, elf + p->p_offset, p->p_filesz);
+            p->p_offset = offset;
+            if (offset + p->p_filesz > size) size = offset + p->p_filesz;
+        }
+    }
+    return size;
+}
+
+/* Convert a text directory of "name ino " pairs into the hashed format;
+ * the table is sized to stay at most 3/4 full, with at least 2 blocks */
+int mkdir_hashed(char* text, char* dst) {
+    char name[DIR_NAME_SIZE];
+    int nentries = 0, nblocks = 2, ino, len;
+    for (char* p = text; sscanf(p, "%31s %d%n", name, &ino, &len) == 2; p += len)
+        nentries++;
+    while (nentries > (DIR_NSLOTS(nblocks) - 1) * 3 / 4) nblocks++;
+
+    memset(dst, 0, nblocks * BLOCK_SIZE);
+    struct dir_header* header = (void*)dst;
+    header->magic = DIR_MAGIC;
+    header->nblocks = nblocks;
+
+    struct dir_entry* entries = (void*)dst;
+    for (char* p = text; sscanf(p, "%31s %d%n", name, &ino, &len) == 2; p += len) {
+        assert(strlen(name) < DIR_ENTRY_NAME_SIZE);
+        unsigned int hash = dir_hash(name);
+        int slot = dir_slot(hash, nblocks);
+        while (entries[slot].hash != DIR_HASH_EMPTY)
+            slot = (slot + 1 == DIR_NSLOTS(nblocks))? 1 : slot + 1;
+
+        entries[slot].hash = hash;
+        entries[slot].ino = ino;
+        strcpy(entries[slot].name, name);
+    }
+    return nblocks;
+}
+
 void mkfs() {
     inode_intf ramdisk = ramdisk_init();
-    assert(treedisk_create(ramdisk, 0, NINODES) >= 0);
+    assert(treedisk_create(ramdisk, 0, NINODES, free_list? TREEDISK_FREE_LIST : TREEDISK_FREE_BITMAP) >= 0);
     inode_intf treedisk = treedisk_init(ramdisk, 0);
 
     char buf[GRASS_EXEC_SIZE / GRASS_NEXEC];
     for (int ino = 0; ino < NINODE; ino++) {
-        if (contents[ino][0] != '#') {
+        if (contents[ino][0] != '#' && (text_dirs || strncmp(contents[ino], "./", 2))) {
             fprintf(stderr, "[INFO] Loading ino=%d, %ld bytes\n", ino, strlen(contents[ino]));
             strncpy(buf, contents[ino], BLOCK_SIZE);
             treedisk->write(treedisk, ino, 0, (void*)buf);
+        } else if (contents[ino][0] != '#') {
+            int nblocks = mkdir_hashed(contents[ino], buf);
+            fprintf(stderr, "[INFO] Loading ino=%d, directory of %d blocks\n", ino, nblocks);
+            for (int b = 0; b < nblocks; b++)
+                treedisk->write(treedisk, ino, b, (void*)(buf + b * BLOCK_SIZE));
         } else {
             struct stat st;
             char* file_name = &contents[ino][1];
@@ -121,6 +313,8 @@ void mkfs() {
                 nread += read(0, buf + nread, st.st_size - nread);
             
             fprintf(stderr, "[INFO] Loading ino=%d, %s: %d bytes\n", ino, file_name, (int)st.st_size);
+            int nblocks = (st.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            if (nblocks > 0) assert(treedisk_reserve(treedisk, ino, nblocks) == 0);
             for (int b = 0; b * BLOCK_SIZE < st.st_size; b++)
                 treedisk->write(treedisk, ino, b, (void*)(buf + b * BLOCK_SIZE));
         }
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# (C) 2022, Cornell University
+# All rights reserved.
+#
+# Description: resolve the samples of "prof dump" to functions
+# Copy the "PROF pid pc count" lines printed by apps/user/prof.c into a file
+# and run this script from the repository root after "make":
+#     python3 tools/prof.py samples.txt [pid=app ...]
+# Samples are matched against the listings in build/debug/*.lst; addresses
+# in the app region need to know which app ran as each pid, which is fixed
+# for the system processes and given as e.g. "5=ult" for user processes.
+
+import re
+import sys
+from collections import defaultdict
+
+DEBUG = "build/debug"
+APPS_START, APPS_END = 0x08005000, 0x08008000
+GRASS_START = 0x08002800
+SYSTEM_PIDS = {1: "sys_proc", 2: "sys_file", 3: "sys_dir", 4: "sys_shell"}
+
+symbol_line = re.compile(r"^([0-9a-f]{8}) <(.+)>:$")
+listings = {}
+
+def load(name):
+    """Return the sorted (address, function) list of build/debug/name.lst"""
+    if name not in listings:
+        symbols = []
+        try:
+            with open("%s/%s.lst" % (DEBUG, name)) as f:
+                for line in f:
+                    m = symbol_line.match(line.strip())
+                    if m: symbols.append((int(m.group(1), 16), m.group(2)))
+        except OSError:
+            print("prof.py: cannot read %s/%s.lst" % (DEBUG, name), file=sys.stderr)
+        listings[name] = sorted(symbols)
+    return listings[name]
+
+def resolve(pid, pc, apps):
+    if APPS_START <= pc < APPS_END: name = apps.get(pid)
+    elif GRASS_START <= pc < APPS_START: name = "grass"
+    else: name = "earth"
+    if name is None: return "pid%d" % pid, "?"
+
+    func = "?"
+    for addr, sym in load(name):
+        if addr > pc: break
+        func = sym
+    return name, func
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: prof.py samples.txt [pid=app ...]", file=sys.stderr)
+        sys.exit(1)
+
+    apps = dict(SYSTEM_PIDS)
+    for arg in sys.argv[2:]:
+        pid, app = arg.split("=")
+        apps[int(pid)] = app
+
+    counts, total = defaultdict(int), 0
+    with open(sys.argv[1]) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) != 4 or fields[0] != "PROF": continue
+            pid, pc, count = int(fields[1]), int(fields[2], 16), int(fields[3])
+            counts[resolve(pid, pc, apps)] += count
+            total += count
+
+    print("%7s %6s  %-10s %s" % ("samples", "%", "binary", "function"))
+    for (name, func), count in sorted(counts.items(), key=lambda x: -x[1]):
+        print("%7d %5.1f%%  %-10s %s" % (count, 100.0 * count / total, name, func))
+
+if __name__ == "__main__":
+    main()